@@ -0,0 +1,172 @@
+/*
+cartotype_area.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_AREA_H__
+#define CARTOTYPE_AREA_H__
+
+#include <cartotype_base.h>
+
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+Gets the area in square metres and the length in metres of a polygon or polyline made of aCount points
+whose longitudes and latitudes in degrees are in the separate arrays aLong and aLat, assuming a spherical earth
+with radius KEquatorialRadiusInMetres.
+
+The area is the absolute value of the spherical polygon area given by the formula of Chamberlain and Duquette, and is zero for polylines;
+the length is the sum of the great-circle distances between successive points, including the closing segment for polygons.
+The sine and cosine of each latitude are calculated once and stored in contiguous arrays, and the sums are accumulated
+in separate loops without branches, so that they can be vectorized. aArea and aLength may be null if the value is not needed.
+*/
+inline void GetSphericalAreaAndLength(const double* aLong,const double* aLat,size_t aCount,bool aIsPolyline,double* aArea,double* aLength)
+    {
+    if (aArea)
+        *aArea = 0;
+    if (aLength)
+        *aLength = 0;
+    if (aCount < 2)
+        return;
+
+    // Small contours, such as buildings, use a buffer on the stack to avoid allocating memory.
+    const size_t KStackPoints = 64;
+    double stack_buffer[KStackPoints * 3];
+    std::vector<double> heap_buffer;
+    double* buffer = stack_buffer;
+    if (aCount > KStackPoints)
+        {
+        heap_buffer.resize(aCount * 3);
+        buffer = heap_buffer.data();
+        }
+    double* sin_lat = buffer;
+    double* cos_lat = buffer + aCount;
+    double* lng = buffer + aCount * 2;
+    for (size_t i = 0; i < aCount; i++)
+        {
+        double lat = aLat[i] * KDegreesToRadiansDouble;
+        sin_lat[i] = std::sin(lat);
+        cos_lat[i] = std::cos(lat);
+        lng[i] = aLong[i] * KDegreesToRadiansDouble;
+        }
+
+    if (aArea && !aIsPolyline && aCount >= 3)
+        {
+        // The sum of (long[i + 1] - long[i - 1]) * sin(lat[i]), with the two wrapped-around points handled separately.
+        double sum[4] = { };
+        size_t i = 1;
+        for (; i + 4 < aCount; i += 4)
+            for (size_t k = 0; k < 4; k++)
+                sum[k] += (lng[i + k + 1] - lng[i + k - 1]) * sin_lat[i + k];
+        for (; i < aCount - 1; i++)
+            sum[0] += (lng[i + 1] - lng[i - 1]) * sin_lat[i];
+        sum[1] += (lng[1] - lng[aCount - 1]) * sin_lat[0];
+        sum[2] += (lng[0] - lng[aCount - 2]) * sin_lat[aCount - 1];
+        double area = (sum[0] + sum[1] + sum[2] + sum[3]) * double(KEquatorialRadiusInMetres) * double(KEquatorialRadiusInMetres) / 2.0;
+        *aArea = std::fabs(area);
+        }
+
+    if (aLength)
+        {
+        // Great-circle distances using the same formula as GreatCircleDistanceInMeters.
+        size_t segments = aIsPolyline ? aCount - 1 : aCount;
+        double length = 0;
+        for (size_t i = 0; i < segments; i++)
+            {
+            size_t j = i + 1 < aCount ? i + 1 : 0;
+            double cos_angle = sin_lat[i] * sin_lat[j] + cos_lat[i] * cos_lat[j] * std::cos(lng[j] - lng[i]);
+            length += std::acos(std::min(cos_angle,1.0));
+            }
+        *aLength = length * KEquatorialRadiusInMetres;
+        }
+    }
+
+/**
+Gets the areas and lengths of an array of polygons or polylines, as defined for GetSphericalAreaAndLength,
+whose points are stored in the arrays aLong and aLat. Contour i consists of the points from aContourEnd[i - 1]
+(or 0 if i is 0) up to but not including aContourEnd[i]. The results for contour i are stored in aAreaArray[i] and aLengthArray[i];
+either array may be null if the values are not needed.
+
+If aThreadCount is greater than 1 the contours are divided between that number of threads; if it is zero the number of hardware threads is used.
+Returns the total area of all the contours.
+*/
+inline double GetSphericalAreasAndLengths(const double* aLong,const double* aLat,const size_t* aContourEnd,size_t aContourCount,bool aIsPolyline,
+                                          double* aAreaArray,double* aLengthArray,size_t aThreadCount = 1)
+    {
+    if (aContourCount == 0)
+        return 0;
+    if (aThreadCount == 0)
+        aThreadCount = std::max(std::thread::hardware_concurrency(),1U);
+
+    // Contours are processed in batches to keep the cost of the shared counter low when there are millions of small polygons.
+    const size_t batch_size = 256;
+    size_t batch_count = (aContourCount + batch_size - 1) / batch_size;
+    aThreadCount = std::min(aThreadCount,batch_count);
+    std::vector<double> thread_total(aThreadCount);
+    std::atomic<size_t> next_batch { 0 };
+    auto worker = [&](size_t aThreadIndex)
+        {
+        double total = 0;
+        for (;;)
+            {
+            size_t batch = next_batch++;
+            if (batch >= batch_count)
+                break;
+            size_t end = std::min((batch + 1) * batch_size,aContourCount);
+            for (size_t i = batch * batch_size; i < end; i++)
+                {
+                size_t start = i ? aContourEnd[i - 1] : 0;
+                double area = 0, length = 0;
+                GetSphericalAreaAndLength(aLong + start,aLat + start,aContourEnd[i] - start,aIsPolyline,&area,aLengthArray ? &length : nullptr);
+                if (aAreaArray)
+                    aAreaArray[i] = area;
+                if (aLengthArray)
+                    aLengthArray[i] = length;
+                total += area;
+                }
+            }
+        thread_total[aThreadIndex] = total;
+        };
+
+    std::vector<std::thread> thread_array;
+    for (size_t i = 1; i < aThreadCount; i++)
+        thread_array.emplace_back(worker,i);
+    worker(0);
+    for (auto& t : thread_array)
+        t.join();
+    double total = 0;
+    for (double t : thread_total)
+        total += t;
+    return total;
+    }
+
+/**
+Gets the planar areas of an array of polygons whose points are stored in the arrays aX and aY, using the same
+contour layout as GetSphericalAreasAndLengths, and stores them in aAreaArray, which may be null.
+The areas are signed: positive for polygons going anticlockwise if the y axis points upwards.
+Returns the sum of the absolute values of the areas.
+*/
+inline double GetAreas(const double* aX,const double* aY,const size_t* aContourEnd,size_t aContourCount,double* aAreaArray)
+    {
+    double total = 0;
+    for (size_t i = 0; i < aContourCount; i++)
+        {
+        size_t start = i ? aContourEnd[i - 1] : 0;
+        double area = Area(aX + start,aY + start,aContourEnd[i] - start);
+        if (aAreaArray)
+            aAreaArray[i] = area;
+        total += std::fabs(area);
+        }
+    return total;
+    }
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_AREA_H__
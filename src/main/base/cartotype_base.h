@@ -1054,6 +1054,28 @@ template<class contour_t> inline double Area(const contour_t& aContour)
     return Area(aContour.data(),aContour.size());
     }
 
+/**
+Returns the area of a polygon whose x and y coordinates are stored in separate arrays.
+The sum is accumulated in four independent parts so that the loop can be vectorized.
+The result is the same as that of the other Area functions, apart from rounding.
+*/
+inline double Area(const double* aX,const double* aY,size_t aPointCount)
+    {
+    if (aPointCount < 3)
+        return 0;
+    // Use the shoelace formula relative to the first point to reduce rounding errors: sum of x[i] * (y[i + 1] - y[i - 1]).
+    double ox = aX[0], oy = aY[0];
+    double sum[4] = { };
+    size_t n = aPointCount;
+    size_t i = 1;
+    for (; i + 4 < n; i += 4)
+        for (size_t k = 0; k < 4; k++)
+            sum[k] += (aX[i + k] - ox) * ((aY[i + k + 1] - oy) - (aY[i + k - 1] - oy));
+    for (; i < n; i++)
+        sum[0] += (aX[i] - ox) * ((aY[(i + 1) % n] - oy) - (aY[i - 1] - oy));
+    return (sum[0] + sum[1] + sum[2] + sum[3]) / 2.0;
+    }
+
 double SphericalPolygonArea(const TCoordSet& aCoordSet) noexcept;
 double SphericalPolylineLength(const TCoordSet& aCoordSet) noexcept;
 double SphericalPolygonArea(std::function<const TPointFP*()> aNextPoint);
@@ -0,0 +1,636 @@
+/*
+cartotype_block_cache.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_BLOCK_CACHE_H__
+#define CARTOTYPE_BLOCK_CACHE_H__
+
+#include <cartotype_memory_budget.h>
+#include <cartotype_stream.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace CartoType
+{
+
+/**
+The identity of a file, independent of the name used to open it. It changes when the file
+is modified, or replaced by another file with the same name.
+*/
+class TFileIdentity
+    {
+    public:
+    /** Creates an empty identity, which does not refer to any file. */
+    TFileIdentity() = default;
+    /** Gets the identity of the file aFileName; the identity is empty if the file does not exist. */
+    explicit TFileIdentity(const std::string& aFileName)
+        {
+#if defined(_MSC_VER)
+        struct _stat64 s;
+        if (_stat64(aFileName.c_str(),&s))
+            return;
+#else
+        struct stat s;
+        if (stat(aFileName.c_str(),&s))
+            return;
+#endif
+        iDevice = uint64_t(s.st_dev);
+        iInode = uint64_t(s.st_ino);
+        iSize = uint64_t(s.st_size);
+        iModificationTime = int64_t(s.st_mtime);
+        iExists = true;
+        }
+
+    /**
+    Returns true if both identities refer to the same file, whatever names were used to open it.
+    Returns false if the file system does not provide file serial numbers.
+    */
+    bool SameFile(const TFileIdentity& aOther) const
+        {
+        return iExists && aOther.iExists && iInode && iDevice == aOther.iDevice && iInode == aOther.iInode;
+        }
+    /** Returns true if the identities are the same, including the size and modification time. */
+    bool operator==(const TFileIdentity& aOther) const { return Tie() == aOther.Tie(); }
+    /** Returns true if the identities are different. */
+    bool operator!=(const TFileIdentity& aOther) const { return !(*this == aOther); }
+    /** An ordering allowing identities to be used as keys. */
+    bool operator<(const TFileIdentity& aOther) const { return Tie() < aOther.Tie(); }
+
+    /** True if the file exists. */
+    bool iExists = false;
+    /** The device containing the file. */
+    uint64_t iDevice = 0;
+    /** The file serial number (inode number); zero if the file system does not provide one. */
+    uint64_t iInode = 0;
+    /** The size of the file in bytes. */
+    uint64_t iSize = 0;
+    /** The time the file was last modified, in seconds since 1970. */
+    int64_t iModificationTime = 0;
+
+    private:
+    std::tuple<bool,uint64_t,uint64_t,uint64_t,int64_t> Tie() const { return std::make_tuple(iExists,iDevice,iInode,iSize,iModificationTime); }
+    };
+
+/** Statistics for a CBlockCache. */
+class TBlockCacheStatistics
+    {
+    public:
+    /** The number of lookups that found the block. */
+    uint64_t iHitCount = 0;
+    /** The number of lookups that did not find the block. */
+    uint64_t iMissCount = 0;
+    /** The number of blocks inserted. */
+    uint64_t iInsertCount = 0;
+    /** The number of blocks evicted to make room for others or to reduce the memory used; blocks removed by Clear or Invalidate are not counted. */
+    uint64_t iEvictionCount = 0;
+    /** The number of blocks in the cache. */
+    uint64_t iBlockCount = 0;
+    /** The number of bytes of data in the cache. */
+    uint64_t iByteCount = 0;
+
+    /** Returns the proportion of lookups that found the block, or zero if there have been no lookups. */
+    double HitRate() const { return iHitCount + iMissCount ? double(iHitCount) / double(iHitCount + iMissCount) : 0; }
+    };
+
+/**
+A cache of file blocks shared by all the streams reading the same files, so that
+copies of a stream used by different threads do not each hold their own copies of hot blocks.
+
+Blocks are identified by a file identifier, obtained from FileId, and a block number. The cache is divided
+into shards, each with its own lock, selected by hashing the key, so that threads reading
+different blocks rarely contend. Each shard evicts blocks using the CLOCK algorithm, which approximates
+least-recently-used eviction without reordering a list on every hit.
+
+Blocks are returned as shared pointers to immutable data, so a block remains valid
+for as long as the caller holds it, even if it is evicted.
+
+The cache can be controlled by a CMemoryBudget, set using SetMemoryBudget, for which it reports its hit rate as the value of its data.
+The cache requests space from the budget before it grows, and evicts its own blocks instead if the request is refused.
+
+Streams read files through the cache using CCachedFileInputStream, which returns pointers into the cached blocks
+instead of copying them.
+*/
+class CBlockCache: public MMemoryBudgetClient
+    {
+    public:
+    /** A block of data. */
+    using TBlock = std::shared_ptr<const std::vector<uint8_t>>;
+
+    /** Creates a block cache holding up to aCapacityInBytes of data. */
+    explicit CBlockCache(size_t aCapacityInBytes = KDefaultCapacity)
+        {
+        SetCapacity(aCapacityInBytes);
+        }
+    ~CBlockCache()
+        {
+        if (m_memory_budget)
+            m_memory_budget->Unregister(*this);
+        }
+
+    /** The default capacity in bytes. */
+    static constexpr size_t KDefaultCapacity = 64 * 1024 * 1024;
+    /** The number of shards. */
+    static constexpr size_t KShardCount = 16;
+
+    /** Returns the block cache shared by all the map files used by this process. */
+    static std::shared_ptr<CBlockCache> Shared()
+        {
+        static std::shared_ptr<CBlockCache> cache = std::make_shared<CBlockCache>();
+        return cache;
+        }
+
+    /**
+    Returns the identifier for a file read in blocks of aBlockSize bytes, allocating one if necessary.
+    Streams reading the same file with the same block size share an identifier and therefore share cached blocks.
+
+    The identifier depends on the file's identity as well as its name, so a file that has been replaced or modified,
+    such as a new version of a map published under the same name, gets a new identifier and never receives the old file's blocks.
+    */
+    uint32_t FileId(const std::string& aFileName,size_t aBlockSize)
+        {
+        return FileId(aFileName,aBlockSize,TFileIdentity(aFileName));
+        }
+    /**
+    Returns the identifier for data called aName, read in blocks of aBlockSize bytes, and stored in the file with the identity aFileIdentity.
+    This is used for data which is not a whole file, such as a compressed table within a file.
+    */
+    uint32_t FileId(const std::string& aName,size_t aBlockSize,const TFileIdentity& aFileIdentity)
+        {
+        std::lock_guard<std::mutex> lock(m_file_mutex);
+        auto key = std::make_tuple(aName,aBlockSize,aFileIdentity);
+        auto p = m_file_id.find(key);
+        if (p != m_file_id.end())
+            return p->second;
+        uint32_t id = uint32_t(m_file_id.size() + 1);
+        m_file_id[key] = id;
+        return id;
+        }
+
+    /** Returns a block, or null if it is not in the cache. */
+    TBlock Find(uint32_t aFileId,uint64_t aBlockNumber)
+        {
+        TKey key { aFileId,aBlockNumber };
+        auto& shard = Shard(key);
+        std::lock_guard<std::mutex> lock(shard.iMutex);
+        auto p = shard.iIndex.find(key);
+        if (p == shard.iIndex.end())
+            {
+            shard.iStatistics.iMissCount++;
+            return nullptr;
+            }
+        auto& slot = shard.iSlot[p->second];
+        slot.iReferenced = true;
+        shard.iStatistics.iHitCount++;
+        return slot.iData;
+        }
+    /** Returns true if a block is in the cache, without counting a hit or miss or marking the block as used. */
+    bool Contains(uint32_t aFileId,uint64_t aBlockNumber)
+        {
+        TKey key { aFileId,aBlockNumber };
+        auto& shard = Shard(key);
+        std::lock_guard<std::mutex> lock(shard.iMutex);
+        return shard.iIndex.count(key) != 0;
+        }
+
+    /**
+    Inserts a block, evicting others if necessary, and returns it. If the block is already in the cache
+    the existing block is returned and aData is discarded. Blocks larger than a shard's capacity are not cached.
+
+    If there is a memory budget, space is requested from it first. If the request is refused the block replaces
+    blocks already in its shard, so that the memory used does not grow; if there are not enough of them it is returned without being cached.
+    */
+    TBlock Insert(uint32_t aFileId,uint64_t aBlockNumber,std::vector<uint8_t>&& aData)
+        {
+        TKey key { aFileId,aBlockNumber };
+        auto& shard = Shard(key);
+        TBlock block = std::make_shared<const std::vector<uint8_t>>(std::move(aData));
+        size_t size = block->size();
+        size_t capacity = m_shard_capacity.load();
+        if (size > capacity)
+            return block;
+
+        // The request is made without holding a shard lock, because it may trim other caches, and other requests may trim this one.
+        std::shared_ptr<CMemoryBudget> budget = MemoryBudget();
+        bool granted = !budget || budget->Request(*this,size);
+        TBlock result = InsertInShard(shard,key,block,granted ? capacity - size : size_t(-1));
+        if (budget && granted)
+            budget->EndRequest(*this,size);
+        return result;
+        }
+
+    /**
+    Sets the memory budget controlling this cache, or removes it if aMemoryBudget is null. aMinimumBytes is the amount of memory the cache
+    may always keep, even when memory is short. Set the budget before the cache is used by more than one thread.
+    */
+    void SetMemoryBudget(std::shared_ptr<CMemoryBudget> aMemoryBudget,size_t aMinimumBytes = 0)
+        {
+        std::lock_guard<std::mutex> lock(m_budget_mutex);
+        if (m_memory_budget)
+            m_memory_budget->Unregister(*this);
+        m_memory_budget = aMemoryBudget;
+        if (m_memory_budget)
+            m_memory_budget->Register(*this,aMinimumBytes);
+        }
+    /** Returns the memory budget controlling this cache, or null if there is none. */
+    std::shared_ptr<CMemoryBudget> MemoryBudget() const
+        {
+        std::lock_guard<std::mutex> lock(m_budget_mutex);
+        return m_memory_budget;
+        }
+
+    /** Removes all the blocks belonging to a file; used when the file has been changed. */
+    void Invalidate(uint32_t aFileId)
+        {
+        for (auto& shard : m_shard)
+            {
+            std::lock_guard<std::mutex> lock(shard.iMutex);
+            for (size_t i = 0; i < shard.iSlot.size(); i++)
+                if (shard.iSlot[i].iData && shard.iSlot[i].iKey.iFileId == aFileId)
+                    RemoveLocked(shard,i);
+            }
+        }
+    /**
+    Removes all the blocks belonging to a file, whatever block size was used to read it,
+    including blocks of compressed tables in the file; used when the file has been replaced.
+    */
+    void Invalidate(const std::string& aFileName)
+        {
+        std::vector<uint32_t> id_array;
+            {
+            std::lock_guard<std::mutex> lock(m_file_mutex);
+            for (const auto& p : m_file_id)
+                {
+                const std::string& name = std::get<0>(p.first);
+                if (name == aFileName || (name.size() > aFileName.size() && name[aFileName.size()] == '#' && !name.compare(0,aFileName.size(),aFileName)))
+                    id_array.push_back(p.second);
+                }
+            }
+        for (auto id : id_array)
+            Invalidate(id);
+        }
+    /** Removes a single block; used when part of a file has been changed. */
+    void Invalidate(uint32_t aFileId,uint64_t aBlockNumber)
+        {
+        TKey key { aFileId,aBlockNumber };
+        auto& shard = Shard(key);
+        std::lock_guard<std::mutex> lock(shard.iMutex);
+        auto p = shard.iIndex.find(key);
+        if (p != shard.iIndex.end())
+            RemoveLocked(shard,p->second);
+        }
+    /** Removes all blocks. They are not counted as evictions. */
+    void Clear()
+        {
+        for (auto& shard : m_shard)
+            {
+            std::lock_guard<std::mutex> lock(shard.iMutex);
+            for (size_t i = 0; i < shard.iSlot.size(); i++)
+                if (shard.iSlot[i].iData)
+                    RemoveLocked(shard,i);
+            }
+        }
+
+    /** Sets the capacity in bytes, evicting blocks if necessary. */
+    void SetCapacity(size_t aCapacityInBytes)
+        {
+        size_t shard_capacity = aCapacityInBytes / KShardCount;
+        m_shard_capacity = shard_capacity;
+        for (auto& shard : m_shard)
+            {
+            std::lock_guard<std::mutex> lock(shard.iMutex);
+            EvictLocked(shard,shard_capacity);
+            }
+        }
+    /** Returns the capacity in bytes. */
+    size_t Capacity() const { return m_shard_capacity.load() * KShardCount; }
+
+    /** Returns the statistics summed over all shards. */
+    TBlockCacheStatistics Statistics() const
+        {
+        TBlockCacheStatistics s;
+        for (auto& shard : m_shard)
+            {
+            std::lock_guard<std::mutex> lock(shard.iMutex);
+            s.iHitCount += shard.iStatistics.iHitCount;
+            s.iMissCount += shard.iStatistics.iMissCount;
+            s.iInsertCount += shard.iStatistics.iInsertCount;
+            s.iEvictionCount += shard.iStatistics.iEvictionCount;
+            s.iBlockCount += shard.iIndex.size();
+            s.iByteCount += shard.iByteCount;
+            }
+        return s;
+        }
+    /** Resets the hit, miss, insertion and eviction counts to zero. */
+    void ResetStatistics()
+        {
+        for (auto& shard : m_shard)
+            {
+            std::lock_guard<std::mutex> lock(shard.iMutex);
+            shard.iStatistics = TBlockCacheStatistics();
+            }
+        }
+
+    // from MMemoryBudgetClient
+    const char* MemoryBudgetName() const override { return "block cache"; }
+    size_t MemoryUsed() const override { return size_t(Statistics().iByteCount); }
+    size_t TrimMemory(size_t aTargetBytes) override
+        {
+        size_t shard_target = aTargetBytes / KShardCount;
+        size_t used = 0;
+        for (auto& shard : m_shard)
+            {
+            std::lock_guard<std::mutex> lock(shard.iMutex);
+            EvictLocked(shard,shard_target);
+            used += shard.iByteCount;
+            }
+        return used;
+        }
+    double ValuePerByte() const override { return Statistics().HitRate(); }
+
+    CBlockCache(const CBlockCache&) = delete;
+    CBlockCache& operator=(const CBlockCache&) = delete;
+
+    private:
+    class TKey
+        {
+        public:
+        bool operator==(const TKey& aOther) const { return iFileId == aOther.iFileId && iBlockNumber == aOther.iBlockNumber; }
+
+        uint32_t iFileId = 0;
+        uint64_t iBlockNumber = 0;
+        };
+
+    class THash
+        {
+        public:
+        size_t operator()(const TKey& aKey) const
+            {
+            uint64_t h = (aKey.iBlockNumber ^ (uint64_t(aKey.iFileId) << 40)) * 0x9E3779B97F4A7C15ULL;
+            return size_t(h ^ (h >> 32));
+            }
+        };
+
+    class TSlot
+        {
+        public:
+        TKey iKey;
+        TBlock iData;
+        bool iReferenced = false;
+        };
+
+    class TShard
+        {
+        public:
+        mutable std::mutex iMutex;
+        std::unordered_map<TKey,size_t,THash> iIndex;
+        std::vector<TSlot> iSlot;
+        std::vector<size_t> iFreeSlot;
+        size_t iClockHand = 0;
+        size_t iByteCount = 0;
+        TBlockCacheStatistics iStatistics;
+        };
+
+    TShard& Shard(const TKey& aKey) { return m_shard[(THash()(aKey) >> 8) % KShardCount]; }
+
+    /*
+    Inserts a block into a shard, evicting blocks until the shard holds no more than aMaxBytes before the insertion.
+    If aMaxBytes is size_t(-1) the memory used must not grow: the block replaces existing blocks, or is not cached if there are not enough of them.
+    */
+    TBlock InsertInShard(TShard& aShard,const TKey& aKey,TBlock aBlock,size_t aMaxBytes)
+        {
+        std::lock_guard<std::mutex> lock(aShard.iMutex);
+        auto p = aShard.iIndex.find(aKey);
+        if (p != aShard.iIndex.end())
+            return aShard.iSlot[p->second].iData;
+        size_t size = aBlock->size();
+        if (aMaxBytes == size_t(-1))
+            {
+            if (aShard.iByteCount < size)
+                return aBlock;
+            aMaxBytes = aShard.iByteCount - size;
+            }
+        EvictLocked(aShard,aMaxBytes);
+
+        size_t index;
+        if (!aShard.iFreeSlot.empty())
+            {
+            index = aShard.iFreeSlot.back();
+            aShard.iFreeSlot.pop_back();
+            }
+        else
+            {
+            index = aShard.iSlot.size();
+            aShard.iSlot.emplace_back();
+            }
+        auto& slot = aShard.iSlot[index];
+        slot.iKey = aKey;
+        slot.iData = aBlock;
+        slot.iReferenced = false;
+        aShard.iIndex[aKey] = index;
+        aShard.iByteCount += size;
+        aShard.iStatistics.iInsertCount++;
+        return aBlock;
+        }
+
+    void RemoveLocked(TShard& aShard,size_t aIndex)
+        {
+        auto& slot = aShard.iSlot[aIndex];
+        aShard.iByteCount -= slot.iData->size();
+        aShard.iIndex.erase(slot.iKey);
+        slot.iData.reset();
+        aShard.iFreeSlot.push_back(aIndex);
+        }
+
+    // Evicts blocks using the CLOCK algorithm until the shard holds no more than aMaxBytes.
+    void EvictLocked(TShard& aShard,size_t aMaxBytes)
+        {
+        while (aShard.iByteCount > aMaxBytes && !aShard.iIndex.empty())
+            {
+            if (aShard.iClockHand >= aShard.iSlot.size())
+                aShard.iClockHand = 0;
+            auto& slot = aShard.iSlot[aShard.iClockHand];
+            if (slot.iData)
+                {
+                if (slot.iReferenced)
+                    slot.iReferenced = false;
+                else
+                    {
+                    RemoveLocked(aShard,aShard.iClockHand);
+                    aShard.iStatistics.iEvictionCount++;
+                    }
+                }
+            aShard.iClockHand++;
+            }
+        }
+
+    std::array<TShard,KShardCount> m_shard;
+    std::atomic<size_t> m_shard_capacity { 0 };
+    std::mutex m_file_mutex;
+    std::map<std::tuple<std::string,size_t,TFileIdentity>,uint32_t> m_file_id;
+    mutable std::mutex m_budget_mutex;
+    std::shared_ptr<CMemoryBudget> m_memory_budget;
+    };
+
+/**
+A file input stream that reads its data through a shared CBlockCache.
+
+Read returns a pointer into the cached block itself, which the stream holds until the next
+call to Read, so a block found in the cache is never copied, and the stream has no buffers of its own.
+Only blocks not found in the cache are read from the file, and they are then added to the cache.
+
+If there is no block cache the stream behaves in the same way as CFileInputStream.
+*/
+class CCachedFileInputStream: public CFileInputStream
+    {
+    public:
+    /** Creates a CCachedFileInputStream to read from the file aFileName using aBlockCache. Returns the result in aError. */
+    static std::unique_ptr<CCachedFileInputStream> New(TResult& aError,const std::string& aFileName,std::shared_ptr<CBlockCache> aBlockCache,
+                                                       size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers)
+        {
+        aError = KErrorNone;
+        try
+            {
+            return std::make_unique<CCachedFileInputStream>(aFileName,aBlockCache,aBufferSize,aMaxBuffers);
+            }
+        catch (TResult error)
+            {
+            aError = error;
+            }
+        catch (std::bad_alloc&)
+            {
+            aError = KErrorNoMemory;
+            }
+        return nullptr;
+        }
+    /**
+    Creates a CCachedFileInputStream to read from the file aFileName using aBlockCache. Throws an exception if the file cannot be opened.
+    aBufferSize is the size of the blocks; aMaxBuffers is the number of buffers used if there is no block cache.
+    */
+    CCachedFileInputStream(const std::string& aFileName,std::shared_ptr<CBlockCache> aBlockCache,
+                           size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers):
+        CFileInputStream(aFileName,aBufferSize,aMaxBuffers),
+        m_max_buffers(aMaxBuffers)
+        {
+        SetBlockCache(aBlockCache);
+        }
+
+    std::unique_ptr<CFileInputStream> Copy() override
+        {
+        return std::make_unique<CCachedFileInputStream>(iName,m_block_cache,iBufferSize,m_max_buffers);
+        }
+
+    // from MInputStream
+    void Read(const uint8_t*& aPointer,size_t& aLength) override
+        {
+        if (!m_block_cache)
+            {
+            CFileInputStream::Read(aPointer,aLength);
+            return;
+            }
+        aPointer = nullptr;
+        aLength = 0;
+        if (iLogicalPosition >= iLength)
+            return;
+        int64_t block_position = iLogicalPosition - iLogicalPosition % int64_t(iBufferSize);
+        if (!m_block || m_block_position != block_position)
+            {
+            m_block = nullptr;
+            StartBlock(block_position);
+            uint64_t block_number = uint64_t(block_position) / iBufferSize;
+            m_block = m_block_cache->Find(m_file_id,block_number);
+            if (!m_block)
+                {
+                std::vector<uint8_t> data;
+                ReadBlock(data,block_position);
+                m_block = m_block_cache->Insert(m_file_id,block_number,std::move(data));
+                }
+            m_block_position = block_position;
+            }
+        size_t offset = size_t(iLogicalPosition - block_position);
+        if (offset >= m_block->size())
+            throw KErrorIo;
+        aPointer = m_block->data() + offset;
+        aLength = m_block->size() - offset;
+        iLogicalPosition += aLength;
+        }
+    bool EndOfStream() const override
+        {
+        if (!m_block_cache)
+            return CFileInputStream::EndOfStream();
+        return iLogicalPosition >= iLength;
+        }
+    void Seek(int64_t aPosition) override
+        {
+        if (!m_block_cache)
+            {
+            CFileInputStream::Seek(aPosition);
+            return;
+            }
+        if (aPosition < 0 || aPosition > iLength)
+            throw KErrorEndOfData;
+        iLogicalPosition = aPosition;
+        }
+
+    /**
+    Sets the block cache shared with other streams, or stops using a block cache if aBlockCache is null.
+    The stream's position is not changed.
+    */
+    void SetBlockCache(std::shared_ptr<CBlockCache> aBlockCache)
+        {
+        m_block_cache = aBlockCache;
+        m_block = nullptr;
+        if (m_block_cache)
+            m_file_id = m_block_cache->FileId(iName,iBufferSize);
+        else
+            CFileInputStream::Seek(iLogicalPosition);
+        }
+    /** Returns the block cache, or null if none is used. */
+    std::shared_ptr<CBlockCache> BlockCache() const { return m_block_cache; }
+    /** Returns the maximum number of buffers used if there is no block cache. */
+    size_t MaxBuffers() const { return m_max_buffers; }
+
+    protected:
+    /**
+    Reads the block starting at aPos from the file into aData; called when the block is not in the cache.
+    Override this function to obtain blocks in some other way, for example from a background read. Throws KErrorIo on failure.
+    */
+    virtual void ReadBlock(std::vector<uint8_t>& aData,int64_t aPos)
+        {
+        aData.resize(size_t(std::min(int64_t(iBufferSize),iLength - aPos)));
+        if (iPositionInFile != aPos && iFile.Seek(aPos,SEEK_SET))
+            throw KErrorIo;
+        size_t n = iFile.Read(aData.data(),aData.size());
+        iPositionInFile = aPos + int64_t(n);
+        if (n != aData.size())
+            throw KErrorIo;
+        }
+    /** Called before a block is looked up in the cache; aPos is its position in the file. The default implementation does nothing. */
+    virtual void StartBlock(int64_t /*aPos*/) { }
+    /** Returns the identifier used for this file by the block cache. */
+    uint32_t FileId() const { return m_file_id; }
+
+    private:
+    std::shared_ptr<CBlockCache> m_block_cache;
+    uint32_t m_file_id = 0;
+    size_t m_max_buffers;
+    CBlockCache::TBlock m_block;
+    int64_t m_block_position = -1;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_BLOCK_CACHE_H__
@@ -0,0 +1,556 @@
+/*
+cartotype_compression.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_COMPRESSION_H__
+#define CARTOTYPE_COMPRESSION_H__
+
+#include <cartotype_block_cache.h>
+#include <cartotype_map_metadata.h>
+#include <cartotype_stream.h>
+
+#include <mutex>
+#include <vector>
+
+#ifdef CARTOTYPE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace CartoType
+{
+
+/**
+Compresses aLength bytes at aData using the LZ4 block format, replacing the contents of aOutput.
+The compressor is a simple greedy one, suitable for use by tools creating map files;
+decompression speed does not depend on how well the data was compressed.
+*/
+inline void Lz4CompressBlock(const uint8_t* aData,size_t aLength,std::vector<uint8_t>& aOutput)
+    {
+    aOutput.clear();
+    auto write_length = [&aOutput](size_t aExtra)
+        {
+        while (aExtra >= 255)
+            {
+            aOutput.push_back(255);
+            aExtra -= 255;
+            }
+        aOutput.push_back(uint8_t(aExtra));
+        };
+    auto write_sequence = [&](size_t aLiteralStart,size_t aLiteralLength,size_t aOffset,size_t aMatchLength)
+        {
+        size_t match_code = aMatchLength ? aMatchLength - 4 : 0;
+        aOutput.push_back(uint8_t((std::min(aLiteralLength,size_t(15)) << 4) | std::min(match_code,size_t(15))));
+        if (aLiteralLength >= 15)
+            write_length(aLiteralLength - 15);
+        aOutput.insert(aOutput.end(),aData + aLiteralStart,aData + aLiteralStart + aLiteralLength);
+        if (aMatchLength)
+            {
+            aOutput.push_back(uint8_t(aOffset));
+            aOutput.push_back(uint8_t(aOffset >> 8));
+            if (match_code >= 15)
+                write_length(match_code - 15);
+            }
+        };
+    auto read32 = [aData](size_t aPos)
+        {
+        return uint32_t(aData[aPos]) | (uint32_t(aData[aPos + 1]) << 8) | (uint32_t(aData[aPos + 2]) << 16) | (uint32_t(aData[aPos + 3]) << 24);
+        };
+
+    // The format requires the last match to start at least 12 bytes before the end, and the last 5 bytes to be literals.
+    size_t anchor = 0;
+    if (aLength >= 13)
+        {
+        constexpr int KHashBits = 12;
+        std::vector<int64_t> table(size_t(1) << KHashBits,-1);
+        size_t limit = aLength - 12;
+        size_t match_limit = aLength - 5;
+        size_t pos = 0;
+        while (pos < limit)
+            {
+            uint32_t sequence = read32(pos);
+            size_t hash = (sequence * 2654435761U) >> (32 - KHashBits);
+            int64_t ref = table[hash];
+            table[hash] = int64_t(pos);
+            if (ref >= 0 && pos - size_t(ref) <= 65535 && read32(size_t(ref)) == sequence)
+                {
+                size_t length = 4;
+                while (pos + length < match_limit && aData[size_t(ref) + length] == aData[pos + length])
+                    length++;
+                write_sequence(anchor,pos - anchor,pos - size_t(ref),length);
+                pos += length;
+                anchor = pos;
+                }
+            else
+                pos++;
+            }
+        }
+    write_sequence(anchor,aLength - anchor,0,0);
+    }
+
+/**
+Decompresses LZ4 block-format data from aData into aOutput, which has room for aCapacity bytes.
+Returns the number of bytes written in aOutputLength. Returns KErrorCorrupt if the data
+is invalid or would overflow the output, so untrusted data can be decompressed safely.
+*/
+inline TResult Lz4DecompressBlock(const uint8_t* aData,size_t aLength,uint8_t* aOutput,size_t aCapacity,size_t& aOutputLength)
+    {
+    aOutputLength = 0;
+    size_t in = 0;
+    size_t out = 0;
+    auto read_length = [&](size_t& aValue)
+        {
+        uint8_t b;
+        do
+            {
+            if (in >= aLength)
+                return false;
+            b = aData[in++];
+            aValue += b;
+            }
+        while (b == 255);
+        return true;
+        };
+
+    while (in < aLength)
+        {
+        uint8_t token = aData[in++];
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(literal_length))
+            return KErrorCorrupt;
+        if (literal_length > aLength - in || literal_length > aCapacity - out)
+            return KErrorCorrupt;
+        memcpy(aOutput + out,aData + in,literal_length);
+        in += literal_length;
+        out += literal_length;
+        if (in == aLength)
+            break;
+
+        if (aLength - in < 2)
+            return KErrorCorrupt;
+        size_t offset = size_t(aData[in]) | (size_t(aData[in + 1]) << 8);
+        in += 2;
+        if (offset == 0 || offset > out)
+            return KErrorCorrupt;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(match_length))
+            return KErrorCorrupt;
+        match_length += 4;
+        if (match_length > aCapacity - out)
+            return KErrorCorrupt;
+
+        // The match may overlap the output being written, so it is copied a byte at a time unless it does not.
+        const uint8_t* source = aOutput + out - offset;
+        if (offset >= match_length)
+            memcpy(aOutput + out,source,match_length);
+        else
+            for (size_t i = 0; i < match_length; i++)
+                aOutput[out + i] = source[i];
+        out += match_length;
+        }
+    aOutputLength = out;
+    return KErrorNone;
+    }
+
+/**
+Reads data from a compressed block table. Blocks are decompressed on demand and
+stored in a block cache, so that the cost of decompression is paid once per block while it stays in the cache,
+and compressed data never needs to be held in memory.
+
+A compressed block table has this layout, with all integers little-endian:
+
+<pre>
+offset  size        contents
+0       4           the characters "CTBC"
+4       1           the compression: a TBlockCompression value
+5       3           reserved: zero
+8       4           the uncompressed block size
+12      8           the total uncompressed length
+20      4           the dictionary size in bytes, D (zero unless the compression is zstd)
+24      D           the dictionary
+24+D    8*(N+1)     the offsets of the N blocks, relative to the start of the table, followed by the end of the last block
+...                 the blocks
+</pre>
+
+A block whose stored size equals its uncompressed size is stored uncompressed:
+the writer does this when compression would not make the block smaller.
+
+A reader may be used by any number of threads at once.
+*/
+class CCompressedBlockReader
+    {
+    public:
+    /**
+    Creates a reader for the compressed block table at aTablePosition in aInput, using aBlockCache.
+    aInput must remain valid for the lifetime of the reader, and is used only while the reader's lock is held.
+    Returns KErrorCorrupt in aError if the header or block offsets are inconsistent with each other or with the length of aInput.
+    */
+    static std::unique_ptr<CCompressedBlockReader> New(TResult& aError,MInputStream& aInput,int64_t aTablePosition,std::shared_ptr<CBlockCache> aBlockCache)
+        {
+        std::unique_ptr<CCompressedBlockReader> r(new CCompressedBlockReader(aInput,aTablePosition,aBlockCache));
+        aError = r->ReadHeader();
+        if (aError)
+            r.reset();
+        return r;
+        }
+
+    /** Returns the compression method. */
+    TBlockCompression Compression() const { return m_compression; }
+    /** Returns the uncompressed block size. */
+    size_t BlockSize() const { return m_block_size; }
+    /** Returns the number of blocks. */
+    size_t BlockCount() const { return m_block_offset.size() - 1; }
+    /** Returns the total uncompressed length of the data. */
+    uint64_t Length() const { return m_length; }
+
+    /** Returns a decompressed block, from the cache if possible. */
+    CBlockCache::TBlock Block(TResult& aError,uint64_t aBlockNumber)
+        {
+        aError = KErrorNone;
+        if (aBlockNumber >= BlockCount())
+            {
+            aError = KErrorInvalidArgument;
+            return nullptr;
+            }
+        auto block = m_block_cache->Find(m_file_id,aBlockNumber);
+        if (block)
+            return block;
+
+        size_t stored_size = size_t(m_block_offset[aBlockNumber + 1] - m_block_offset[aBlockNumber]);
+        size_t size = size_t(std::min(uint64_t(m_block_size),m_length - aBlockNumber * m_block_size));
+        std::vector<uint8_t> stored(stored_size);
+            {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            aError = ReadExact(m_table_position + int64_t(m_block_offset[aBlockNumber]),stored.data(),stored_size);
+            }
+        if (aError)
+            return nullptr;
+        if (stored_size == size)
+            return m_block_cache->Insert(m_file_id,aBlockNumber,std::move(stored));
+
+        std::vector<uint8_t> data(size);
+        size_t length = 0;
+        aError = Decompress(stored.data(),stored_size,data.data(),size,length);
+        if (!aError && length != size)
+            aError = KErrorCorrupt;
+        if (aError)
+            return nullptr;
+        return m_block_cache->Insert(m_file_id,aBlockNumber,std::move(data));
+        }
+
+    /** Reads aLength bytes of uncompressed data starting at aPosition into aBuffer. */
+    TResult Read(uint64_t aPosition,uint8_t* aBuffer,size_t aLength)
+        {
+        if (aPosition > m_length || aLength > m_length - aPosition)
+            return KErrorEndOfData;
+        while (aLength)
+            {
+            TResult error;
+            uint64_t block_number = aPosition / m_block_size;
+            auto block = Block(error,block_number);
+            if (error)
+                return error;
+            size_t offset = size_t(aPosition % m_block_size);
+            size_t n = std::min(aLength,block->size() - offset);
+            memcpy(aBuffer,block->data() + offset,n);
+            aBuffer += n;
+            aPosition += n;
+            aLength -= n;
+            }
+        return KErrorNone;
+        }
+
+    /**
+    Writes aLength bytes from aData as a compressed block table using the compression aCompression and blocks of aBlockSize bytes.
+    For zstd, aDictionary is a dictionary trained on samples of the data; it may be empty.
+    Returns KErrorUnimplemented for zstd if CartoType was built without zstd support.
+    */
+    static TResult Write(MOutputStream& aOutput,const uint8_t* aData,uint64_t aLength,TBlockCompression aCompression,uint32_t aBlockSize,
+                         const std::vector<uint8_t>& aDictionary = std::vector<uint8_t>())
+        {
+        if (aBlockSize == 0 || aCompression == TBlockCompression::None)
+            return KErrorInvalidArgument;
+#ifndef CARTOTYPE_ZSTD
+        if (aCompression == TBlockCompression::Zstd)
+            return KErrorUnimplemented;
+#endif
+        const std::vector<uint8_t>& dictionary = aCompression == TBlockCompression::Zstd ? aDictionary : std::vector<uint8_t>();
+        size_t block_count = size_t((aLength + aBlockSize - 1) / aBlockSize);
+        std::vector<std::vector<uint8_t>> block(block_count);
+        for (size_t i = 0; i < block_count; i++)
+            {
+            const uint8_t* p = aData + i * uint64_t(aBlockSize);
+            size_t n = size_t(std::min(uint64_t(aBlockSize),aLength - i * uint64_t(aBlockSize)));
+            TResult error = Compress(aCompression,p,n,dictionary,block[i]);
+            if (error)
+                return error;
+            if (block[i].size() >= n)
+                block[i].assign(p,p + n);
+            }
+
+        std::vector<uint8_t> header { 'C', 'T', 'B', 'C', uint8_t(aCompression), 0, 0, 0 };
+        AppendLE(header,aBlockSize,4);
+        AppendLE(header,aLength,8);
+        AppendLE(header,dictionary.size(),4);
+        header.insert(header.end(),dictionary.begin(),dictionary.end());
+        uint64_t offset = header.size() + 8 * (block_count + 1);
+        for (const auto& b : block)
+            {
+            AppendLE(header,offset,8);
+            offset += b.size();
+            }
+        AppendLE(header,offset,8);
+        aOutput.Write(header.data(),header.size());
+        for (const auto& b : block)
+            aOutput.Write(b.data(),b.size());
+        return KErrorNone;
+        }
+
+    ~CCompressedBlockReader()
+        {
+#ifdef CARTOTYPE_ZSTD
+        for (auto context : m_zstd_context)
+            ZSTD_freeDCtx(context);
+        if (m_zstd_dictionary)
+            ZSTD_freeDDict(m_zstd_dictionary);
+#endif
+        }
+
+    CCompressedBlockReader(const CCompressedBlockReader&) = delete;
+    CCompressedBlockReader& operator=(const CCompressedBlockReader&) = delete;
+
+    private:
+    CCompressedBlockReader(MInputStream& aInput,int64_t aTablePosition,std::shared_ptr<CBlockCache> aBlockCache):
+        m_input(aInput),
+        m_table_position(aTablePosition),
+        m_block_cache(aBlockCache ? aBlockCache : CBlockCache::Shared())
+        {
+        }
+
+    static void AppendLE(std::vector<uint8_t>& aBuffer,uint64_t aValue,size_t aBytes)
+        {
+        for (size_t i = 0; i < aBytes; i++)
+            aBuffer.push_back(uint8_t(aValue >> (8 * i)));
+        }
+    static uint64_t ReadLE(const uint8_t* aData,size_t aBytes)
+        {
+        uint64_t v = 0;
+        for (size_t i = 0; i < aBytes; i++)
+            v |= uint64_t(aData[i]) << (8 * i);
+        return v;
+        }
+
+    TResult ReadExact(int64_t aPosition,uint8_t* aBuffer,size_t aLength)
+        {
+        try
+            {
+            m_input.Seek(aPosition);
+            while (aLength)
+                {
+                const uint8_t* p = nullptr;
+                size_t n = 0;
+                m_input.Read(p,n);
+                if (n == 0)
+                    return KErrorEndOfData;
+                n = std::min(n,aLength);
+                memcpy(aBuffer,p,n);
+                aBuffer += n;
+                aLength -= n;
+                }
+            }
+        catch (TResult error)
+            {
+            return error;
+            }
+        return KErrorNone;
+        }
+
+    /*
+    Reads and checks the header and block offsets. Every field is checked against the length of the stream before
+    anything is allocated, and any inconsistency gives KErrorCorrupt.
+    */
+    TResult ReadHeader()
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t stream_length = 0;
+        try
+            {
+            stream_length = uint64_t(std::max(m_input.Length(),int64_t(0)));
+            }
+        catch (TResult error)
+            {
+            return error;
+            }
+        if (m_table_position < 0 || uint64_t(m_table_position) >= stream_length)
+            return KErrorCorrupt;
+        const uint64_t table_length = stream_length - uint64_t(m_table_position);
+        if (table_length < 24)
+            return KErrorCorrupt;
+
+        uint8_t header[24];
+        TResult error = ReadExact(m_table_position,header,sizeof(header));
+        if (error)
+            return error == KErrorEndOfData ? KErrorCorrupt : error;
+        if (memcmp(header,"CTBC",4))
+            return KErrorUnknownDataFormat;
+        m_compression = TBlockCompression(header[4]);
+        m_block_size = uint32_t(ReadLE(header + 8,4));
+        m_length = ReadLE(header + 12,8);
+        uint64_t dictionary_size = ReadLE(header + 20,4);
+        if (m_compression != TBlockCompression::LZ4 && m_compression != TBlockCompression::Zstd)
+            return KErrorCorrupt;
+        if (m_block_size == 0)
+            return KErrorCorrupt;
+#ifndef CARTOTYPE_ZSTD
+        if (m_compression == TBlockCompression::Zstd)
+            return KErrorUnimplemented;
+#endif
+
+        // The dictionary and the offset table must fit in the stream.
+        if (dictionary_size > table_length - 24 || (dictionary_size && m_compression != TBlockCompression::Zstd))
+            return KErrorCorrupt;
+        const uint64_t offset_table_position = 24 + dictionary_size;
+        uint64_t block_count = m_length / m_block_size + (m_length % m_block_size ? 1 : 0);
+        if (block_count >= (table_length - offset_table_position) / 8)
+            return KErrorCorrupt;
+        const uint64_t data_position = offset_table_position + 8 * (block_count + 1);
+
+        std::vector<uint8_t> dictionary(static_cast<size_t>(dictionary_size));
+        error = ReadExact(m_table_position + 24,dictionary.data(),dictionary.size());
+        if (error)
+            return error == KErrorEndOfData ? KErrorCorrupt : error;
+#ifdef CARTOTYPE_ZSTD
+        if (m_compression == TBlockCompression::Zstd && dictionary_size)
+            {
+            m_zstd_dictionary = ZSTD_createDDict(dictionary.data(),dictionary.size());
+            if (!m_zstd_dictionary)
+                return KErrorCorrupt;
+            }
+#endif
+
+        std::vector<uint8_t> offset(size_t(block_count + 1) * 8);
+        error = ReadExact(m_table_position + int64_t(offset_table_position),offset.data(),offset.size());
+        if (error)
+            return error == KErrorEndOfData ? KErrorCorrupt : error;
+
+        /*
+        The blocks follow the offset table without gaps, and end inside the stream. A block is never stored
+        larger than its uncompressed size, because the writer stores it uncompressed if compression does not make it smaller.
+        */
+        m_block_offset.resize(size_t(block_count + 1));
+        for (size_t i = 0; i < m_block_offset.size(); i++)
+            {
+            m_block_offset[i] = ReadLE(offset.data() + i * 8,8);
+            if (i == 0)
+                {
+                if (m_block_offset[0] != data_position)
+                    return KErrorCorrupt;
+                continue;
+                }
+            if (m_block_offset[i] < m_block_offset[i - 1] || m_block_offset[i] > table_length)
+                return KErrorCorrupt;
+            uint64_t stored_size = m_block_offset[i] - m_block_offset[i - 1];
+            uint64_t size = std::min(uint64_t(m_block_size),m_length - (i - 1) * uint64_t(m_block_size));
+            if (stored_size == 0 || stored_size > size)
+                return KErrorCorrupt;
+            }
+
+        std::string name = m_input.Name();
+        m_file_id = m_block_cache->FileId(name + "#" + std::to_string(m_table_position),m_block_size,TFileIdentity(name));
+        return KErrorNone;
+        }
+
+    static TResult Compress(TBlockCompression aCompression,const uint8_t* aData,size_t aLength,const std::vector<uint8_t>& aDictionary,std::vector<uint8_t>& aOutput)
+        {
+        if (aCompression == TBlockCompression::LZ4)
+            {
+            Lz4CompressBlock(aData,aLength,aOutput);
+            return KErrorNone;
+            }
+#ifdef CARTOTYPE_ZSTD
+        if (aCompression == TBlockCompression::Zstd)
+            {
+            aOutput.resize(ZSTD_compressBound(aLength));
+            ZSTD_CCtx* context = ZSTD_createCCtx();
+            if (!context)
+                return KErrorNoMemory;
+            size_t n = ZSTD_compress_usingDict(context,aOutput.data(),aOutput.size(),aData,aLength,aDictionary.data(),aDictionary.size(),19);
+            ZSTD_freeCCtx(context);
+            if (ZSTD_isError(n))
+                return KErrorGeneral;
+            aOutput.resize(n);
+            return KErrorNone;
+            }
+#else
+        (void)aDictionary;
+#endif
+        return KErrorUnimplemented;
+        }
+
+    TResult Decompress(const uint8_t* aData,size_t aLength,uint8_t* aOutput,size_t aCapacity,size_t& aOutputLength) const
+        {
+        if (m_compression == TBlockCompression::LZ4)
+            return Lz4DecompressBlock(aData,aLength,aOutput,aCapacity,aOutputLength);
+#ifdef CARTOTYPE_ZSTD
+        if (m_compression == TBlockCompression::Zstd)
+            {
+            ZSTD_DCtx* context = TakeZstdContext();
+            if (!context)
+                return KErrorNoMemory;
+            size_t n = m_zstd_dictionary ? ZSTD_decompress_usingDDict(context,aOutput,aCapacity,aData,aLength,m_zstd_dictionary) :
+                                           ZSTD_decompressDCtx(context,aOutput,aCapacity,aData,aLength);
+            ReturnZstdContext(context);
+            if (ZSTD_isError(n))
+                return KErrorCorrupt;
+            aOutputLength = n;
+            return KErrorNone;
+            }
+#endif
+        return KErrorUnimplemented;
+        }
+
+#ifdef CARTOTYPE_ZSTD
+    // Decompression contexts are kept for reuse; there are never more than the number of threads decompressing at once.
+    ZSTD_DCtx* TakeZstdContext() const
+        {
+        std::lock_guard<std::mutex> lock(m_zstd_mutex);
+        if (m_zstd_context.empty())
+            return ZSTD_createDCtx();
+        ZSTD_DCtx* context = m_zstd_context.back();
+        m_zstd_context.pop_back();
+        return context;
+        }
+    void ReturnZstdContext(ZSTD_DCtx* aContext) const
+        {
+        std::lock_guard<std::mutex> lock(m_zstd_mutex);
+        try
+            {
+            m_zstd_context.push_back(aContext);
+            }
+        catch (std::bad_alloc&)
+            {
+            ZSTD_freeDCtx(aContext);
+            }
+        }
+#endif
+
+    std::mutex m_mutex;
+    MInputStream& m_input;
+    int64_t m_table_position;
+    std::shared_ptr<CBlockCache> m_block_cache;
+    uint32_t m_file_id = 0;
+    TBlockCompression m_compression = TBlockCompression::None;
+    uint32_t m_block_size = 0;
+    uint64_t m_length = 0;
+    std::vector<uint64_t> m_block_offset { 0 };
+#ifdef CARTOTYPE_ZSTD
+    ZSTD_DDict* m_zstd_dictionary = nullptr;
+    mutable std::mutex m_zstd_mutex;
+    mutable std::vector<ZSTD_DCtx*> m_zstd_context;
+#endif
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_COMPRESSION_H__
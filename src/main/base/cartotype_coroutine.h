@@ -0,0 +1,204 @@
+/*
+cartotype_coroutine.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_COROUTINE_H__
+#define CARTOTYPE_COROUTINE_H__
+
+#include <cartotype_framework.h>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define CARTOTYPE_COROUTINES
+#endif
+#endif
+
+#ifdef CARTOTYPE_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+
+namespace CartoType
+{
+
+/**
+An interface for executors used by the awaitable framework functions.
+The Post function must arrange for aTask to be called, normally on a
+thread owned by the executor. It may be called from any thread.
+*/
+class MExecutor
+    {
+    public:
+    virtual ~MExecutor() { }
+    /** Schedules aTask to be called by the executor. */
+    virtual void Post(std::function<void()> aTask) = 0;
+    };
+
+/** The result of an awaited framework operation: an error code and, if the error code is KErrorNone, a value. */
+template<class T> class TAwaitResult
+    {
+    public:
+    /** The error code. */
+    TResult iError;
+    /** The value. */
+    T iValue {};
+    };
+
+/**
+An awaitable object returned by the functions CreateRouteAwaitable, FindAwaitable,
+GetAddressAwaitable and TileBitmapAwaitable. The operation starts when the awaitable is
+awaited by a coroutine, which is resumed, using the executor, when the operation has finished.
+The co_await expression gives a TAwaitResult<T>.
+*/
+template<class T> class TFrameworkAwaitable
+    {
+    public:
+    /** A type for functions called when the operation finishes. */
+    using DoneFunction = std::function<void(TResult aError,T aValue)>;
+    /** A type for functions that start an operation; they must call the done function exactly once. */
+    using StartFunction = std::function<void(DoneFunction aDone)>;
+
+    /** Creates an awaitable object using an executor and a function to start the operation. */
+    TFrameworkAwaitable(MExecutor& aExecutor,StartFunction aStart):
+        m_executor(aExecutor),
+        m_start(std::move(aStart)),
+        m_state(std::make_shared<TState>())
+        {
+        }
+
+    /** Returns false: the operation has not been started. */
+    bool await_ready() const noexcept { return false; }
+
+    /**
+    Starts the operation. Returns false, so that the coroutine is not suspended,
+    if the operation finishes before this function returns.
+    */
+    bool await_suspend(std::coroutine_handle<> aHandle)
+        {
+        m_state->iHandle = aHandle;
+        std::shared_ptr<TState> state { m_state };
+        MExecutor* executor = &m_executor;
+        DoneFunction done = [state,executor](TResult aError,T aValue)
+            {
+            state->iResult.iError = aError;
+            state->iResult.iValue = std::move(aValue);
+            if (state->iRendezvous.exchange(true))
+                executor->Post([state]() { state->iHandle.resume(); });
+            };
+        try
+            {
+            m_start(done);
+            }
+        catch (TResult error)
+            {
+            done(error,T());
+            }
+        catch (std::bad_alloc&)
+            {
+            done(KErrorNoMemory,T());
+            }
+        return !m_state->iRendezvous.exchange(true);
+        }
+
+    /** Returns the result of the operation. */
+    TAwaitResult<T> await_resume() { return std::move(m_state->iResult); }
+
+    private:
+    /*
+    The state shared by the awaitable and the done function. Whichever of await_suspend
+    and the done function sets iRendezvous second is responsible for resuming the coroutine.
+    */
+    class TState
+        {
+        public:
+        TAwaitResult<T> iResult;
+        std::coroutine_handle<> iHandle;
+        std::atomic<bool> iRendezvous { false };
+        };
+
+    MExecutor& m_executor;
+    StartFunction m_start;
+    std::shared_ptr<TState> m_state;
+    };
+
+/**
+Returns an awaitable object to create a route asynchronously using CFramework::CreateRouteAsync.
+The request never overrides a pending request, because an overridden request's callback is not called,
+and a coroutine awaiting it would never be resumed.
+*/
+inline TFrameworkAwaitable<std::unique_ptr<CRoute>> CreateRouteAwaitable(CFramework& aFramework,MExecutor& aExecutor,const TRouteProfile& aProfile,const TRouteCoordSet& aCoordSet)
+    {
+    using done_t = TFrameworkAwaitable<std::unique_ptr<CRoute>>::DoneFunction;
+    return { aExecutor,[&aFramework,aProfile,aCoordSet](done_t aDone)
+        {
+        TResult error = aFramework.CreateRouteAsync([aDone](TResult aError,std::unique_ptr<CRoute> aRoute) { aDone(aError,std::move(aRoute)); },aProfile,aCoordSet,false);
+        if (error)
+            aDone(error,nullptr);
+        } };
+    }
+
+/**
+Returns an awaitable object to find map objects asynchronously using CFramework::FindAsync.
+As with CreateRouteAwaitable, the request never overrides a pending request.
+*/
+inline TFrameworkAwaitable<std::unique_ptr<CMapObjectArray>> FindAwaitable(CFramework& aFramework,MExecutor& aExecutor,const TFindParam& aFindParam)
+    {
+    using done_t = TFrameworkAwaitable<std::unique_ptr<CMapObjectArray>>::DoneFunction;
+    return { aExecutor,[&aFramework,aFindParam](done_t aDone)
+        {
+        TResult error = aFramework.FindAsync(FindAsyncCallBack([aDone](std::unique_ptr<CMapObjectArray> aArray) { aDone(KErrorNone,std::move(aArray)); }),aFindParam,false);
+        if (error)
+            aDone(error,nullptr);
+        } };
+    }
+
+/**
+Returns an awaitable object to get the address of a point using CFramework::GetAddress.
+Because GetAddress is a blocking function it is called by the executor. The framework must not be
+used by any other thread until the operation has finished; use CFramework::Copy to create
+a framework for each operation that may run concurrently.
+*/
+inline TFrameworkAwaitable<CAddress> GetAddressAwaitable(CFramework& aFramework,MExecutor& aExecutor,double aX,double aY,TCoordType aCoordType,bool aFullAddress = true)
+    {
+    using done_t = TFrameworkAwaitable<CAddress>::DoneFunction;
+    return { aExecutor,[&aFramework,&aExecutor,aX,aY,aCoordType,aFullAddress](done_t aDone)
+        {
+        aExecutor.Post([&aFramework,aDone,aX,aY,aCoordType,aFullAddress]()
+            {
+            CAddress address;
+            TResult error = aFramework.GetAddress(address,aX,aY,aCoordType,aFullAddress);
+            aDone(error,std::move(address));
+            });
+        } };
+    }
+
+/**
+Returns an awaitable object to draw a map tile using CFramework::TileBitmap.
+Because TileBitmap is a blocking function it is called by the executor. The framework must not be
+used by any other thread until the operation has finished; use CFramework::Copy to create
+a framework for each operation that may run concurrently.
+*/
+inline TFrameworkAwaitable<CBitmap> TileBitmapAwaitable(CFramework& aFramework,MExecutor& aExecutor,int32_t aTileSizeInPixels,int32_t aZoom,int32_t aX,int32_t aY,const TTileBitmapParam* aParam = nullptr)
+    {
+    using done_t = TFrameworkAwaitable<CBitmap>::DoneFunction;
+    std::shared_ptr<TTileBitmapParam> param;
+    if (aParam)
+        param = std::make_shared<TTileBitmapParam>(*aParam);
+    return { aExecutor,[&aFramework,&aExecutor,aTileSizeInPixels,aZoom,aX,aY,param](done_t aDone)
+        {
+        aExecutor.Post([&aFramework,aDone,aTileSizeInPixels,aZoom,aX,aY,param]()
+            {
+            TResult error;
+            CBitmap bitmap { aFramework.TileBitmap(error,aTileSizeInPixels,aZoom,aX,aY,param.get()) };
+            aDone(error,std::move(bitmap));
+            });
+        } };
+    }
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_COROUTINES
+
+#endif // CARTOTYPE_COROUTINE_H__
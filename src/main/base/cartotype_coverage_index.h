@@ -0,0 +1,227 @@
+/*
+cartotype_coverage_index.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_COVERAGE_INDEX_H__
+#define CARTOTYPE_COVERAGE_INDEX_H__
+
+#include <cartotype_path.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace CartoType
+{
+
+/** The relationship between a rectangle and a region. */
+enum class TCoverage
+    {
+    /** The rectangle is entirely outside the region. */
+    Outside,
+    /** The rectangle is entirely inside the region. */
+    Inside,
+    /** The rectangle may cross the boundary of the region. */
+    Boundary
+    };
+
+/**
+A coverage index is a grid covering a region, such as the part of a map not overlapped by
+maps loaded earlier, in which each cell is classified as inside, outside or on the boundary of the region.
+It is built once when the region is calculated. After that, objects whose bounds lie
+entirely in inside cells can be drawn without clipping, objects entirely in outside cells can be skipped,
+and only objects touching boundary cells need to be clipped against the region's polygon.
+
+The region is interpreted using the even-odd rule. Off-curve points are treated as on-curve points,
+which is correct for the polygonal regions produced by clipping maps against each other.
+*/
+class CCoverageIndex
+    {
+    public:
+    /**
+    Creates a coverage index for aRegion, which is in map coordinates, using a grid of
+    at most aMaxCellsPerSide by aMaxCellsPerSide cells covering the region's bounding box.
+    */
+    explicit CCoverageIndex(const MPath& aRegion,int32_t aMaxCellsPerSide = KDefaultMaxCellsPerSide)
+        {
+        for (size_t i = 0; i < aRegion.Contours(); i++)
+            {
+            TContour contour = aRegion.Contour(i);
+            size_t n = contour.Points();
+            for (size_t j = 0; j < n; j++)
+                {
+                TOutlinePoint a = contour.Point(j);
+                TOutlinePoint b = contour.Point(j + 1 < n ? j + 1 : 0);
+                if (a.iX != b.iX || a.iY != b.iY)
+                    m_edge.push_back(TEdge { double(a.iX),double(a.iY),double(b.iX),double(b.iY) });
+                }
+            }
+        if (m_edge.empty())
+            return;
+
+        m_min_x = m_max_x = m_edge[0].iX0;
+        m_min_y = m_max_y = m_edge[0].iY0;
+        for (const auto& e : m_edge)
+            {
+            m_min_x = std::min({ m_min_x,e.iX0,e.iX1 });
+            m_max_x = std::max({ m_max_x,e.iX0,e.iX1 });
+            m_min_y = std::min({ m_min_y,e.iY0,e.iY1 });
+            m_max_y = std::max({ m_max_y,e.iY0,e.iY1 });
+            }
+        double size = std::max(m_max_x - m_min_x,m_max_y - m_min_y);
+        aMaxCellsPerSide = std::max(aMaxCellsPerSide,1);
+        m_cell_size = std::max(std::ceil(size / aMaxCellsPerSide),1.0);
+        m_columns = std::max(int32_t(std::ceil((m_max_x - m_min_x) / m_cell_size)),1);
+        m_rows = std::max(int32_t(std::ceil((m_max_y - m_min_y) / m_cell_size)),1);
+        m_cell.assign(size_t(m_columns) * size_t(m_rows),TCoverage::Outside);
+
+        MarkBoundaryCells();
+        FillInsideCells();
+        }
+
+    /** The default maximum number of cells along each side of the grid. */
+    static constexpr int32_t KDefaultMaxCellsPerSide = 256;
+
+    /** Returns the relationship between the rectangle aBounds, in map coordinates, and the region. */
+    TCoverage Classify(const TRect& aBounds) const
+        {
+        if (m_cell.empty() ||
+            aBounds.iBottomRight.iX < m_min_x || aBounds.iTopLeft.iX > m_max_x ||
+            aBounds.iBottomRight.iY < m_min_y || aBounds.iTopLeft.iY > m_max_y)
+            return TCoverage::Outside;
+        int32_t x0 = Column(aBounds.iTopLeft.iX);
+        int32_t x1 = Column(aBounds.iBottomRight.iX);
+        int32_t y0 = Row(aBounds.iTopLeft.iY);
+        int32_t y1 = Row(aBounds.iBottomRight.iY);
+
+        // A rectangle partly outside the grid is at least partly outside the region.
+        bool partly_outside = aBounds.iTopLeft.iX < m_min_x || aBounds.iBottomRight.iX > m_max_x ||
+                              aBounds.iTopLeft.iY < m_min_y || aBounds.iBottomRight.iY > m_max_y;
+        TCoverage first = partly_outside ? TCoverage::Outside : Cell(x0,y0);
+        for (int32_t y = y0; y <= y1; y++)
+            for (int32_t x = x0; x <= x1; x++)
+                {
+                TCoverage c = Cell(x,y);
+                if (c == TCoverage::Boundary || c != first)
+                    return TCoverage::Boundary;
+                }
+        return first;
+        }
+    /** Returns the relationship between the point (aX,aY), in map coordinates, and the region, which is exact except in boundary cells. */
+    TCoverage Classify(int32_t aX,int32_t aY) const
+        {
+        return Classify(TRect(aX,aY,aX,aY));
+        }
+
+    /** Returns the number of cells with a given classification. */
+    size_t CellCount(TCoverage aCoverage) const { return size_t(std::count(m_cell.begin(),m_cell.end(),aCoverage)); }
+    /** Returns the number of columns in the grid. */
+    int32_t Columns() const { return m_columns; }
+    /** Returns the number of rows in the grid. */
+    int32_t Rows() const { return m_rows; }
+
+    private:
+    class TEdge
+        {
+        public:
+        double iX0;
+        double iY0;
+        double iX1;
+        double iY1;
+        };
+
+    int32_t Column(double aX) const { return std::max(0,std::min(int32_t(std::floor((aX - m_min_x) / m_cell_size)),m_columns - 1)); }
+    int32_t Row(double aY) const { return std::max(0,std::min(int32_t(std::floor((aY - m_min_y) / m_cell_size)),m_rows - 1)); }
+    TCoverage Cell(int32_t aX,int32_t aY) const { return m_cell[size_t(aY) * size_t(m_columns) + size_t(aX)]; }
+    TCoverage& Cell(int32_t aX,int32_t aY) { return m_cell[size_t(aY) * size_t(m_columns) + size_t(aX)]; }
+
+    // Returns true if the segment from (aX0,aY0) to (aX1,aY1) intersects the closed rectangle.
+    static bool SegmentIntersectsRect(double aX0,double aY0,double aX1,double aY1,double aLeft,double aTop,double aRight,double aBottom)
+        {
+        // Liang-Barsky clipping.
+        double t0 = 0, t1 = 1;
+        double dx = aX1 - aX0, dy = aY1 - aY0;
+        const double p[4] = { -dx, dx, -dy, dy };
+        const double q[4] = { aX0 - aLeft, aRight - aX0, aY0 - aTop, aBottom - aY0 };
+        for (int i = 0; i < 4; i++)
+            {
+            if (p[i] == 0)
+                {
+                if (q[i] < 0)
+                    return false;
+                }
+            else
+                {
+                double t = q[i] / p[i];
+                if (p[i] < 0)
+                    t0 = std::max(t0,t);
+                else
+                    t1 = std::min(t1,t);
+                if (t0 > t1)
+                    return false;
+                }
+            }
+        return true;
+        }
+
+    void MarkBoundaryCells()
+        {
+        for (const auto& e : m_edge)
+            {
+            int32_t x0 = Column(std::min(e.iX0,e.iX1));
+            int32_t x1 = Column(std::max(e.iX0,e.iX1));
+            int32_t y0 = Row(std::min(e.iY0,e.iY1));
+            int32_t y1 = Row(std::max(e.iY0,e.iY1));
+            for (int32_t y = y0; y <= y1; y++)
+                for (int32_t x = x0; x <= x1; x++)
+                    {
+                    if (Cell(x,y) == TCoverage::Boundary)
+                        continue;
+                    double left = m_min_x + x * m_cell_size;
+                    double top = m_min_y + y * m_cell_size;
+                    if (SegmentIntersectsRect(e.iX0,e.iY0,e.iX1,e.iY1,left,top,left + m_cell_size,top + m_cell_size))
+                        Cell(x,y) = TCoverage::Boundary;
+                    }
+            }
+        }
+
+    // Classifies the cells not on the boundary using the even-odd rule at the center of each cell.
+    void FillInsideCells()
+        {
+        std::vector<double> crossing;
+        for (int32_t y = 0; y < m_rows; y++)
+            {
+            double cy = m_min_y + (y + 0.5) * m_cell_size;
+            crossing.clear();
+            for (const auto& e : m_edge)
+                if ((e.iY0 <= cy) != (e.iY1 <= cy))
+                    crossing.push_back(e.iX0 + (cy - e.iY0) * (e.iX1 - e.iX0) / (e.iY1 - e.iY0));
+            std::sort(crossing.begin(),crossing.end());
+            size_t index = 0;
+            for (int32_t x = 0; x < m_columns; x++)
+                {
+                double cx = m_min_x + (x + 0.5) * m_cell_size;
+                while (index < crossing.size() && crossing[index] <= cx)
+                    index++;
+                if (Cell(x,y) != TCoverage::Boundary && (index & 1))
+                    Cell(x,y) = TCoverage::Inside;
+                }
+            }
+        }
+
+    std::vector<TEdge> m_edge;
+    std::vector<TCoverage> m_cell;
+    double m_min_x = 0;
+    double m_min_y = 0;
+    double m_max_x = 0;
+    double m_max_y = 0;
+    double m_cell_size = 1;
+    int32_t m_columns = 0;
+    int32_t m_rows = 0;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_COVERAGE_INDEX_H__
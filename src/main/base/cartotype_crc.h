@@ -0,0 +1,314 @@
+/*
+cartotype_crc.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_CRC_H__
+#define CARTOTYPE_CRC_H__
+
+#include <cartotype_stream.h>
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CARTOTYPE_CRC32C_SSE42
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define CARTOTYPE_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+namespace CartoType
+{
+
+/**
+Functions for the CRC-32C (Castagnoli) checksum, which is used to verify map files.
+CRCs are calculated using the SSE4.2 or ARMv8 CRC instructions where available,
+and otherwise using the slicing-by-8 algorithm, which processes eight bytes per step.
+
+CRCs follow the usual convention, in which the CRC of the empty string is zero and the
+CRC of a block of data can be extended by passing it as aCrc when processing the next block.
+*/
+class Crc32C
+    {
+    public:
+    /** Returns the CRC of aLength bytes at aData appended to data whose CRC is aCrc. */
+    static uint32_t Update(uint32_t aCrc,const uint8_t* aData,size_t aLength) noexcept
+        {
+#if defined(CARTOTYPE_CRC32C_SSE42)
+        static const bool hardware = __builtin_cpu_supports("sse4.2");
+        if (hardware)
+            return UpdateSse42(aCrc,aData,aLength);
+#elif defined(CARTOTYPE_CRC32C_ARM)
+        return UpdateArm(aCrc,aData,aLength);
+#endif
+        return UpdateSoftware(aCrc,aData,aLength);
+        }
+    /** Returns the CRC of aLength bytes at aData. */
+    static uint32_t Compute(const uint8_t* aData,size_t aLength) noexcept { return Update(0,aData,aLength); }
+
+    /**
+    Returns the CRC of two blocks of data joined together, given the CRC of the first block,
+    the CRC of the second block, and the length of the second block. This allows CRCs of
+    separate parts of a file to be calculated in parallel.
+    */
+    static uint32_t Combine(uint32_t aCrc1,uint32_t aCrc2,uint64_t aLength2) noexcept
+        {
+        return MultiplyModP(PowerOfXModP(aLength2,3),aCrc1) ^ aCrc2;
+        }
+
+    /** Returns the CRC calculated using the slicing-by-8 algorithm; used if there is no hardware support, and for testing. */
+    static uint32_t UpdateSoftware(uint32_t aCrc,const uint8_t* aData,size_t aLength) noexcept
+        {
+        const auto& table = Table();
+        uint32_t crc = ~aCrc;
+        while (aLength && (uintptr_t(aData) & 7))
+            {
+            crc = table[0][(crc ^ *aData++) & 0xFF] ^ (crc >> 8);
+            aLength--;
+            }
+        while (aLength >= 8)
+            {
+            uint32_t low = crc ^ (uint32_t(aData[0]) | (uint32_t(aData[1]) << 8) | (uint32_t(aData[2]) << 16) | (uint32_t(aData[3]) << 24));
+            uint32_t high = uint32_t(aData[4]) | (uint32_t(aData[5]) << 8) | (uint32_t(aData[6]) << 16) | (uint32_t(aData[7]) << 24);
+            crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+                  table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+            aData += 8;
+            aLength -= 8;
+            }
+        while (aLength--)
+            crc = table[0][(crc ^ *aData++) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+        }
+
+    /** The CRC-32C polynomial in reversed bit order. */
+    static constexpr uint32_t KPolynomial = 0x82F63B78;
+
+    private:
+    using TTable = std::array<std::array<uint32_t,256>,8>;
+
+    static const TTable& Table() noexcept
+        {
+        static const TTable table = []
+            {
+            TTable t { };
+            for (uint32_t i = 0; i < 256; i++)
+                {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? (c >> 1) ^ KPolynomial : c >> 1;
+                t[0][i] = c;
+                }
+            for (uint32_t i = 0; i < 256; i++)
+                for (size_t k = 1; k < 8; k++)
+                    t[k][i] = t[0][t[k - 1][i] & 0xFF] ^ (t[k - 1][i] >> 8);
+            return t;
+            }();
+        return table;
+        }
+
+    // Multiplies two polynomials modulo the CRC polynomial, in reversed bit order.
+    static uint32_t MultiplyModP(uint32_t aA,uint32_t aB) noexcept
+        {
+        uint32_t m = 1U << 31;
+        uint32_t p = 0;
+        for (;;)
+            {
+            if (aA & m)
+                {
+                p ^= aB;
+                if ((aA & (m - 1)) == 0)
+                    break;
+                }
+            m >>= 1;
+            aB = (aB & 1) ? (aB >> 1) ^ KPolynomial : aB >> 1;
+            }
+        return p;
+        }
+
+    // Returns x^(aN * 2^aK) modulo the CRC polynomial.
+    static uint32_t PowerOfXModP(uint64_t aN,unsigned aK) noexcept
+        {
+        static const std::array<uint32_t,32> power = []
+            {
+            std::array<uint32_t,32> t { };
+            uint32_t p = 1U << 30; // x^1
+            t[0] = p;
+            for (size_t i = 1; i < 32; i++)
+                t[i] = p = MultiplyModP(p,p);
+            return t;
+            }();
+        uint32_t p = 1U << 31; // x^0
+        while (aN)
+            {
+            if (aN & 1)
+                p = MultiplyModP(power[aK & 31],p);
+            aN >>= 1;
+            aK++;
+            }
+        return p;
+        }
+
+#if defined(CARTOTYPE_CRC32C_SSE42)
+    __attribute__((target("sse4.2")))
+    static uint32_t UpdateSse42(uint32_t aCrc,const uint8_t* aData,size_t aLength) noexcept
+        {
+        uint32_t crc = ~aCrc;
+        while (aLength && (uintptr_t(aData) & 7))
+            {
+            crc = _mm_crc32_u8(crc,*aData++);
+            aLength--;
+            }
+#if defined(__x86_64__)
+        uint64_t crc64 = crc;
+        while (aLength >= 8)
+            {
+            uint64_t v;
+            memcpy(&v,aData,8);
+            crc64 = _mm_crc32_u64(crc64,v);
+            aData += 8;
+            aLength -= 8;
+            }
+        crc = uint32_t(crc64);
+#endif
+        while (aLength >= 4)
+            {
+            uint32_t v;
+            memcpy(&v,aData,4);
+            crc = _mm_crc32_u32(crc,v);
+            aData += 4;
+            aLength -= 4;
+            }
+        while (aLength--)
+            crc = _mm_crc32_u8(crc,*aData++);
+        return ~crc;
+        }
+#elif defined(CARTOTYPE_CRC32C_ARM)
+    static uint32_t UpdateArm(uint32_t aCrc,const uint8_t* aData,size_t aLength) noexcept
+        {
+        uint32_t crc = ~aCrc;
+        while (aLength && (uintptr_t(aData) & 7))
+            {
+            crc = __crc32cb(crc,*aData++);
+            aLength--;
+            }
+        while (aLength >= 8)
+            {
+            uint64_t v;
+            memcpy(&v,aData,8);
+            crc = __crc32cd(crc,v);
+            aData += 8;
+            aLength -= 8;
+            }
+        while (aLength--)
+            crc = __crc32cb(crc,*aData++);
+        return ~crc;
+        }
+#endif
+    };
+
+/**
+Calculates the CRC-32C of a file, reading and processing separate parts of the file
+in parallel using aThreadCount threads, and combining the results.
+If aThreadCount is zero the number of hardware threads is used.
+aChunkSize is the number of bytes processed by a thread at a time.
+*/
+inline TResult FileCrc32C(uint32_t& aCrc,const std::string& aFileName,size_t aThreadCount = 0,size_t aChunkSize = 4 * 1024 * 1024)
+    {
+    aCrc = 0;
+    if (aChunkSize == 0)
+        return KErrorInvalidArgument;
+    int64_t length = 0;
+        {
+        CBinaryInputFile file;
+        TResult error = file.Open(aFileName.c_str());
+        if (!error)
+            error = file.Seek(0,SEEK_END);
+        if (error)
+            return error;
+        length = file.Tell();
+        if (length < 0)
+            return KErrorIo;
+        }
+
+    size_t chunk_count = size_t((uint64_t(length) + aChunkSize - 1) / aChunkSize);
+    if (aThreadCount == 0)
+        aThreadCount = std::max(std::thread::hardware_concurrency(),1U);
+    aThreadCount = std::min(aThreadCount,std::max(chunk_count,size_t(1)));
+
+    std::vector<uint32_t> chunk_crc(chunk_count);
+    std::atomic<size_t> next_chunk { 0 };
+    std::atomic<uint32_t> result { KErrorNone };
+    auto worker = [&]
+        {
+        CBinaryInputFile file;
+        TResult error = file.Open(aFileName.c_str());
+        std::vector<uint8_t> buffer(aChunkSize);
+        for (;;)
+            {
+            size_t chunk = next_chunk++;
+            if (error || chunk >= chunk_count || result.load())
+                break;
+            int64_t position = int64_t(chunk) * int64_t(aChunkSize);
+            size_t size = size_t(std::min(int64_t(aChunkSize),length - position));
+            error = file.Seek(position,SEEK_SET);
+            size_t done = 0;
+            while (!error && done < size)
+                {
+                size_t n = file.Read(buffer.data() + done,size - done);
+                if (n == 0 || n > size - done)
+                    error = KErrorIo;
+                else
+                    done += n;
+                }
+            if (!error)
+                chunk_crc[chunk] = Crc32C::Compute(buffer.data(),size);
+            }
+        if (error)
+            {
+            uint32_t none = KErrorNone;
+            result.compare_exchange_strong(none,error);
+            }
+        };
+
+    std::vector<std::thread> thread_array;
+    for (size_t i = 1; i < aThreadCount; i++)
+        thread_array.emplace_back(worker);
+    worker();
+    for (auto& t : thread_array)
+        t.join();
+    if (result.load())
+        return result.load();
+
+    uint32_t crc = 0;
+    for (size_t i = 0; i < chunk_count; i++)
+        {
+        uint64_t size = std::min(uint64_t(aChunkSize),uint64_t(length) - uint64_t(i) * aChunkSize);
+        crc = Crc32C::Combine(crc,chunk_crc[i],size);
+        }
+    aCrc = crc;
+    return KErrorNone;
+    }
+
+/**
+Verifies the integrity of a map file, or any other file, by comparing its CRC-32C with aExpectedCrc,
+which is normally supplied with the file when it is downloaded.
+Returns KErrorNone if the CRCs match, KErrorCorrupt if they do not, or another error if the file cannot be read.
+The file is read in parallel as described for FileCrc32C.
+*/
+inline TResult VerifyMapFile(const std::string& aFileName,uint32_t aExpectedCrc,size_t aThreadCount = 0)
+    {
+    uint32_t crc = 0;
+    TResult error = FileCrc32C(crc,aFileName,aThreadCount);
+    if (!error && crc != aExpectedCrc)
+        error = KErrorCorrupt;
+    return error;
+    }
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_CRC_H__
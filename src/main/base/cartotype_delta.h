@@ -0,0 +1,515 @@
+/*
+cartotype_delta.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_DELTA_H__
+#define CARTOTYPE_DELTA_H__
+
+#include <cartotype_block_cache.h>
+#include <cartotype_compression.h>
+#include <cartotype_crc.h>
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+Delta updates for CTM1 map files.
+
+A delta describes a new version of a map file as a sequence of instructions which copy ranges of the old version
+and insert new data, in the manner of VCDIFF or bsdiff, so that an update can be shipped as the data that has actually changed
+rather than the whole file. Because copied ranges may come from anywhere in the old file, data which has moved,
+for example because something has been inserted before it, costs only a copy instruction.
+
+Create finds the ranges to copy by indexing the old file in windows of KMatchSize bytes, then moving a rolling hash of
+the same size along the new file, one byte at a time, and extending every matching window as far as possible in both directions.
+Inserted data is stored in chunks of up to KMaxInsertSize bytes, each compressed using LZ4 if that makes it smaller.
+
+A delta has this layout, with all integers little-endian:
+
+<pre>
+offset  size    contents
+0       4       the characters "CTDL"
+4       4       the block size used when reporting changed blocks
+8       8       the length of the old file
+16      4       the CRC-32C of the old file
+20      8       the length of the new file
+28      4       the CRC-32C of the new file
+32      8       the number of instructions, N
+40      ...     N instructions, which produce the new file in order, each being either
+                a copy:
+                    1 byte: 0
+                    8 bytes: the position in the old file
+                    8 bytes: the length
+                or an insertion:
+                    1 byte: 1
+                    4 bytes: the length, which is not greater than KMaxInsertSize
+                    4 bytes: the stored size
+                    1 byte: the compression: a TBlockCompression value
+                    the stored data
+</pre>
+*/
+class CMapDelta
+    {
+    public:
+    /** The default block size: the same as the default CFileInputStream buffer size, so that changed blocks map directly onto cached buffers. */
+    static constexpr uint32_t KDefaultBlockSize = uint32_t(CFileInputStream::KDefaultBufferSize);
+    /** The size of the windows used to find data copied from the old file. */
+    static constexpr size_t KMatchSize = 64;
+    /** The maximum length of a single insertion. */
+    static constexpr size_t KMaxInsertSize = 64 * 1024;
+
+    /** Information about a delta, read from its header. */
+    class TInfo
+        {
+        public:
+        /** The block size used when reporting changed blocks. */
+        uint32_t iBlockSize = 0;
+        /** The length of the old file. */
+        uint64_t iOldLength = 0;
+        /** The CRC-32C of the old file. */
+        uint32_t iOldCrc = 0;
+        /** The length of the new file. */
+        uint64_t iNewLength = 0;
+        /** The CRC-32C of the new file. */
+        uint32_t iNewCrc = 0;
+        /** The number of instructions. */
+        uint64_t iInstructionCount = 0;
+        };
+
+    /**
+    Creates a delta which changes aOldFileName into aNewFileName, and writes it to aDeltaFileName.
+    aBlockSize is the size of the blocks reported as changed when the delta is applied.
+    Both files are read into memory.
+    */
+    static TResult Create(const std::string& aOldFileName,const std::string& aNewFileName,const std::string& aDeltaFileName,uint32_t aBlockSize = KDefaultBlockSize)
+        {
+        if (aBlockSize == 0)
+            return KErrorInvalidArgument;
+        std::vector<uint8_t> old_data, new_data;
+        TResult error = ReadFile(aOldFileName,old_data);
+        if (!error)
+            error = ReadFile(aNewFileName,new_data);
+        if (error)
+            return error;
+        TInfo info;
+        info.iBlockSize = aBlockSize;
+        info.iOldLength = old_data.size();
+        info.iOldCrc = Crc32C::Compute(old_data.data(),old_data.size());
+        info.iNewLength = new_data.size();
+        info.iNewCrc = Crc32C::Compute(new_data.data(),new_data.size());
+
+        std::vector<uint8_t> body;
+        Diff(old_data,new_data,body,info.iInstructionCount);
+
+        std::vector<uint8_t> header { 'C', 'T', 'D', 'L' };
+        AppendLE(header,info.iBlockSize,4);
+        AppendLE(header,info.iOldLength,8);
+        AppendLE(header,info.iOldCrc,4);
+        AppendLE(header,info.iNewLength,8);
+        AppendLE(header,info.iNewCrc,4);
+        AppendLE(header,info.iInstructionCount,8);
+        std::unique_ptr<CFileOutputStream> output;
+        try
+            {
+            output = CFileOutputStream::New(error,aDeltaFileName);
+            if (!error)
+                {
+                output->Write(header.data(),header.size());
+                output->Write(body.data(),body.size());
+                }
+            }
+        catch (TResult e)
+            {
+            error = e;
+            }
+        if (output)
+            {
+            output.reset();
+            if (error)
+                std::remove(aDeltaFileName.c_str());
+            }
+        return error;
+        }
+
+    /** Reads the header of a delta. */
+    static TResult ReadInfo(TInfo& aInfo,const std::string& aDeltaFileName)
+        {
+        CBinaryInputFile file;
+        uint64_t length = 0;
+        TResult error = OpenFile(file,aDeltaFileName,length);
+        if (!error)
+            error = ReadHeader(file,aInfo);
+        return error;
+        }
+
+    /**
+    Applies the delta aDeltaFileName to aBaseFileName, writing the result to aOutputFileName, which must be a different file:
+    KErrorInvalidArgument is returned if it is the same file as the base or the delta, even under another name.
+    The base file is checked against the CRC in the delta before anything is written, and the result is checked afterwards;
+    KErrorCorrupt is returned if either check fails. The caller can then replace the base file with the output file.
+
+    The result is written to a temporary file, aOutputFileName with ".tmp" appended, which is renamed to aOutputFileName only if
+    the delta has been applied successfully. If the delta cannot be applied the temporary file is deleted and aOutputFileName is left unchanged.
+
+    If aChangedBlockArray is non-null it receives, in ascending order, the numbers of the blocks of the output file which differ from the same blocks
+    of the base file, using the block size given when the delta was created, so that only those need to be reloaded.
+    Any blocks belonging to aOutputFileName held in aBlockCache (by default the shared block cache) are removed.
+    */
+    static TResult Apply(const std::string& aBaseFileName,const std::string& aDeltaFileName,const std::string& aOutputFileName,
+                         std::vector<uint64_t>* aChangedBlockArray = nullptr,std::shared_ptr<CBlockCache> aBlockCache = nullptr)
+        {
+        if (aChangedBlockArray)
+            aChangedBlockArray->clear();
+        const std::string temp_file_name = aOutputFileName + ".tmp";
+        TFileIdentity base_identity(aBaseFileName), delta_identity(aDeltaFileName);
+        for (const std::string* name : { &aOutputFileName, &temp_file_name })
+            {
+            TFileIdentity identity(*name);
+            if (*name == aBaseFileName || *name == aDeltaFileName || identity.SameFile(base_identity) || identity.SameFile(delta_identity))
+                return KErrorInvalidArgument;
+            }
+
+        TResult error;
+        std::unique_ptr<CFileOutputStream> output;
+        try
+            {
+            error = Apply(output,aBaseFileName,aDeltaFileName,temp_file_name,aChangedBlockArray);
+            }
+        catch (TResult e)
+            {
+            error = e;
+            }
+        catch (std::bad_alloc&)
+            {
+            error = KErrorNoMemory;
+            }
+
+        // Close the temporary file before renaming or deleting it.
+        bool created = output != nullptr;
+        output.reset();
+        if (!error && std::rename(temp_file_name.c_str(),aOutputFileName.c_str()))
+            {
+            // Renaming over an existing file fails on some platforms.
+            std::remove(aOutputFileName.c_str());
+            if (std::rename(temp_file_name.c_str(),aOutputFileName.c_str()))
+                error = KErrorIo;
+            }
+        if (error)
+            {
+            if (created)
+                std::remove(temp_file_name.c_str());
+            if (aChangedBlockArray)
+                aChangedBlockArray->clear();
+            }
+
+        auto cache = aBlockCache ? aBlockCache : CBlockCache::Shared();
+        cache->Invalidate(aOutputFileName);
+        return error;
+        }
+
+    private:
+    static constexpr uint8_t KCopy = 0;
+    static constexpr uint8_t KInsert = 1;
+    static constexpr uint32_t KHashMultiplier = 0x01000193;
+
+    // Applies a delta, writing the result to aOutputFileName using aOutput, which is created here; may throw TResult if writing fails.
+    static TResult Apply(std::unique_ptr<CFileOutputStream>& aOutput,const std::string& aBaseFileName,const std::string& aDeltaFileName,
+                         const std::string& aOutputFileName,std::vector<uint64_t>* aChangedBlockArray)
+        {
+        CBinaryInputFile delta_file, base_file;
+        TInfo info;
+        uint64_t delta_length = 0, base_length = 0;
+        TResult error = OpenFile(delta_file,aDeltaFileName,delta_length);
+        if (!error)
+            error = ReadHeader(delta_file,info);
+        if (!error)
+            error = OpenFile(base_file,aBaseFileName,base_length);
+        if (error)
+            return error;
+        uint32_t base_crc = 0;
+        error = FileCrc32C(base_crc,aBaseFileName);
+        if (error)
+            return error;
+        if (base_length != info.iOldLength || base_crc != info.iOldCrc)
+            return KErrorCorrupt;
+
+        aOutput = CFileOutputStream::New(error,aOutputFileName);
+        if (error)
+            return error;
+        std::vector<uint8_t> buffer(KMaxInsertSize), stored;
+        uint64_t output_length = 0;
+        uint32_t new_crc = 0;
+        auto write = [&](size_t aLength)
+            {
+            aOutput->Write(buffer.data(),aLength);
+            new_crc = Crc32C::Update(new_crc,buffer.data(),aLength);
+            };
+        for (uint64_t i = 0; !error && i < info.iInstructionCount; i++)
+            {
+            uint8_t type = 0;
+            error = ReadExact(delta_file,&type,1);
+            if (error)
+                break;
+            uint64_t length = 0;
+            bool unchanged = false;
+            if (type == KCopy)
+                {
+                uint8_t h[16];
+                error = ReadExact(delta_file,h,sizeof(h));
+                if (error)
+                    break;
+                uint64_t position = ReadLE(h,8);
+                length = ReadLE(h + 8,8);
+                if (length == 0 || position > base_length || length > base_length - position || length > info.iNewLength - output_length)
+                    {
+                    error = KErrorCorrupt;
+                    break;
+                    }
+                unchanged = position == output_length;
+                error = base_file.Seek(int64_t(position),SEEK_SET);
+                for (uint64_t done = 0; !error && done < length; )
+                    {
+                    size_t n = size_t(std::min(uint64_t(buffer.size()),length - done));
+                    error = ReadExact(base_file,buffer.data(),n);
+                    if (!error)
+                        write(n);
+                    done += n;
+                    }
+                }
+            else if (type == KInsert)
+                {
+                uint8_t h[9];
+                error = ReadExact(delta_file,h,sizeof(h));
+                if (error)
+                    break;
+                length = ReadLE(h,4);
+                size_t stored_size = size_t(ReadLE(h + 4,4));
+                TBlockCompression compression = TBlockCompression(h[8]);
+                if (length == 0 || length > KMaxInsertSize || length > info.iNewLength - output_length || stored_size > length)
+                    {
+                    error = KErrorCorrupt;
+                    break;
+                    }
+                stored.resize(stored_size);
+                error = ReadExact(delta_file,stored.data(),stored_size);
+                size_t decompressed_length = stored_size;
+                if (error)
+                    break;
+                if (compression == TBlockCompression::LZ4)
+                    error = Lz4DecompressBlock(stored.data(),stored_size,buffer.data(),size_t(length),decompressed_length);
+                else if (compression == TBlockCompression::None)
+                    memcpy(buffer.data(),stored.data(),stored_size);
+                else
+                    error = KErrorCorrupt;
+                if (!error && decompressed_length != length)
+                    error = KErrorCorrupt;
+                if (!error)
+                    write(size_t(length));
+                }
+            else
+                error = KErrorCorrupt;
+
+            if (!error && aChangedBlockArray && !unchanged)
+                {
+                uint64_t first = output_length / info.iBlockSize;
+                uint64_t last = (output_length + length - 1) / info.iBlockSize;
+                if (!aChangedBlockArray->empty() && aChangedBlockArray->back() >= first)
+                    first = aChangedBlockArray->back() + 1;
+                for (uint64_t b = first; b <= last; b++)
+                    aChangedBlockArray->push_back(b);
+                }
+            output_length += length;
+            }
+        if (error == KErrorEndOfData)
+            error = KErrorCorrupt;
+        if (!error && (output_length != info.iNewLength || new_crc != info.iNewCrc))
+            error = KErrorCorrupt;
+
+        // The last block has changed if its length has changed, even if its data was copied from the same position.
+        if (!error && aChangedBlockArray && info.iNewLength)
+            {
+            uint64_t last = (info.iNewLength - 1) / info.iBlockSize;
+            uint64_t old_end = std::min(info.iOldLength,(last + 1) * info.iBlockSize);
+            if (old_end != info.iNewLength && (aChangedBlockArray->empty() || aChangedBlockArray->back() != last))
+                aChangedBlockArray->push_back(last);
+            }
+        return error;
+        }
+
+    static uint32_t Hash(const uint8_t* aData)
+        {
+        uint32_t h = 0;
+        for (size_t i = 0; i < KMatchSize; i++)
+            h = h * KHashMultiplier + aData[i];
+        return h;
+        }
+
+    // Writes the instructions creating aNew from aOld to aBody.
+    static void Diff(const std::vector<uint8_t>& aOld,const std::vector<uint8_t>& aNew,std::vector<uint8_t>& aBody,uint64_t& aInstructionCount)
+        {
+        const uint8_t* old_data = aOld.data();
+        const uint8_t* new_data = aNew.data();
+        const size_t old_length = aOld.size();
+        const size_t new_length = aNew.size();
+
+        // Index the old file in aligned windows, keeping the first position of each hash value.
+        std::unordered_map<uint32_t,size_t> index;
+        index.reserve(old_length / KMatchSize);
+        for (size_t p = 0; p + KMatchSize <= old_length; p += KMatchSize)
+            index.emplace(Hash(old_data + p),p);
+
+        // The factor by which the hash of a byte leaving the window has been multiplied.
+        uint32_t leaving_factor = 1;
+        for (size_t i = 1; i < KMatchSize; i++)
+            leaving_factor *= KHashMultiplier;
+
+        size_t literal_start = 0;
+        size_t pos = 0;
+        uint32_t h = new_length >= KMatchSize ? Hash(new_data) : 0;
+        while (pos + KMatchSize <= new_length)
+            {
+            // Data that has not moved is preferred, so that unchanged blocks can be recognised when the delta is applied.
+            size_t source = SIZE_MAX;
+            if (pos + KMatchSize <= old_length && old_data[pos] == new_data[pos] && !memcmp(old_data + pos,new_data + pos,KMatchSize))
+                source = pos;
+            else
+                {
+                auto p = index.find(h);
+                if (p != index.end() && !memcmp(old_data + p->second,new_data + pos,KMatchSize))
+                    source = p->second;
+                }
+
+            if (source == SIZE_MAX)
+                {
+                if (pos + KMatchSize < new_length)
+                    h = (h - new_data[pos] * leaving_factor) * KHashMultiplier + new_data[pos + KMatchSize];
+                pos++;
+                continue;
+                }
+
+            size_t start = pos, end = pos + KMatchSize;
+            size_t source_end = source + KMatchSize;
+            while (start > literal_start && source > 0 && new_data[start - 1] == old_data[source - 1])
+                {
+                start--;
+                source--;
+                }
+            while (end < new_length && source_end < old_length && new_data[end] == old_data[source_end])
+                {
+                end++;
+                source_end++;
+                }
+            AppendInsert(aBody,aInstructionCount,new_data + literal_start,start - literal_start);
+            aBody.push_back(uint8_t(KCopy));
+            AppendLE(aBody,source,8);
+            AppendLE(aBody,end - start,8);
+            aInstructionCount++;
+            literal_start = pos = end;
+            if (pos + KMatchSize <= new_length)
+                h = Hash(new_data + pos);
+            }
+        AppendInsert(aBody,aInstructionCount,new_data + literal_start,new_length - literal_start);
+        }
+
+    static void AppendInsert(std::vector<uint8_t>& aBody,uint64_t& aInstructionCount,const uint8_t* aData,size_t aLength)
+        {
+        std::vector<uint8_t> compressed;
+        while (aLength)
+            {
+            size_t n = std::min(aLength,size_t(KMaxInsertSize));
+            Lz4CompressBlock(aData,n,compressed);
+            bool use_compressed = compressed.size() < n;
+            aBody.push_back(uint8_t(KInsert));
+            AppendLE(aBody,n,4);
+            AppendLE(aBody,use_compressed ? compressed.size() : n,4);
+            aBody.push_back(uint8_t(use_compressed ? TBlockCompression::LZ4 : TBlockCompression::None));
+            if (use_compressed)
+                aBody.insert(aBody.end(),compressed.begin(),compressed.end());
+            else
+                aBody.insert(aBody.end(),aData,aData + n);
+            aInstructionCount++;
+            aData += n;
+            aLength -= n;
+            }
+        }
+
+    static void AppendLE(std::vector<uint8_t>& aBuffer,uint64_t aValue,size_t aBytes)
+        {
+        for (size_t i = 0; i < aBytes; i++)
+            aBuffer.push_back(uint8_t(aValue >> (8 * i)));
+        }
+    static uint64_t ReadLE(const uint8_t* aData,size_t aBytes)
+        {
+        uint64_t v = 0;
+        for (size_t i = 0; i < aBytes; i++)
+            v |= uint64_t(aData[i]) << (8 * i);
+        return v;
+        }
+
+    static TResult OpenFile(CBinaryInputFile& aFile,const std::string& aFileName,uint64_t& aLength)
+        {
+        TResult error = aFile.Open(aFileName.c_str());
+        if (!error)
+            error = aFile.Seek(0,SEEK_END);
+        if (error)
+            return error;
+        int64_t length = aFile.Tell();
+        if (length < 0)
+            return KErrorIo;
+        aLength = uint64_t(length);
+        return aFile.Seek(0,SEEK_SET);
+        }
+
+    static TResult ReadExact(CBinaryInputFile& aFile,uint8_t* aBuffer,size_t aLength)
+        {
+        while (aLength)
+            {
+            size_t n = aFile.Read(aBuffer,aLength);
+            if (n == 0 || n > aLength)
+                return KErrorEndOfData;
+            aBuffer += n;
+            aLength -= n;
+            }
+        return KErrorNone;
+        }
+
+    static TResult ReadFile(const std::string& aFileName,std::vector<uint8_t>& aData)
+        {
+        CBinaryInputFile file;
+        uint64_t length = 0;
+        TResult error = OpenFile(file,aFileName,length);
+        if (error)
+            return error;
+        if (length > SIZE_MAX)
+            return KErrorNoMemory;
+        aData.resize(size_t(length));
+        return ReadExact(file,aData.data(),aData.size());
+        }
+
+    static TResult ReadHeader(CBinaryInputFile& aFile,TInfo& aInfo)
+        {
+        uint8_t h[40];
+        TResult error = ReadExact(aFile,h,sizeof(h));
+        if (error)
+            return error;
+        if (memcmp(h,"CTDL",4))
+            return KErrorUnknownDataFormat;
+        aInfo.iBlockSize = uint32_t(ReadLE(h + 4,4));
+        aInfo.iOldLength = ReadLE(h + 8,8);
+        aInfo.iOldCrc = uint32_t(ReadLE(h + 16,4));
+        aInfo.iNewLength = ReadLE(h + 20,8);
+        aInfo.iNewCrc = uint32_t(ReadLE(h + 28,4));
+        aInfo.iInstructionCount = ReadLE(h + 32,8);
+        return aInfo.iBlockSize ? KErrorNone : KErrorCorrupt;
+        }
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_DELTA_H__
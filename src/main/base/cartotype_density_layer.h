@@ -0,0 +1,316 @@
+/*
+cartotype_density_layer.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_DENSITY_LAYER_H__
+#define CARTOTYPE_DENSITY_LAYER_H__
+
+#include <cartotype_string.h>
+#include <cartotype_color.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+namespace CartoType
+{
+
+/** Parameters for creating a density layer. */
+class TDensityLayerParam
+    {
+    public:
+    /** The area covered by the layer, in map coordinates. Points outside it are ignored. */
+    TRect iExtent;
+    /** The size of the cells of the finest grid, in map units. The pyramid takes about 10.7 bytes for each cell of the finest grid. */
+    int32_t iFinestCellSize = 32 * 16;
+    /** The radius of the smoothing kernel in pixels. */
+    double iRadiusInPixels = 12;
+    /**
+    The colors used for increasing density, from low to high, evenly spaced; they are interpolated to give a ramp of 256 colors.
+    Zero density is always transparent. If the array is empty a default ramp from transparent blue through green and yellow to red is used.
+    */
+    std::vector<TColor> iColorRamp;
+    };
+
+/**
+A layer showing the density of weighted points, such as GPS positions or incidents, as a colored raster.
+
+Points are accumulated into a pyramid of grids: each point adds its weight to one cell at each level, and
+the cells at each level are twice the size of those at the level below. Cells hold doubles, so that counts remain exact far beyond
+the 2^24 at which a float stops counting. Adding a point therefore takes a time proportional
+to the number of levels, and millions of points can be added without slowing drawing.
+
+When the layer is drawn, the level with cells closest to the size of a pixel is used, so the cost of drawing depends on the size of the
+bitmap rather than the number of points. The cells are smoothed with a separable Gaussian kernel, which is equivalent to
+splatting each point with the kernel, but much cheaper; the inner loops work on contiguous rows of floats so that they can be vectorized.
+The result is scaled so that the highest density maps to the last color of the ramp.
+
+The layer name identifies the layer to the application; Draw renders it into an array of pixels, which the application
+can draw as a bitmap over the map. All functions may be called from any thread.
+*/
+class CDensityLayer
+    {
+    public:
+    /** Creates a density layer with the name aLayerName. */
+    CDensityLayer(const CString& aLayerName,const TDensityLayerParam& aParam):
+        m_layer_name(aLayerName),
+        m_param(aParam)
+        {
+        m_param.iFinestCellSize = std::max(m_param.iFinestCellSize,1);
+        int32_t w = std::max(int32_t((int64_t(m_param.iExtent.Width()) + m_param.iFinestCellSize - 1) / m_param.iFinestCellSize),1);
+        int32_t h = std::max(int32_t((int64_t(m_param.iExtent.Height()) + m_param.iFinestCellSize - 1) / m_param.iFinestCellSize),1);
+        int64_t cell_size = m_param.iFinestCellSize;
+        for (;;)
+            {
+            TGrid grid;
+            grid.iWidth = w;
+            grid.iHeight = h;
+            grid.iCellSize = int32_t(cell_size);
+            grid.iCell.resize(size_t(w) * size_t(h));
+            m_level.push_back(std::move(grid));
+            // Stop at a single cell, or before the cell size would overflow.
+            cell_size *= 2;
+            if ((w == 1 && h == 1) || m_level.size() >= 24 || cell_size > INT32_MAX)
+                break;
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            }
+        SetColorRamp(m_param.iColorRamp);
+        }
+
+    /** Returns the name of the style sheet layer used to draw the density. */
+    const CString& LayerName() const { return m_layer_name; }
+    /** Returns the number of levels in the pyramid. */
+    size_t LevelCount() const { return m_level.size(); }
+    /** Returns the total weight of all points added. */
+    double TotalWeight() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_total_weight;
+        }
+
+    /** Sets the colors used for increasing density; see TDensityLayerParam::iColorRamp. */
+    void SetColorRamp(const std::vector<TColor>& aColorRamp)
+        {
+        std::vector<TColor> ramp = aColorRamp;
+        if (ramp.empty())
+            ramp = { TColor(0,0,255,0),TColor(0,0,255,160),TColor(0,255,0,200),TColor(255,255,0,230),TColor(255,0,0,255) };
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < m_ramp.size(); i++)
+            {
+            double pos = ramp.size() == 1 ? 0 : double(i) / 255 * (ramp.size() - 1);
+            size_t index = std::min(size_t(pos),ramp.size() - 1);
+            size_t next = std::min(index + 1,ramp.size() - 1);
+            double t = pos - index;
+            auto mix = [t](int32_t a,int32_t b) { return int32_t(std::lround(a + (b - a) * t)); };
+            m_ramp[i] = TColor(mix(ramp[index].Red(),ramp[next].Red()),mix(ramp[index].Green(),ramp[next].Green()),
+                               mix(ramp[index].Blue(),ramp[next].Blue()),mix(ramp[index].Alpha(),ramp[next].Alpha()));
+            }
+        m_ramp[0] = TColor(0,0,0,0);
+        }
+
+    /**
+    Adds aCount points with positions in map coordinates given by aPointArray and weights by aWeightArray, which may be null,
+    in which case each point has a weight of 1. Points outside the extent of the layer are ignored.
+    Weights may be negative, to remove points added earlier.
+    */
+    void AddPoints(const TPoint* aPointArray,const float* aWeightArray,size_t aCount)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const TRect& e = m_param.iExtent;
+        for (size_t i = 0; i < aCount; i++)
+            {
+            const TPoint& p = aPointArray[i];
+            if (p.iX < e.Left() || p.iY < e.Top() || p.iX >= e.Right() || p.iY >= e.Bottom())
+                continue;
+            float weight = aWeightArray ? aWeightArray[i] : 1.0f;
+            int32_t x = int32_t((int64_t(p.iX) - e.Left()) / m_param.iFinestCellSize);
+            int32_t y = int32_t((int64_t(p.iY) - e.Top()) / m_param.iFinestCellSize);
+            for (auto& grid : m_level)
+                {
+                grid.iCell[size_t(y) * grid.iWidth + x] += weight;
+                x >>= 1;
+                y >>= 1;
+                }
+            m_total_weight += weight;
+            }
+        }
+    /** Removes all points. */
+    void Clear()
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& grid : m_level)
+            std::fill(grid.iCell.begin(),grid.iCell.end(),0.0);
+        m_total_weight = 0;
+        }
+
+    /**
+    Draws the density in the area aBounds, in map coordinates, into aPixelArray, which is resized to aWidth * aHeight
+    colors in the RGBA format used by TColor. Row 0 is the northern (maximum y) edge of aBounds.
+    If aMaxDensity is greater than zero it is the density drawn using the last color of the ramp; otherwise the highest density
+    in the area is used. Returns the density used for scaling.
+    */
+    float Draw(std::vector<uint32_t>& aPixelArray,const TRect& aBounds,int32_t aWidth,int32_t aHeight,float aMaxDensity = 0) const
+        {
+        aPixelArray.assign(size_t(std::max(aWidth,0)) * size_t(std::max(aHeight,0)),0);
+        if (aWidth <= 0 || aHeight <= 0 || aBounds.Width() <= 0 || aBounds.Height() <= 0)
+            return aMaxDensity;
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Choose the coarsest level with cells no larger than a pixel.
+        double pixel_size = std::max(double(aBounds.Width()) / aWidth,double(aBounds.Height()) / aHeight);
+        size_t level = 0;
+        while (level + 1 < m_level.size() && m_level[level + 1].iCellSize <= pixel_size)
+            level++;
+        const TGrid& grid = m_level[level];
+
+        /*
+        If even the coarsest cells are smaller than a pixel, as when the whole extent covers only a few pixels,
+        the cells are summed into bins of about a pixel, so that the kernel is a few bins wide rather than thousands of cells.
+        */
+        int32_t bin_cells = int32_t(std::max(1.0,std::min(std::floor(pixel_size / grid.iCellSize),double(1 << 24))));
+        double bin_size = double(grid.iCellSize) * bin_cells;
+        int32_t bin_columns = (grid.iWidth + bin_cells - 1) / bin_cells;
+        int32_t bin_rows = (grid.iHeight + bin_cells - 1) / bin_cells;
+
+        // Find the bins covering the area, with a margin for the kernel, clipped to the grid and its margin, outside which the density is zero.
+        double radius = std::max(m_param.iRadiusInPixels * pixel_size / bin_size,0.5);
+        int32_t margin = int32_t(std::ceil(radius));
+        double left = (double(aBounds.Left()) - m_param.iExtent.Left()) / bin_size;
+        double right = (double(aBounds.Right()) - m_param.iExtent.Left()) / bin_size;
+        double top = (double(aBounds.Top()) - m_param.iExtent.Top()) / bin_size;
+        double bottom = (double(aBounds.Bottom()) - m_param.iExtent.Top()) / bin_size;
+        if (right + margin < 0 || left - margin > bin_columns || bottom + margin < 0 || top - margin > bin_rows)
+            return aMaxDensity;
+        auto clip = [margin](double aBin,int32_t aBinCount) { return int32_t(std::max(-double(margin),std::min(aBin,double(aBinCount - 1 + margin)))); };
+        int32_t x0 = clip(std::floor(left) - margin,bin_columns), x1 = clip(std::ceil(right) + margin,bin_columns);
+        int32_t y0 = clip(std::floor(top) - margin,bin_rows), y1 = clip(std::ceil(bottom) + margin,bin_rows);
+        int32_t w = x1 - x0 + 1, h = y1 - y0 + 1;
+        std::vector<float> window(size_t(w) * size_t(h));
+        int32_t cx0 = int32_t(std::min(int64_t(std::max(x0,0)) * bin_cells,int64_t(grid.iWidth)));
+        int32_t cx1 = int32_t(std::min(int64_t(x1 + 1) * bin_cells,int64_t(grid.iWidth)));
+        int32_t cy0 = int32_t(std::min(int64_t(std::max(y0,0)) * bin_cells,int64_t(grid.iHeight)));
+        int32_t cy1 = int32_t(std::min(int64_t(y1 + 1) * bin_cells,int64_t(grid.iHeight)));
+        for (int32_t y = cy0; y < cy1; y++)
+            {
+            const double* cell = &grid.iCell[size_t(y) * grid.iWidth];
+            float* out = &window[size_t(y / bin_cells - y0) * w];
+            for (int32_t x = cx0; x < cx1; x++)
+                out[x / bin_cells - x0] += float(cell[x]);
+            }
+
+        // Smooth using a separable Gaussian kernel with a standard deviation of half the radius.
+        std::vector<float> kernel(size_t(margin) * 2 + 1);
+        double sigma = radius / 2;
+        for (int32_t i = -margin; i <= margin; i++)
+            kernel[i + margin] = float(std::exp(-0.5 * (i / sigma) * (i / sigma)));
+        std::vector<float> temp(window.size());
+        for (int32_t y = 0; y < h; y++)
+            {
+            const float* in = &window[size_t(y) * w];
+            float* out = &temp[size_t(y) * w];
+            for (int32_t k = -margin; k <= margin; k++)
+                {
+                float kw = kernel[k + margin];
+                int32_t xs = std::max(0,-k), xe = std::min(w,w - k);
+                for (int32_t x = xs; x < xe; x++)
+                    out[x] += kw * in[x + k];
+                }
+            }
+        std::fill(window.begin(),window.end(),0.0f);
+        for (int32_t y = 0; y < h; y++)
+            {
+            float* out = &window[size_t(y) * w];
+            for (int32_t k = -margin; k <= margin; k++)
+                {
+                if (y + k < 0 || y + k >= h)
+                    continue;
+                float kw = kernel[k + margin];
+                const float* in = &temp[size_t(y + k) * w];
+                for (int32_t x = 0; x < w; x++)
+                    out[x] += kw * in[x];
+                }
+            }
+
+        // Find the pixels with centres inside the window; the others are left transparent.
+        double pixel_x = double(aBounds.Width()) / aWidth, pixel_y = double(aBounds.Height()) / aHeight;
+        double window_left = m_param.iExtent.Left() + x0 * bin_size, window_right = m_param.iExtent.Left() + (x1 + 1) * bin_size;
+        double window_top = m_param.iExtent.Top() + y0 * bin_size, window_bottom = m_param.iExtent.Top() + (y1 + 1) * bin_size;
+        int32_t px0 = int32_t(std::max(0.0,std::ceil((window_left - aBounds.Left()) / pixel_x - 0.5)));
+        int32_t px1 = int32_t(std::min(double(aWidth - 1),std::floor((window_right - aBounds.Left()) / pixel_x - 0.5)));
+        int32_t py0 = int32_t(std::max(0.0,std::ceil((aBounds.Bottom() - window_bottom) / pixel_y - 0.5)));
+        int32_t py1 = int32_t(std::min(double(aHeight - 1),std::floor((aBounds.Bottom() - window_top) / pixel_y - 0.5)));
+        if (px0 > px1 || py0 > py1)
+            return aMaxDensity;
+
+        // Resample to pixels using bilinear interpolation and map densities to colors.
+        int32_t dw = px1 - px0 + 1;
+        std::vector<float> density(size_t(dw) * size_t(py1 - py0 + 1));
+        float max_density = 0;
+        for (int32_t py = py0; py <= py1; py++)
+            {
+            double my = aBounds.Bottom() - (py + 0.5) * pixel_y;
+            double fy = (my - m_param.iExtent.Top()) / bin_size - 0.5 - y0;
+            int32_t iy = std::max(0,std::min(int32_t(std::floor(fy)),std::max(h - 2,0)));
+            float ty = float(std::max(0.0,std::min(fy - iy,1.0)));
+            const float* row0 = &window[size_t(iy) * w];
+            const float* row1 = &window[size_t(std::min(iy + 1,h - 1)) * w];
+            float* out = &density[size_t(py - py0) * dw];
+            for (int32_t px = px0; px <= px1; px++)
+                {
+                double mx = aBounds.Left() + (px + 0.5) * pixel_x;
+                double fx = (mx - m_param.iExtent.Left()) / bin_size - 0.5 - x0;
+                int32_t ix = std::max(0,std::min(int32_t(std::floor(fx)),std::max(w - 2,0)));
+                int32_t ix1 = std::min(ix + 1,w - 1);
+                float tx = float(std::max(0.0,std::min(fx - ix,1.0)));
+                float upper = row0[ix] + (row0[ix1] - row0[ix]) * tx;
+                float lower = row1[ix] + (row1[ix1] - row1[ix]) * tx;
+                float d = upper + (lower - upper) * ty;
+                out[px - px0] = d;
+                max_density = std::max(max_density,d);
+                }
+            }
+        if (aMaxDensity <= 0)
+            aMaxDensity = max_density;
+        if (aMaxDensity <= 0)
+            return aMaxDensity;
+        float scale = 255.0f / aMaxDensity;
+        for (int32_t py = py0; py <= py1; py++)
+            {
+            const float* in = &density[size_t(py - py0) * dw];
+            uint32_t* out = &aPixelArray[size_t(py) * aWidth];
+            for (int32_t px = px0; px <= px1; px++)
+                {
+                float d = in[px - px0] * scale;
+                int32_t index = d <= 0 ? 0 : std::max(1,std::min(255,int32_t(d + 0.5f)));
+                out[px] = m_ramp[index].iValue;
+                }
+            }
+        return aMaxDensity;
+        }
+
+    private:
+    class TGrid
+        {
+        public:
+        int32_t iWidth = 0;
+        int32_t iHeight = 0;
+        int32_t iCellSize = 0;
+        std::vector<double> iCell;
+        };
+
+    CString m_layer_name;
+    TDensityLayerParam m_param;
+    mutable std::mutex m_mutex;
+    std::vector<TGrid> m_level;
+    std::array<TColor,256> m_ramp;
+    double m_total_weight = 0;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_DENSITY_LAYER_H__
@@ -0,0 +1,330 @@
+/*
+cartotype_edit_geometry_cache.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_EDIT_GEOMETRY_CACHE_H__
+#define CARTOTYPE_EDIT_GEOMETRY_CACHE_H__
+
+#include <cartotype_transform.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A cache of the simplified display geometry of a map object being edited interactively.
+
+An application can draw the object into a separate overlay while it is being edited, so that the map itself does not need
+to be redrawn when a point is moved. The points are divided into chunks, each of which is transformed to display
+coordinates and simplified separately, using a tolerance in pixels. When a point is moved, inserted or deleted only the chunk
+containing it is recalculated, so dragging a point of a boundary with thousands of points costs about the same as dragging
+a point of a small polygon. The current point and the ends of each chunk are never removed by simplification,
+so the point being dragged is always drawn exactly where it is.
+
+Changing the transform, as when the map is panned or zoomed, invalidates all the chunks.
+*/
+class CEditGeometryCache
+    {
+    public:
+    /** Creates an empty cache dividing the points into chunks of about aChunkSize points. */
+    explicit CEditGeometryCache(size_t aChunkSize = 256):
+        m_chunk_size(std::max(aChunkSize,size_t(4)))
+        {
+        }
+
+    /** Sets the points of the object, in map coordinates, and whether it is closed. */
+    void SetPoints(const std::vector<TPointFP>& aPointArray,bool aClosed)
+        {
+        m_point = aPointArray;
+        m_closed = aClosed;
+        m_current = SIZE_MAX;
+        Rechunk();
+        }
+    /**
+    Sets the transform from map coordinates to display coordinates, and the simplification tolerance in pixels.
+    If either has changed, all the chunks are recalculated when the display points are next needed.
+    */
+    void SetTransform(const TTransform& aMapToDisplay,double aTolerance = 0.25)
+        {
+        bool same = m_transform_set && m_tolerance == aTolerance &&
+                    m_transform.A() == aMapToDisplay.A() && m_transform.B() == aMapToDisplay.B() &&
+                    m_transform.C() == aMapToDisplay.C() && m_transform.D() == aMapToDisplay.D() &&
+                    m_transform.Tx() == aMapToDisplay.Tx() && m_transform.Ty() == aMapToDisplay.Ty();
+        if (same)
+            return;
+        m_transform = aMapToDisplay;
+        m_transform_set = true;
+        m_tolerance = aTolerance;
+        for (auto& c : m_chunk)
+            c.iValid = false;
+        m_display_valid = false;
+        m_dirty_all = true;
+        }
+    /** Sets the current point, which is never removed by simplification. Use SIZE_MAX if there is no current point. */
+    void SetCurrentPoint(size_t aIndex)
+        {
+        if (aIndex == m_current)
+            return;
+        Invalidate(m_current);
+        m_current = aIndex;
+        Invalidate(m_current);
+        }
+
+    /** Moves the point with index aIndex to aPoint, in map coordinates. */
+    void MovePoint(size_t aIndex,const TPointFP& aPoint)
+        {
+        if (aIndex >= m_point.size())
+            return;
+        AddDirtyNeighbours(aIndex);
+        m_point[aIndex] = aPoint;
+        AddDirtyNeighbours(aIndex);
+        Invalidate(aIndex);
+        }
+    /** Inserts aPoint, in map coordinates, before the point with index aIndex. */
+    void InsertPoint(size_t aIndex,const TPointFP& aPoint)
+        {
+        aIndex = std::min(aIndex,m_point.size());
+        m_point.insert(m_point.begin() + aIndex,aPoint);
+        if (m_current != SIZE_MAX && m_current >= aIndex)
+            m_current++;
+        size_t c = ChunkContaining(aIndex == m_point.size() - 1 && aIndex > 0 ? aIndex - 1 : aIndex);
+        m_chunk[c].iEnd++;
+        for (size_t i = c + 1; i < m_chunk.size(); i++)
+            {
+            m_chunk[i].iStart++;
+            m_chunk[i].iEnd++;
+            }
+        m_chunk[c].iValid = false;
+        if (m_chunk[c].iEnd - m_chunk[c].iStart > m_chunk_size * 2)
+            Rechunk();
+        AddDirtyNeighbours(aIndex);
+        m_display_valid = false;
+        }
+    /** Deletes the point with index aIndex. */
+    void DeletePoint(size_t aIndex)
+        {
+        if (aIndex >= m_point.size())
+            return;
+        AddDirtyNeighbours(aIndex);
+        size_t c = ChunkContaining(aIndex);
+        m_point.erase(m_point.begin() + aIndex);
+        if (m_current == aIndex)
+            m_current = SIZE_MAX;
+        else if (m_current != SIZE_MAX && m_current > aIndex)
+            m_current--;
+        m_chunk[c].iEnd--;
+        for (size_t i = c + 1; i < m_chunk.size(); i++)
+            {
+            m_chunk[i].iStart--;
+            m_chunk[i].iEnd--;
+            }
+        if (m_chunk[c].iStart == m_chunk[c].iEnd)
+            Rechunk();
+        else
+            m_chunk[c].iValid = false;
+        m_display_valid = false;
+        }
+
+    /** Returns the points in map coordinates. */
+    const std::vector<TPointFP>& Points() const { return m_point; }
+    /** Returns true if the object is closed. */
+    bool Closed() const { return m_closed; }
+    /** Returns the simplified points in display coordinates, recalculating only the chunks which have changed. */
+    const std::vector<TPointFP>& DisplayPoints()
+        {
+        if (m_display_valid)
+            return m_display;
+        m_display.clear();
+        for (auto& c : m_chunk)
+            {
+            if (!c.iValid)
+                {
+                Simplify(c);
+                m_chunks_recalculated++;
+                }
+            m_display.insert(m_display.end(),c.iDisplay.begin(),c.iDisplay.end());
+            }
+        m_display_valid = true;
+        return m_display;
+        }
+    /**
+    Gets the area of the display, in display coordinates, affected by changes since the last call, including the segments on both sides of
+    each moved, inserted or deleted point, and resets it. Returns false if nothing has changed. Returns true and sets aAll to true
+    if the whole object must be redrawn, because the points or the transform have been replaced.
+    */
+    bool TakeDirtyBounds(TRectFP& aBounds,bool& aAll)
+        {
+        aAll = m_dirty_all;
+        aBounds = m_dirty_bounds;
+        bool dirty = m_dirty_all || m_has_dirty_bounds;
+        m_dirty_all = m_has_dirty_bounds = false;
+        return dirty;
+        }
+    /** Returns the total number of chunk recalculations, for measuring the effectiveness of the cache. */
+    size_t ChunksRecalculated() const { return m_chunks_recalculated; }
+
+    private:
+    class TChunk
+        {
+        public:
+        size_t iStart = 0; // the index of the first point
+        size_t iEnd = 0; // one more than the index of the last point
+        bool iValid = false;
+        std::vector<TPointFP> iDisplay;
+        };
+
+    void Rechunk()
+        {
+        m_chunk.clear();
+        for (size_t i = 0; i < m_point.size(); i += m_chunk_size)
+            {
+            TChunk c;
+            c.iStart = i;
+            c.iEnd = std::min(i + m_chunk_size,m_point.size());
+            m_chunk.push_back(std::move(c));
+            }
+        if (m_chunk.empty())
+            m_chunk.emplace_back();
+        m_display_valid = false;
+        m_dirty_all = true;
+        }
+    size_t ChunkContaining(size_t aIndex) const
+        {
+        auto p = std::upper_bound(m_chunk.begin(),m_chunk.end(),aIndex,[](size_t aValue,const TChunk& aChunk) { return aValue < aChunk.iEnd; });
+        return p == m_chunk.end() ? m_chunk.size() - 1 : size_t(p - m_chunk.begin());
+        }
+    void Invalidate(size_t aIndex)
+        {
+        if (aIndex >= m_point.size())
+            return;
+        m_chunk[ChunkContaining(aIndex)].iValid = false;
+        m_display_valid = false;
+        }
+
+    TPointFP ToDisplay(const TPointFP& aPoint) const
+        {
+        TPointFP p = aPoint;
+        if (m_transform_set)
+            m_transform.Transform(p.iX,p.iY);
+        return p;
+        }
+    void AddDirty(const TPointFP& aPoint)
+        {
+        if (!m_has_dirty_bounds)
+            {
+            m_dirty_bounds = TRectFP(aPoint.iX,aPoint.iY,aPoint.iX,aPoint.iY);
+            m_has_dirty_bounds = true;
+            }
+        else
+            m_dirty_bounds.Combine(aPoint);
+        }
+    // Adds the display positions of a point and its neighbours to the dirty area.
+    void AddDirtyNeighbours(size_t aIndex)
+        {
+        size_t n = m_point.size();
+        if (n == 0)
+            return;
+        aIndex = std::min(aIndex,n - 1);
+        AddDirty(ToDisplay(m_point[aIndex]));
+        if (aIndex > 0)
+            AddDirty(ToDisplay(m_point[aIndex - 1]));
+        else if (m_closed)
+            AddDirty(ToDisplay(m_point[n - 1]));
+        if (aIndex + 1 < n)
+            AddDirty(ToDisplay(m_point[aIndex + 1]));
+        else if (m_closed)
+            AddDirty(ToDisplay(m_point[0]));
+        }
+
+    // Transforms a chunk to display coordinates and simplifies it using the Douglas-Peucker algorithm.
+    void Simplify(TChunk& aChunk)
+        {
+        aChunk.iDisplay.clear();
+        size_t n = aChunk.iEnd - aChunk.iStart;
+        if (n == 0)
+            {
+            aChunk.iValid = true;
+            return;
+            }
+        std::vector<TPointFP> p(n);
+        for (size_t i = 0; i < n; i++)
+            p[i] = ToDisplay(m_point[aChunk.iStart + i]);
+        std::vector<bool> keep(n,false);
+        keep[0] = keep[n - 1] = true;
+        std::vector<std::pair<size_t,size_t>> stack;
+        if (m_current >= aChunk.iStart && m_current < aChunk.iEnd)
+            {
+            size_t c = m_current - aChunk.iStart;
+            keep[c] = true;
+            stack.push_back({ 0,c });
+            stack.push_back({ c,n - 1 });
+            }
+        else
+            stack.push_back({ 0,n - 1 });
+        double tolerance_squared = m_tolerance * m_tolerance;
+        while (!stack.empty())
+            {
+            auto range = stack.back();
+            stack.pop_back();
+            if (range.second <= range.first + 1)
+                continue;
+            const TPointFP& a = p[range.first];
+            const TPointFP& b = p[range.second];
+            double dx = b.iX - a.iX, dy = b.iY - a.iY;
+            double length_squared = dx * dx + dy * dy;
+            double max_distance = -1;
+            size_t max_index = range.first;
+            for (size_t i = range.first + 1; i < range.second; i++)
+                {
+                double ex = p[i].iX - a.iX, ey = p[i].iY - a.iY;
+                double d;
+                if (length_squared == 0)
+                    d = ex * ex + ey * ey;
+                else
+                    {
+                    double cross = ex * dy - ey * dx;
+                    d = cross * cross / length_squared;
+                    }
+                if (d > max_distance)
+                    {
+                    max_distance = d;
+                    max_index = i;
+                    }
+                }
+            if (max_distance > tolerance_squared)
+                {
+                keep[max_index] = true;
+                stack.push_back({ range.first,max_index });
+                stack.push_back({ max_index,range.second });
+                }
+            }
+        for (size_t i = 0; i < n; i++)
+            if (keep[i])
+                aChunk.iDisplay.push_back(p[i]);
+        aChunk.iValid = true;
+        }
+
+    size_t m_chunk_size;
+    std::vector<TPointFP> m_point;
+    bool m_closed = false;
+    size_t m_current = SIZE_MAX;
+    std::vector<TChunk> m_chunk { TChunk() };
+    TTransform m_transform;
+    bool m_transform_set = false;
+    double m_tolerance = 0.25;
+    std::vector<TPointFP> m_display;
+    bool m_display_valid = false;
+    TRectFP m_dirty_bounds;
+    bool m_has_dirty_bounds = false;
+    bool m_dirty_all = false;
+    size_t m_chunks_recalculated = 0;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_EDIT_GEOMETRY_CACHE_H__
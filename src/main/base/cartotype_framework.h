@@ -782,8 +782,10 @@ class CFramework: public MNavigatorObserver
     void NotifyObservers(std::function<void(MFrameworkObserver&)>);
     void DeleteNullObservers();
     void ViewChanged() { NotifyObservers([](MFrameworkObserver& aP) { aP.OnViewChange(); }); }
-    void MainDataChanged() { NotifyObservers([](MFrameworkObserver& aP) { aP.OnMainDataChange(); }); }
-    void DynamicDataChanged() { NotifyObservers([](MFrameworkObserver& aP) { aP.OnDynamicDataChange(); }); }
+    void MainDataChanged() { MainDataChanged(TMapDataChange::WholeMap(0)); }
+    void MainDataChanged(const TMapDataChange& aChange) { NotifyObservers([&aChange](MFrameworkObserver& aP) { aP.OnMainDataChangeDelta(aChange); }); }
+    void DynamicDataChanged() { DynamicDataChanged(TMapDataChange::WholeMap(0)); }
+    void DynamicDataChanged(const TMapDataChange& aChange) { NotifyObservers([&aChange](MFrameworkObserver& aP) { aP.OnDynamicDataChangeDelta(aChange); }); }
     void StyleChanged() { NotifyObservers([](MFrameworkObserver& aP) { aP.OnStyleChange(); }); }
     void LayerChanged() { NotifyObservers([](MFrameworkObserver& aP) { aP.OnLayerChange(); }); }
     void NoticeChanged() { NotifyObservers([](MFrameworkObserver& aP) { aP.OnNoticeChange(); }); }
@@ -8,6 +8,7 @@ See www.cartotype.com for more information.
 #define CARTOTYPE_FRAMEWORK_OBSERVER_H__
 
 #include <cartotype_navigation.h>
+#include <cartotype_map_data_change.h>
 
 namespace CartoType
 {
@@ -53,6 +54,20 @@ class MFrameworkObserver: public MNavigatorObserver
 
     /** This virtual function is called when the notices such as the legend, scale bar and copyright notice are changed, enabled or disabled. */
     virtual void OnNoticeChange() { }
+
+    /**
+    This virtual function is called when the map data changes, with a description of the change.
+    The default implementation calls OnMainDataChange(), so override either this function or that one, not both.
+    */
+    virtual void OnMainDataChangeDelta(const TMapDataChange& /*aChange*/) { OnMainDataChange(); }
+
+    /**
+    This virtual function is called when the dynamic data changes, with a description of the change
+    giving the map handle, the ranges of ids of the objects inserted, replaced or deleted, and the bounds
+    of the area to be redrawn. Use TTileRange::ForChange to find the tiles to be invalidated.
+    The default implementation calls OnDynamicDataChange(), so override either this function or that one, not both.
+    */
+    virtual void OnDynamicDataChangeDelta(const TMapDataChange& /*aChange*/) { OnDynamicDataChange(); }
     };
 
 }
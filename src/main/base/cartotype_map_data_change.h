@@ -0,0 +1,217 @@
+/*
+cartotype_map_data_change.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MAP_DATA_CHANGE_H__
+#define CARTOTYPE_MAP_DATA_CHANGE_H__
+
+#include <cartotype_base.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+namespace CartoType
+{
+
+/** An inclusive range of map object ids. */
+class TMapObjectIdRange
+    {
+    public:
+    /** The first id in the range. */
+    uint64_t iStartId = 0;
+    /** The last id in the range. */
+    uint64_t iEndId = 0;
+    };
+
+/**
+A description of a change to map data, passed to MFrameworkObserver::OnMainDataChangeDelta and MFrameworkObserver::OnDynamicDataChangeDelta,
+so that tile caches and views can update only what has changed.
+
+If iWholeMap is true the extent of the change is unknown, as when a map is loaded or unloaded,
+and everything drawn from the map identified by iMapHandle, or from all maps if iMapHandle is zero, must be refreshed.
+Otherwise the change affects the objects in iIdRangeArray, and drawing within iBounds, which includes
+both the old and new positions of moved or replaced objects.
+*/
+class TMapDataChange
+    {
+    public:
+    /** Creates an empty change for the map with handle aMapHandle. */
+    explicit TMapDataChange(uint32_t aMapHandle = 0): iMapHandle(aMapHandle) { }
+
+    /** Returns a change affecting the whole of the map with handle aMapHandle. */
+    static TMapDataChange WholeMap(uint32_t aMapHandle)
+        {
+        TMapDataChange c(aMapHandle);
+        c.iWholeMap = true;
+        return c;
+        }
+
+    /** Returns true if nothing has changed. */
+    bool IsEmpty() const { return !iWholeMap && iIdRangeArray.empty() && !iHasBounds; }
+
+    /**
+    Records a change to the object with id aId, whose bounds in map coordinates and degrees are aBounds and aBoundsInDegrees.
+    Call this function for both the old and new positions of an object which has moved.
+    */
+    void Add(uint64_t aId,const TRect& aBounds,const TRectFP& aBoundsInDegrees)
+        {
+        AddIdRange(aId,aId);
+        AddBounds(aBounds,aBoundsInDegrees);
+        }
+    /** Records a change to all the objects with ids in the inclusive range aStartId...aEndId. */
+    void AddIdRange(uint64_t aStartId,uint64_t aEndId)
+        {
+        if (aStartId > aEndId)
+            return;
+        // Keep the ranges sorted, merging overlapping and adjacent ranges.
+        auto p = std::lower_bound(iIdRangeArray.begin(),iIdRangeArray.end(),aStartId,
+                                  [](const TMapObjectIdRange& aRange,uint64_t aId) { return aRange.iEndId < aId && aId - aRange.iEndId > 1; });
+        TMapObjectIdRange range { aStartId,aEndId };
+        auto q = p;
+        while (q != iIdRangeArray.end() && (aEndId == UINT64_MAX || q->iStartId <= aEndId + 1))
+            {
+            range.iStartId = std::min(range.iStartId,q->iStartId);
+            range.iEndId = std::max(range.iEndId,q->iEndId);
+            ++q;
+            }
+        p = iIdRangeArray.erase(p,q);
+        iIdRangeArray.insert(p,range);
+        }
+    /** Extends the dirty area to include aBounds, in map coordinates, and aBoundsInDegrees, which must describe the same area. */
+    void AddBounds(const TRect& aBounds,const TRectFP& aBoundsInDegrees)
+        {
+        if (!iHasBounds)
+            {
+            iBounds = aBounds;
+            iBoundsInDegrees = aBoundsInDegrees;
+            iHasBounds = true;
+            return;
+            }
+        iBounds.iTopLeft.iX = std::min(iBounds.iTopLeft.iX,aBounds.iTopLeft.iX);
+        iBounds.iTopLeft.iY = std::min(iBounds.iTopLeft.iY,aBounds.iTopLeft.iY);
+        iBounds.iBottomRight.iX = std::max(iBounds.iBottomRight.iX,aBounds.iBottomRight.iX);
+        iBounds.iBottomRight.iY = std::max(iBounds.iBottomRight.iY,aBounds.iBottomRight.iY);
+        iBoundsInDegrees.iTopLeft.iX = std::min(iBoundsInDegrees.iTopLeft.iX,aBoundsInDegrees.iTopLeft.iX);
+        iBoundsInDegrees.iTopLeft.iY = std::min(iBoundsInDegrees.iTopLeft.iY,aBoundsInDegrees.iTopLeft.iY);
+        iBoundsInDegrees.iBottomRight.iX = std::max(iBoundsInDegrees.iBottomRight.iX,aBoundsInDegrees.iBottomRight.iX);
+        iBoundsInDegrees.iBottomRight.iY = std::max(iBoundsInDegrees.iBottomRight.iY,aBoundsInDegrees.iBottomRight.iY);
+        }
+    /** Combines another change to the same map with this one. */
+    void Merge(const TMapDataChange& aOther)
+        {
+        iWholeMap = iWholeMap || aOther.iWholeMap;
+        for (const auto& r : aOther.iIdRangeArray)
+            AddIdRange(r.iStartId,r.iEndId);
+        if (aOther.iHasBounds)
+            AddBounds(aOther.iBounds,aOther.iBoundsInDegrees);
+        }
+    /** Returns true if the object with id aId is affected by the change. */
+    bool Contains(uint64_t aId) const
+        {
+        if (iWholeMap)
+            return true;
+        auto p = std::lower_bound(iIdRangeArray.begin(),iIdRangeArray.end(),aId,
+                                  [](const TMapObjectIdRange& aRange,uint64_t aValue) { return aRange.iEndId < aValue; });
+        return p != iIdRangeArray.end() && p->iStartId <= aId;
+        }
+
+    /** The handle of the map which has changed, or zero if the change may affect any map. */
+    uint32_t iMapHandle = 0;
+    /** True if the whole map has changed. */
+    bool iWholeMap = false;
+    /** The ranges of ids of the objects inserted, replaced or deleted, in ascending order, without overlaps. */
+    std::vector<TMapObjectIdRange> iIdRangeArray;
+    /** True if iBounds and iBoundsInDegrees are valid. */
+    bool iHasBounds = false;
+    /** The bounds of the changed area in map coordinates. */
+    TRect iBounds;
+    /** The bounds of the changed area in degrees of longitude (x) and latitude (y). */
+    TRectFP iBoundsInDegrees;
+    };
+
+/**
+A rectangular range of web Mercator tiles at a single zoom level, as used by CFramework::TileBitmap,
+with x increasing eastwards and y increasing southwards. Use it to invalidate only the cached tiles
+affected by a TMapDataChange.
+*/
+class TTileRange
+    {
+    public:
+    /** The highest zoom level supported: tile indexes at higher levels do not fit into an int32_t. */
+    static constexpr int32_t KMaxZoom = 30;
+
+    /**
+    Creates the range of tiles at zoom level aZoom covering aBoundsInDegrees, extended by aMarginInPixels
+    on each side to allow for symbols, labels and line widths extending beyond the changed objects.
+    The range is empty if aZoom is less than zero or greater than KMaxZoom.
+    */
+    TTileRange(const TRectFP& aBoundsInDegrees,int32_t aZoom,int32_t aTileSizeInPixels = 256,int32_t aMarginInPixels = 64):
+        iZoom(aZoom)
+        {
+        if (aZoom < 0 || aZoom > KMaxZoom)
+            return;
+        double n = std::ldexp(1.0,aZoom);
+        double margin = aTileSizeInPixels > 0 ? double(aMarginInPixels) / aTileSizeInPixels : 0;
+        int32_t max_index = int32_t(n) - 1;
+        iMinX = Clamp(std::floor(TileX(aBoundsInDegrees.iTopLeft.iX,n) - margin),max_index);
+        iMaxX = Clamp(std::floor(TileX(aBoundsInDegrees.iBottomRight.iX,n) + margin),max_index);
+        iMinY = Clamp(std::floor(TileY(aBoundsInDegrees.iBottomRight.iY,n) - margin),max_index); // north is at the top
+        iMaxY = Clamp(std::floor(TileY(aBoundsInDegrees.iTopLeft.iY,n) + margin),max_index);
+        }
+
+    /** Returns the range of tiles at zoom level aZoom affected by aChange, or an empty range if the change has no bounds. Whole-map changes give all tiles. */
+    static TTileRange ForChange(const TMapDataChange& aChange,int32_t aZoom,int32_t aTileSizeInPixels = 256,int32_t aMarginInPixels = 64)
+        {
+        if (aChange.iWholeMap)
+            return TTileRange(TRectFP(-180,-90,180,90),aZoom,aTileSizeInPixels,0);
+        TTileRange r(aChange.iBoundsInDegrees,aZoom,aTileSizeInPixels,aMarginInPixels);
+        if (!aChange.iHasBounds)
+            r.iMaxX = r.iMinX - 1;
+        return r;
+        }
+
+    /** Returns true if the range contains no tiles. */
+    bool IsEmpty() const { return iMinX > iMaxX || iMinY > iMaxY; }
+    /** Returns the number of tiles in the range. */
+    uint64_t Count() const { return IsEmpty() ? 0 : uint64_t(iMaxX - iMinX + 1) * uint64_t(iMaxY - iMinY + 1); }
+    /** Returns true if the tile (aZoom,aX,aY) is in the range. */
+    bool Contains(int32_t aZoom,int32_t aX,int32_t aY) const
+        {
+        return aZoom == iZoom && aX >= iMinX && aX <= iMaxX && aY >= iMinY && aY <= iMaxY;
+        }
+    /** Calls aFunction for each tile in the range. */
+    void ForEach(const std::function<void(int32_t aZoom,int32_t aX,int32_t aY)>& aFunction) const
+        {
+        for (int32_t y = iMinY; y <= iMaxY; y++)
+            for (int32_t x = iMinX; x <= iMaxX; x++)
+                aFunction(iZoom,x,y);
+        }
+
+    /** The zoom level. */
+    int32_t iZoom = 0;
+    /** The smallest x index. */
+    int32_t iMinX = 0;
+    /** The smallest y index. */
+    int32_t iMinY = 0;
+    /** The largest x index. */
+    int32_t iMaxX = -1;
+    /** The largest y index. */
+    int32_t iMaxY = -1;
+
+    private:
+    static double TileX(double aLongitude,double aN) { return (aLongitude + 180.0) / 360.0 * aN; }
+    static double TileY(double aLatitude,double aN)
+        {
+        double lat = std::max(-85.0511287798,std::min(aLatitude,85.0511287798)) * KDegreesToRadiansDouble;
+        return (1.0 - std::log(std::tan(lat) + 1.0 / std::cos(lat)) / KPiDouble) / 2.0 * aN;
+        }
+    static int32_t Clamp(double aValue,int32_t aMax) { return int32_t(std::max(0.0,std::min(aValue,double(aMax)))); }
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_MAP_DATA_CHANGE_H__
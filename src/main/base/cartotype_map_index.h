@@ -0,0 +1,275 @@
+/*
+cartotype_map_index.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MAP_INDEX_H__
+#define CARTOTYPE_MAP_INDEX_H__
+
+#include <cartotype_string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+An index of the extents and layers of a set of maps, identified by their map handles.
+
+When many maps are loaded, for example hundreds of small city maps, this index can be used
+to find the maps which can contribute to a given area and layer, so that
+the indexes of the other maps need not be consulted at all.
+
+The index is a packed R-tree, rebuilt using the sort-tile-recursive algorithm whenever a map
+is inserted, removed, enabled or disabled. That happens rarely compared with queries, and takes
+a negligible time even for thousands of maps. Each node records the union of the layers present in the maps below it,
+so that queries for a single layer can skip whole subtrees.
+
+Find may be called from several threads at once, but not at the same time as a function which modifies the index.
+*/
+class CMapExtentIndex
+    {
+    public:
+    /**
+    Inserts a map with the handle aHandle, extent aExtent in map coordinates, and layers aLayerNameArray.
+    If a map with the same handle is already in the index it is replaced but keeps its place in the loading order.
+    */
+    void Insert(uint32_t aHandle,const TRect& aExtent,const std::vector<CString>& aLayerNameArray)
+        {
+        TEntry entry;
+        entry.iHandle = aHandle;
+        entry.iExtent = aExtent;
+        for (const auto& name : aLayerNameArray)
+            {
+            auto p = m_layer_index.emplace(std::string(name),uint32_t(m_layer_index.size()));
+            SetBit(entry.iLayers,p.first->second);
+            }
+        auto e = FindEntry(aHandle);
+        if (e != m_entry.end())
+            {
+            entry.iEnabled = e->iEnabled;
+            *e = std::move(entry);
+            }
+        else
+            m_entry.push_back(std::move(entry));
+        Build();
+        }
+    /** Removes the map with the handle aHandle. Returns false if there is no such map. */
+    bool Remove(uint32_t aHandle)
+        {
+        auto e = FindEntry(aHandle);
+        if (e == m_entry.end())
+            return false;
+        m_entry.erase(e);
+        Build();
+        return true;
+        }
+    /** Enables or disables a map. Disabled maps are not returned by Find. Returns false if there is no such map. */
+    bool Enable(uint32_t aHandle,bool aEnable)
+        {
+        auto e = FindEntry(aHandle);
+        if (e == m_entry.end())
+            return false;
+        if (e->iEnabled != aEnable)
+            {
+            e->iEnabled = aEnable;
+            Build();
+            }
+        return true;
+        }
+    /** Removes all maps from the index. */
+    void Clear()
+        {
+        m_entry.clear();
+        m_layer_index.clear();
+        Build();
+        }
+
+    /** Returns the number of maps in the index, including disabled maps. */
+    size_t Count() const { return m_entry.size(); }
+    /** Returns true if the index contains the map with the handle aHandle. */
+    bool Contains(uint32_t aHandle) const
+        {
+        return std::any_of(m_entry.begin(),m_entry.end(),[aHandle](const TEntry& e) { return e.iHandle == aHandle; });
+        }
+    /** Returns the union of the extents of the enabled maps, or an empty rectangle if there are none. */
+    TRect Extent() const { return m_node.empty() ? TRect() : m_node.back().iBounds; }
+
+    /**
+    Gets the handles of the enabled maps whose extents intersect aBounds, in the order in which the maps were loaded.
+    The handles are appended to aHandleArray. Returns the number of handles appended.
+    */
+    size_t Find(std::vector<uint32_t>& aHandleArray,const TRect& aBounds) const
+        {
+        return Find(aHandleArray,aBounds,nullptr);
+        }
+    /**
+    Gets the handles of the enabled maps containing the layer aLayerName whose extents intersect aBounds,
+    in the order in which the maps were loaded. The handles are appended to aHandleArray. Returns the number of handles appended.
+    */
+    size_t Find(std::vector<uint32_t>& aHandleArray,const TRect& aBounds,const CString& aLayerName) const
+        {
+        auto p = m_layer_index.find(std::string(aLayerName));
+        if (p == m_layer_index.end())
+            return 0;
+        return Find(aHandleArray,aBounds,&p->second);
+        }
+
+    /** The maximum number of children of a node. */
+    static constexpr size_t KNodeSize = 16;
+
+    private:
+    class TEntry
+        {
+        public:
+        uint32_t iHandle = 0;
+        TRect iExtent;
+        std::vector<uint64_t> iLayers;
+        bool iEnabled = true;
+        };
+
+    class TNode
+        {
+        public:
+        TRect iBounds;
+        std::vector<uint64_t> iLayers;
+        uint32_t iFirst = 0; // index of the first child in m_child
+        uint32_t iCount = 0;
+        bool iLeaf = false; // if true the children are indexes into m_entry, otherwise into m_node
+        };
+
+    std::vector<TEntry>::iterator FindEntry(uint32_t aHandle)
+        {
+        return std::find_if(m_entry.begin(),m_entry.end(),[aHandle](const TEntry& e) { return e.iHandle == aHandle; });
+        }
+
+    static void SetBit(std::vector<uint64_t>& aBits,uint32_t aIndex)
+        {
+        if (aBits.size() <= aIndex / 64)
+            aBits.resize(aIndex / 64 + 1);
+        aBits[aIndex / 64] |= uint64_t(1) << (aIndex % 64);
+        }
+    static bool TestBit(const std::vector<uint64_t>& aBits,uint32_t aIndex)
+        {
+        return aIndex / 64 < aBits.size() && (aBits[aIndex / 64] & (uint64_t(1) << (aIndex % 64)));
+        }
+    static void Merge(std::vector<uint64_t>& aBits,const std::vector<uint64_t>& aOther)
+        {
+        if (aBits.size() < aOther.size())
+            aBits.resize(aOther.size());
+        for (size_t i = 0; i < aOther.size(); i++)
+            aBits[i] |= aOther[i];
+        }
+    static void Combine(TRect& aRect,const TRect& aOther)
+        {
+        aRect.iTopLeft.iX = std::min(aRect.iTopLeft.iX,aOther.iTopLeft.iX);
+        aRect.iTopLeft.iY = std::min(aRect.iTopLeft.iY,aOther.iTopLeft.iY);
+        aRect.iBottomRight.iX = std::max(aRect.iBottomRight.iX,aOther.iBottomRight.iX);
+        aRect.iBottomRight.iY = std::max(aRect.iBottomRight.iY,aOther.iBottomRight.iY);
+        }
+    // Intersection using closed intervals, so that maps sharing an edge with aBounds are found.
+    static bool Overlaps(const TRect& aA,const TRect& aB)
+        {
+        return aA.iTopLeft.iX <= aB.iBottomRight.iX && aB.iTopLeft.iX <= aA.iBottomRight.iX &&
+               aA.iTopLeft.iY <= aB.iBottomRight.iY && aB.iTopLeft.iY <= aA.iBottomRight.iY;
+        }
+
+    const TRect& ItemBounds(uint32_t aItem,bool aLeafLevel) const { return aLeafLevel ? m_entry[aItem].iExtent : m_node[aItem].iBounds; }
+    const std::vector<uint64_t>& ItemLayers(uint32_t aItem,bool aLeafLevel) const { return aLeafLevel ? m_entry[aItem].iLayers : m_node[aItem].iLayers; }
+
+    // Sorts the items using the sort-tile-recursive order, so that consecutive groups of KNodeSize items are close together.
+    void SortTileRecursive(std::vector<uint32_t>& aItem,bool aLeafLevel) const
+        {
+        auto center_x = [&](uint32_t aIndex) { const TRect& r = ItemBounds(aIndex,aLeafLevel); return int64_t(r.iTopLeft.iX) + r.iBottomRight.iX; };
+        auto center_y = [&](uint32_t aIndex) { const TRect& r = ItemBounds(aIndex,aLeafLevel); return int64_t(r.iTopLeft.iY) + r.iBottomRight.iY; };
+        std::sort(aItem.begin(),aItem.end(),[&](uint32_t a,uint32_t b) { return center_x(a) < center_x(b); });
+        size_t pages = (aItem.size() + KNodeSize - 1) / KNodeSize;
+        size_t slice_size = size_t(std::ceil(std::sqrt(double(pages)))) * KNodeSize;
+        for (size_t i = 0; i < aItem.size(); i += slice_size)
+            {
+            auto end = aItem.begin() + std::min(i + slice_size,aItem.size());
+            std::sort(aItem.begin() + i,end,[&](uint32_t a,uint32_t b) { return center_y(a) < center_y(b); });
+            }
+        }
+
+    void Build()
+        {
+        m_node.clear();
+        m_child.clear();
+        std::vector<uint32_t> level;
+        for (uint32_t i = 0; i < m_entry.size(); i++)
+            if (m_entry[i].iEnabled)
+                level.push_back(i);
+        if (level.empty())
+            return;
+
+        bool leaf_level = true;
+        for (;;)
+            {
+            SortTileRecursive(level,leaf_level);
+            std::vector<uint32_t> parent;
+            for (size_t i = 0; i < level.size(); i += KNodeSize)
+                {
+                TNode node;
+                node.iLeaf = leaf_level;
+                node.iFirst = uint32_t(m_child.size());
+                node.iCount = uint32_t(std::min(KNodeSize,level.size() - i));
+                node.iBounds = ItemBounds(level[i],leaf_level);
+                for (size_t j = i; j < i + node.iCount; j++)
+                    {
+                    m_child.push_back(level[j]);
+                    Combine(node.iBounds,ItemBounds(level[j],leaf_level));
+                    Merge(node.iLayers,ItemLayers(level[j],leaf_level));
+                    }
+                parent.push_back(uint32_t(m_node.size()));
+                m_node.push_back(std::move(node));
+                }
+            if (parent.size() == 1)
+                break;
+            level = std::move(parent);
+            leaf_level = false;
+            }
+        }
+
+    size_t Find(std::vector<uint32_t>& aHandleArray,const TRect& aBounds,const uint32_t* aLayer) const
+        {
+        if (m_node.empty())
+            return 0;
+        std::vector<uint32_t> found;
+        std::vector<uint32_t> stack { uint32_t(m_node.size() - 1) };
+        while (!stack.empty())
+            {
+            const TNode& node = m_node[stack.back()];
+            stack.pop_back();
+            if (!Overlaps(node.iBounds,aBounds) || (aLayer && !TestBit(node.iLayers,*aLayer)))
+                continue;
+            for (uint32_t i = node.iFirst; i < node.iFirst + node.iCount; i++)
+                {
+                uint32_t child = m_child[i];
+                if (!node.iLeaf)
+                    stack.push_back(child);
+                else if (Overlaps(m_entry[child].iExtent,aBounds) && (!aLayer || TestBit(m_entry[child].iLayers,*aLayer)))
+                    found.push_back(child);
+                }
+            }
+
+        // Entries are kept in loading order, which is the order in which maps are drawn.
+        std::sort(found.begin(),found.end());
+        for (auto i : found)
+            aHandleArray.push_back(m_entry[i].iHandle);
+        return found.size();
+        }
+
+    std::vector<TEntry> m_entry;
+    std::map<std::string,uint32_t> m_layer_index;
+    std::vector<TNode> m_node; // the root, if any, is the last node
+    std::vector<uint32_t> m_child;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_MAP_INDEX_H__
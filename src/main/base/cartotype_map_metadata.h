@@ -86,6 +86,20 @@ enum class TPointFormat
     Meter32nds = 8
     };
 
+/**
+The compression applied to the blocks of a CTM1 table.
+These numbers must fit into 8 bits because of the way they are stored in the CTM1 file.
+*/
+enum class TBlockCompression
+    {
+    /** The table is not compressed. */
+    None = 0,
+    /** Each block is compressed using the LZ4 block format. */
+    LZ4 = 1,
+    /** Each block is compressed using zstd with a dictionary trained on the table's data and stored with it. */
+    Zstd = 2
+    };
+
 /** A data version. */
 class TDataVersion
     {
@@ -130,6 +144,14 @@ class CMapMetaData
     bool iDrivingSideKnown = false;
     /** True if the driving side is known and the rule is to drive on the left. */
     bool iDriveOnLeft = false;
+    /**
+    The compression used for the layer tables (KLayerTable and KLowResolutionLayerTable).
+    If it is not TBlockCompression::None the tables are stored as described in cartotype_compression.h,
+    and blocks are decompressed into the block cache when they are first read.
+    */
+    TBlockCompression iLayerBlockCompression = TBlockCompression::None;
+    /** The uncompressed size in bytes of each block of a compressed layer table; zero if the layer tables are not compressed. */
+    uint32_t iCompressedBlockSize = 0;
     };
 
 }
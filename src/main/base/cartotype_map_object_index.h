@@ -0,0 +1,295 @@
+/*
+cartotype_map_object_index.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MAP_OBJECT_INDEX_H__
+#define CARTOTYPE_MAP_OBJECT_INDEX_H__
+
+#include <cartotype_string.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoType
+{
+
+/** Parameters specifying which secondary indexes are maintained for the objects in a writable map. */
+class TMapObjectIndexParam
+    {
+    public:
+    /** If true, objects are indexed by layer. */
+    bool iIndexLayer = true;
+    /** If true, objects are indexed by their integer attribute. */
+    bool iIndexIntAttribute = true;
+    /** The names of string attributes by which objects are indexed. Use an empty name for the label. */
+    std::vector<std::string> iStringAttributeArray;
+    };
+
+/**
+A query selecting map objects using secondary indexes. Objects must satisfy all the criteria given.
+A query with no criteria selects all objects in the id range.
+*/
+class TMapObjectIndexQuery
+    {
+    public:
+    /** The lowest id of objects to be selected. */
+    uint64_t iStartId = 0;
+    /** The highest id of objects to be selected. */
+    uint64_t iEndId = UINT64_MAX;
+    /** If not empty, only objects in this layer are selected. */
+    std::string iLayerName;
+    /** If true, only objects with an integer attribute in the inclusive range iMinIntAttribute...iMaxIntAttribute are selected. */
+    bool iMatchIntAttribute = false;
+    /** The lowest integer attribute selected if iMatchIntAttribute is true. */
+    uint32_t iMinIntAttribute = 0;
+    /** The highest integer attribute selected if iMatchIntAttribute is true. */
+    uint32_t iMaxIntAttribute = UINT32_MAX;
+    /** Pairs of string attribute names and values; only objects with all these values are selected. Use an empty name for the label. */
+    std::vector<std::pair<std::string,std::string>> iStringAttributeArray;
+    };
+
+/**
+Secondary indexes for the objects in a writable map, by layer, integer attribute and selected string attributes.
+
+The owner of a writable map keeps one of these up to date by calling Insert and Remove when objects are inserted,
+replaced or deleted. Deletions and searches using a TMapObjectIndexQuery then
+start from the smallest matching set of objects instead of testing every object in the id range.
+
+String attributes are given in the usual form: the label, if any, followed by key=value pairs, all separated by | characters;
+for example "Main Street|ref=A1|type=primary".
+*/
+class CMapObjectAttributeIndex
+    {
+    public:
+    /** Creates an index maintaining the indexes specified by aParam. */
+    explicit CMapObjectAttributeIndex(const TMapObjectIndexParam& aParam = TMapObjectIndexParam()):
+        m_param(aParam),
+        m_string_index(aParam.iStringAttributeArray.size())
+        {
+        }
+
+    /** Returns the parameters specifying which indexes are maintained. */
+    const TMapObjectIndexParam& Param() const { return m_param; }
+    /** Returns the number of objects in the index. */
+    size_t Count() const { return m_all.size(); }
+
+    /** Adds an object to the index, replacing any existing entry with the same id. */
+    void Insert(uint64_t aId,const CString& aLayerName,uint32_t aIntAttribute,const CString& aStringAttributes)
+        {
+        Remove(aId);
+        TKeys keys;
+        keys.iLayerName = aLayerName;
+        keys.iIntAttribute = aIntAttribute;
+        keys.iStringValue.resize(m_param.iStringAttributeArray.size());
+        keys.iHasStringValue.resize(m_param.iStringAttributeArray.size());
+        ParseStringAttributes(keys,aStringAttributes);
+
+        m_all.insert(aId);
+        if (m_param.iIndexLayer)
+            m_layer_index[keys.iLayerName].insert(aId);
+        if (m_param.iIndexIntAttribute)
+            m_int_index[keys.iIntAttribute].insert(aId);
+        for (size_t i = 0; i < keys.iStringValue.size(); i++)
+            if (keys.iHasStringValue[i])
+                m_string_index[i][keys.iStringValue[i]].insert(aId);
+        m_keys.emplace(aId,std::move(keys));
+        }
+    /** Removes an object from the index. Returns false if the object was not in the index. */
+    bool Remove(uint64_t aId)
+        {
+        auto p = m_keys.find(aId);
+        if (p == m_keys.end())
+            return false;
+        const TKeys& keys = p->second;
+        m_all.erase(aId);
+        if (m_param.iIndexLayer)
+            Erase(m_layer_index,keys.iLayerName,aId);
+        if (m_param.iIndexIntAttribute)
+            Erase(m_int_index,keys.iIntAttribute,aId);
+        for (size_t i = 0; i < keys.iStringValue.size(); i++)
+            if (keys.iHasStringValue[i])
+                Erase(m_string_index[i],keys.iStringValue[i],aId);
+        m_keys.erase(p);
+        return true;
+        }
+    /** Removes all objects from the index. */
+    void Clear()
+        {
+        m_all.clear();
+        m_keys.clear();
+        m_layer_index.clear();
+        m_int_index.clear();
+        for (auto& p : m_string_index)
+            p.clear();
+        }
+
+    /**
+    Returns true if every criterion in aQuery uses an index maintained by this object, so that Find gives the exact answer.
+    If not, the caller must fall back to testing the objects in the id range.
+    */
+    bool CanAnswer(const TMapObjectIndexQuery& aQuery) const
+        {
+        if (!aQuery.iLayerName.empty() && !m_param.iIndexLayer)
+            return false;
+        if (aQuery.iMatchIntAttribute && !m_param.iIndexIntAttribute)
+            return false;
+        for (const auto& p : aQuery.iStringAttributeArray)
+            if (StringAttributeIndex(p.first) < 0)
+                return false;
+        return true;
+        }
+
+    /**
+    Appends the ids of the objects selected by aQuery to aIdArray, in ascending order, and returns the number of ids appended.
+    Criteria which are not indexed are ignored; use CanAnswer to check that all the criteria are indexed.
+    */
+    size_t Find(std::vector<uint64_t>& aIdArray,const TMapObjectIndexQuery& aQuery) const
+        {
+        if (aQuery.iStartId > aQuery.iEndId)
+            return 0;
+
+        // Start from the smallest candidate set: a single layer or string value, or the whole map.
+        const std::set<uint64_t>* candidate = &m_all;
+        if (!aQuery.iLayerName.empty() && m_param.iIndexLayer)
+            {
+            auto p = m_layer_index.find(aQuery.iLayerName);
+            if (p == m_layer_index.end())
+                return 0;
+            candidate = &p->second;
+            }
+        for (const auto& attrib : aQuery.iStringAttributeArray)
+            {
+            int index = StringAttributeIndex(attrib.first);
+            if (index < 0)
+                continue;
+            auto p = m_string_index[index].find(attrib.second);
+            if (p == m_string_index[index].end())
+                return 0;
+            if (p->second.size() < candidate->size())
+                candidate = &p->second;
+            }
+
+        size_t old_size = aIdArray.size();
+        bool use_int_index = false;
+        if (aQuery.iMatchIntAttribute && m_param.iIndexIntAttribute)
+            {
+            auto begin = m_int_index.lower_bound(aQuery.iMinIntAttribute);
+            auto end = m_int_index.upper_bound(aQuery.iMaxIntAttribute);
+            size_t n = 0;
+            for (auto p = begin; p != end && n < candidate->size(); ++p)
+                n += p->second.size();
+            if (n < candidate->size())
+                {
+                use_int_index = true;
+                for (auto p = begin; p != end; ++p)
+                    AppendMatches(aIdArray,p->second,aQuery);
+                std::sort(aIdArray.begin() + old_size,aIdArray.end());
+                }
+            }
+        if (!use_int_index)
+            AppendMatches(aIdArray,*candidate,aQuery);
+        return aIdArray.size() - old_size;
+        }
+
+    private:
+    class TKeys
+        {
+        public:
+        std::string iLayerName;
+        uint32_t iIntAttribute = 0;
+        std::vector<std::string> iStringValue;
+        std::vector<bool> iHasStringValue;
+        };
+
+    template<class TIndex,class TKey> static void Erase(TIndex& aIndex,const TKey& aKey,uint64_t aId)
+        {
+        auto p = aIndex.find(aKey);
+        if (p != aIndex.end())
+            {
+            p->second.erase(aId);
+            if (p->second.empty())
+                aIndex.erase(p);
+            }
+        }
+
+    int StringAttributeIndex(const std::string& aName) const
+        {
+        const auto& a = m_param.iStringAttributeArray;
+        auto p = std::find(a.begin(),a.end(),aName);
+        return p == a.end() ? -1 : int(p - a.begin());
+        }
+
+    void ParseStringAttributes(TKeys& aKeys,const CString& aStringAttributes) const
+        {
+        std::string text = aStringAttributes;
+        size_t start = 0;
+        bool first = true;
+        for (;;)
+            {
+            size_t end = text.find('|',start);
+            std::string item = text.substr(start,end == std::string::npos ? std::string::npos : end - start);
+            size_t eq = item.find('=');
+            std::string name, value;
+            if (eq != std::string::npos)
+                {
+                name = item.substr(0,eq);
+                value = item.substr(eq + 1);
+                }
+            else if (first)
+                value = item; // the label
+            if ((eq != std::string::npos || first) && (!name.empty() || !value.empty()))
+                {
+                int index = StringAttributeIndex(name);
+                if (index >= 0)
+                    {
+                    aKeys.iStringValue[index] = value;
+                    aKeys.iHasStringValue[index] = true;
+                    }
+                }
+            first = false;
+            if (end == std::string::npos)
+                break;
+            start = end + 1;
+            }
+        }
+
+    bool Matches(uint64_t aId,const TMapObjectIndexQuery& aQuery) const
+        {
+        const TKeys& keys = m_keys.find(aId)->second;
+        if (!aQuery.iLayerName.empty() && m_param.iIndexLayer && keys.iLayerName != aQuery.iLayerName)
+            return false;
+        if (aQuery.iMatchIntAttribute && m_param.iIndexIntAttribute &&
+            (keys.iIntAttribute < aQuery.iMinIntAttribute || keys.iIntAttribute > aQuery.iMaxIntAttribute))
+            return false;
+        for (const auto& attrib : aQuery.iStringAttributeArray)
+            {
+            int index = StringAttributeIndex(attrib.first);
+            if (index >= 0 && (!keys.iHasStringValue[index] || keys.iStringValue[index] != attrib.second))
+                return false;
+            }
+        return true;
+        }
+
+    void AppendMatches(std::vector<uint64_t>& aIdArray,const std::set<uint64_t>& aSet,const TMapObjectIndexQuery& aQuery) const
+        {
+        for (auto p = aSet.lower_bound(aQuery.iStartId); p != aSet.end() && *p <= aQuery.iEndId; ++p)
+            if (Matches(*p,aQuery))
+                aIdArray.push_back(*p);
+        }
+
+    TMapObjectIndexParam m_param;
+    std::set<uint64_t> m_all;
+    std::unordered_map<uint64_t,TKeys> m_keys;
+    std::unordered_map<std::string,std::set<uint64_t>> m_layer_index;
+    std::map<uint32_t,std::set<uint64_t>> m_int_index;
+    std::vector<std::unordered_map<std::string,std::set<uint64_t>>> m_string_index;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_MAP_OBJECT_INDEX_H__
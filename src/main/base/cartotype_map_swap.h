@@ -0,0 +1,253 @@
+/*
+cartotype_map_swap.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MAP_SWAP_H__
+#define CARTOTYPE_MAP_SWAP_H__
+
+#include <cartotype_framework.h>
+
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A map swapper replaces the map data used by a set of frameworks without stopping drawing.
+
+The new maps are opened and warmed up in a separate CFrameworkMapDataSet, which may be done on a background
+thread using SwapAsync, while frameworks continue to draw using the current data set. The new data set is
+then published atomically, and each CSwappableFramework picks it up at the start of its next operation.
+
+Old data sets are reclaimed by reference counting: every framework holds a reference to the data set it
+was created with, so a render in progress on the old data completes safely, and the old data set is
+destroyed when the last framework using it moves on to the new data. Each data set is a
+generation, numbered from 1; RetiredGenerationCount returns the number of old generations still in use.
+
+All the functions of a map swapper may be called from any thread.
+*/
+class CMapSwapper
+    {
+    public:
+    /** Parameters for creating a map swapper. */
+    class TParam
+        {
+        public:
+        /** The shared engine used by all data sets. Must not be null. */
+        std::shared_ptr<CFrameworkEngine> iEngine;
+        /** The map files making up the first data set. There must be at least one. */
+        std::vector<CString> iMapFileNameArray;
+        /** The style sheet used when warming up new data sets. */
+        CString iStyleSheetFileName;
+        /** If not empty, an encryption key used when loading maps. */
+        std::string iEncryptionKey;
+        /** If true, maps are allowed to overlap; see CFramework::TParam::iMapsOverlap. */
+        bool iMapsOverlap = true;
+        /** If true, new data sets are warmed up, by drawing a map using them, before they are published. */
+        bool iWarmUp = true;
+        };
+
+    /** A function called on the background thread when SwapAsync has finished. */
+    using SwapCallBack = std::function<void(TResult aError,uint64_t aGeneration)>;
+
+    /** Creates a map swapper and loads the first data set. */
+    static std::unique_ptr<CMapSwapper> New(TResult& aError,const TParam& aParam)
+        {
+        std::unique_ptr<CMapSwapper> swapper(new CMapSwapper(aParam));
+        aError = swapper->Swap(aParam.iMapFileNameArray);
+        if (aError)
+            swapper.reset();
+        return swapper;
+        }
+    ~CMapSwapper()
+        {
+        if (m_swap_thread.joinable())
+            m_swap_thread.join();
+        }
+
+    /** Returns the shared engine. */
+    std::shared_ptr<CFrameworkEngine> Engine() const { return m_param.iEngine; }
+    /** Returns the current data set. */
+    std::shared_ptr<CFrameworkMapDataSet> MapDataSet() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_data_set;
+        }
+    /** Returns the current data set and its generation number. */
+    std::shared_ptr<CFrameworkMapDataSet> MapDataSet(uint64_t& aGeneration) const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        aGeneration = m_generation;
+        return m_data_set;
+        }
+    /** Returns the generation number of the current data set. */
+    uint64_t Generation() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_generation;
+        }
+    /** Returns the number of data sets which have been replaced but are still used by a framework. */
+    size_t RetiredGenerationCount() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t n = 0;
+        for (const auto& p : m_retired)
+            if (!p.expired())
+                n++;
+        return n;
+        }
+
+    /**
+    Opens the maps aMapFileNameArray in a new data set, warms it up if required,
+    and publishes it. Frameworks continue to draw using the current data set until this function has finished.
+    The new files may have the same names as the old ones: the block cache identifies files by their identity
+    as well as their names (see CBlockCache::FileId), so the new data set never uses blocks cached from the old files.
+    */
+    TResult Swap(const std::vector<CString>& aMapFileNameArray)
+        {
+        TResult error;
+        auto data_set = Open(error,aMapFileNameArray);
+        if (!error)
+            Publish(std::move(data_set));
+        return error;
+        }
+    /**
+    Starts a swap on a background thread and returns immediately. aCallBack, if not null,
+    is called on the background thread when the swap has finished or failed.
+    Returns KErrorDuplicate if a swap is already in progress.
+    */
+    TResult SwapAsync(const std::vector<CString>& aMapFileNameArray,SwapCallBack aCallBack = nullptr)
+        {
+        std::lock_guard<std::mutex> lock(m_swap_mutex);
+        if (m_swap_in_progress)
+            return KErrorDuplicate;
+        if (m_swap_thread.joinable())
+            m_swap_thread.join();
+        m_swap_in_progress = true;
+        m_swap_thread = std::thread([this,aMapFileNameArray,aCallBack]
+            {
+            TResult error = Swap(aMapFileNameArray);
+            uint64_t generation = Generation();
+                {
+                std::lock_guard<std::mutex> lock(m_swap_mutex);
+                m_swap_in_progress = false;
+                }
+            if (aCallBack)
+                aCallBack(error,generation);
+            });
+        return KErrorNone;
+        }
+
+    CMapSwapper(const CMapSwapper&) = delete;
+    CMapSwapper& operator=(const CMapSwapper&) = delete;
+
+    private:
+    explicit CMapSwapper(const TParam& aParam): m_param(aParam) { }
+
+    std::shared_ptr<CFrameworkMapDataSet> Open(TResult& aError,const std::vector<CString>& aMapFileNameArray)
+        {
+        if (!m_param.iEngine || aMapFileNameArray.empty())
+            {
+            aError = KErrorInvalidArgument;
+            return nullptr;
+            }
+        const std::string* key = m_param.iEncryptionKey.empty() ? nullptr : &m_param.iEncryptionKey;
+        std::shared_ptr<CFrameworkMapDataSet> data_set = CFrameworkMapDataSet::New(aError,m_param.iEngine,aMapFileNameArray[0],key,m_param.iMapsOverlap);
+        for (size_t i = 1; !aError && i < aMapFileNameArray.size(); i++)
+            aError = data_set->LoadMapData(aMapFileNameArray[i],key,m_param.iMapsOverlap);
+        if (!aError && m_param.iWarmUp)
+            {
+            auto framework = CFramework::New(aError,m_param.iEngine,data_set,m_param.iStyleSheetFileName,256,256,key);
+            if (!aError)
+                framework->MapBitmap(aError);
+            }
+        if (aError)
+            data_set.reset();
+        return data_set;
+        }
+
+    void Publish(std::shared_ptr<CFrameworkMapDataSet> aDataSet)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_data_set)
+            m_retired.push_back(m_data_set);
+        m_retired.erase(std::remove_if(m_retired.begin(),m_retired.end(),[](const std::weak_ptr<CFrameworkMapDataSet>& p) { return p.expired(); }),m_retired.end());
+        m_data_set = std::move(aDataSet);
+        m_generation++;
+        }
+
+    TParam m_param;
+    mutable std::mutex m_mutex;
+    std::shared_ptr<CFrameworkMapDataSet> m_data_set;
+    uint64_t m_generation = 0;
+    std::vector<std::weak_ptr<CFrameworkMapDataSet>> m_retired;
+    std::mutex m_swap_mutex;
+    std::thread m_swap_thread;
+    bool m_swap_in_progress = false;
+    };
+
+/**
+A framework which follows the data set published by a map swapper. Each thread drawing
+maps, such as each worker thread of a tile server, should own one of these objects.
+
+Call Framework at the start of each operation: if a new data set has been published,
+a new framework is created using it, and aSetUp is called to restore the view, style sheet and other settings.
+The old framework, and with it the reference to the old data set, is then released.
+*/
+class CSwappableFramework
+    {
+    public:
+    /** A function to set up a newly created framework. */
+    using SetUpFunction = std::function<TResult(CFramework& aFramework)>;
+
+    /** Creates a swappable framework using aSwapper, with the given style sheet and view size, and an optional set-up function. */
+    CSwappableFramework(std::shared_ptr<CMapSwapper> aSwapper,const CString& aStyleSheetFileName,int32_t aViewWidth,int32_t aViewHeight,SetUpFunction aSetUp = nullptr):
+        m_swapper(aSwapper),
+        m_style_sheet_file_name(aStyleSheetFileName),
+        m_view_width(aViewWidth),
+        m_view_height(aViewHeight),
+        m_set_up(aSetUp)
+        {
+        }
+
+    /**
+    Returns the framework using the current data set, creating it if necessary. If a new framework cannot be created,
+    aError is set and the previous framework, which may be null, is returned, so that drawing can continue with the old data.
+    */
+    CFramework* Framework(TResult& aError)
+        {
+        aError = KErrorNone;
+        uint64_t generation = 0;
+        auto data_set = m_swapper->MapDataSet(generation);
+        if (m_framework && generation == m_generation)
+            return m_framework.get();
+        auto framework = CFramework::New(aError,m_swapper->Engine(),data_set,m_style_sheet_file_name,m_view_width,m_view_height);
+        if (!aError && m_set_up)
+            aError = m_set_up(*framework);
+        if (aError)
+            return m_framework.get();
+        m_framework = std::move(framework);
+        m_generation = generation;
+        return m_framework.get();
+        }
+    /** Returns the generation of the data set used by the current framework, or zero if none has been created. */
+    uint64_t Generation() const { return m_framework ? m_generation : 0; }
+
+    private:
+    std::shared_ptr<CMapSwapper> m_swapper;
+    CString m_style_sheet_file_name;
+    int32_t m_view_width;
+    int32_t m_view_height;
+    SetUpFunction m_set_up;
+    std::unique_ptr<CFramework> m_framework;
+    uint64_t m_generation = 0;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_MAP_SWAP_H__
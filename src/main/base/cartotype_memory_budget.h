@@ -0,0 +1,275 @@
+/*
+cartotype_memory_budget.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MEMORY_BUDGET_H__
+#define CARTOTYPE_MEMORY_BUDGET_H__
+
+#include <cartotype_types.h>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+The interface for a cache whose memory is controlled by a CMemoryBudget:
+for example file buffers, the image cache, the glyph cache or the route caches.
+*/
+class MMemoryBudgetClient
+    {
+    public:
+    virtual ~MMemoryBudgetClient() { }
+    /** Returns a short name for the cache, used in reports. */
+    virtual const char* MemoryBudgetName() const = 0;
+    /** Returns the number of bytes used by the cache. */
+    virtual size_t MemoryUsed() const = 0;
+    /**
+    Releases memory until no more than aTargetBytes are used, or as near to that as possible,
+    and returns the number of bytes now used. This function must not call the memory budget.
+    */
+    virtual size_t TrimMemory(size_t aTargetBytes) = 0;
+    /**
+    Returns the value of keeping a byte of the cache's data: the estimated cost of
+    recreating it multiplied by the likelihood that it will be used again, for example
+    the time to reload a file buffer multiplied by the buffer hit rate.
+    Only the relative values matter: when memory must be reclaimed, caches with lower
+    values are trimmed first.
+    */
+    virtual double ValuePerByte() const = 0;
+    };
+
+/** The memory used by a cache controlled by a memory budget. */
+class TMemoryBudgetUsage
+    {
+    public:
+    /** The name of the cache. */
+    std::string iName;
+    /** The number of bytes used. */
+    size_t iUsedBytes = 0;
+    /** The number of bytes that the cache may always keep. */
+    size_t iMinimumBytes = 0;
+    /** The number of bytes granted by CMemoryBudget::Request but not yet allocated. */
+    size_t iReservedBytes = 0;
+    /** The value of keeping a byte of the cache's data, as returned by MMemoryBudgetClient::ValuePerByte. */
+    double iValuePerByte = 0;
+    };
+
+/**
+A memory budget shared by a set of caches, such as CBlockCache, which implement MMemoryBudgetClient.
+Caches register with the budget and request space before they grow. When the total would exceed
+the budget, memory is reclaimed from the caches holding the least valuable data, as
+reported by MMemoryBudgetClient::ValuePerByte, down to each cache's minimum.
+
+The total is predictable because all caches draw from the same budget. ReleaseMemory
+should be called from the platform's low-memory notification to trim every cache to its minimum.
+
+A memory budget may be used by any number of threads at once.
+*/
+class CMemoryBudget
+    {
+    public:
+    /** Creates a memory budget allowing aLimitBytes to be used by all caches together. */
+    explicit CMemoryBudget(size_t aLimitBytes): m_limit(aLimitBytes) { }
+
+    /** A function called after memory has been released because of a low-memory notification; its argument is the number of bytes released. */
+    using LowMemoryCallBack = std::function<void(size_t aReleasedBytes)>;
+
+    /**
+    Registers a cache with the budget. aMinimumBytes is the amount of memory the cache
+    may always keep, even when memory is short. The cache must be unregistered before it is destroyed.
+    */
+    void Register(MMemoryBudgetClient& aClient,size_t aMinimumBytes = 0)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& c : m_client_array)
+            if (c.iClient == &aClient)
+                {
+                c.iMinimumBytes = aMinimumBytes;
+                return;
+                }
+        m_client_array.push_back(TClient { &aClient,aMinimumBytes,0 });
+        }
+    /** Unregisters a cache. */
+    void Unregister(MMemoryBudgetClient& aClient)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_client_array.erase(std::remove_if(m_client_array.begin(),m_client_array.end(),[&aClient](const TClient& c) { return c.iClient == &aClient; }),m_client_array.end());
+        }
+
+    /**
+    Requests space for aClient to allocate aBytes more memory, reclaiming memory from other caches
+    if necessary. Returns true if the memory may be allocated. If it returns false the cache should
+    evict some of its own data, or not cache the new item, instead: aClient itself is never trimmed by its own request.
+
+    If the request succeeds the bytes are reserved for aClient, so that concurrent requests cannot together exceed the limit.
+    The client must call EndRequest when it has allocated the memory, or decided not to, to release the reservation.
+    If aClient is not registered the request is always granted and nothing is reserved.
+    The caller must not hold any lock that its own TrimMemory function takes, because other requests may trim it.
+    */
+    bool Request(const MMemoryBudgetClient& aClient,size_t aBytes)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        TClient* client = FindLocked(aClient);
+        if (!client)
+            return true;
+        size_t used = UsedLocked();
+        if (used + aBytes > m_limit)
+            {
+            size_t excess = used + aBytes - m_limit;
+            if (ReclaimLocked(excess,&aClient) < excess)
+                return false;
+            }
+        client->iReservedBytes += aBytes;
+        return true;
+        }
+    /**
+    Ends a successful request for aBytes made by aClient, releasing the reservation. Call it after the memory has been allocated,
+    so that it is counted by aClient's MemoryUsed function instead, or when the allocation has been abandoned.
+    */
+    void EndRequest(const MMemoryBudgetClient& aClient,size_t aBytes)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        TClient* client = FindLocked(aClient);
+        if (client)
+            client->iReservedBytes -= std::min(client->iReservedBytes,aBytes);
+        }
+
+    /** Sets the limit, trimming the caches if they use more than the new limit. */
+    void SetLimit(size_t aLimitBytes)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_limit = aLimitBytes;
+        size_t used = UsedLocked();
+        if (used > m_limit)
+            ReclaimLocked(used - m_limit,nullptr);
+        }
+    /** Returns the limit in bytes. */
+    size_t Limit() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_limit;
+        }
+    /** Returns the number of bytes used by all the registered caches, including the bytes reserved for them by Request. */
+    size_t Used() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return UsedLocked();
+        }
+    /** Returns the memory used by each registered cache. */
+    std::vector<TMemoryBudgetUsage> Usage() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<TMemoryBudgetUsage> usage;
+        for (const auto& c : m_client_array)
+            usage.push_back(TMemoryBudgetUsage { c.iClient->MemoryBudgetName(),c.iClient->MemoryUsed(),c.iMinimumBytes,c.iReservedBytes,c.iClient->ValuePerByte() });
+        return usage;
+        }
+
+    /** Sets a function to be called after ReleaseMemory has trimmed the caches. */
+    void SetLowMemoryCallBack(LowMemoryCallBack aCallBack)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_low_memory_callback = aCallBack;
+        }
+    /**
+    Trims every cache to its minimum size and returns the number of bytes released.
+    Call this function when the platform reports that memory is low.
+    */
+    size_t ReleaseMemory()
+        {
+        LowMemoryCallBack callback;
+        size_t released = 0;
+            {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& c : m_client_array)
+                {
+                size_t used = c.iClient->MemoryUsed();
+                if (used > c.iMinimumBytes)
+                    {
+                    size_t now_used = c.iClient->TrimMemory(c.iMinimumBytes);
+                    if (now_used < used)
+                        released += used - now_used;
+                    }
+                }
+            callback = m_low_memory_callback;
+            }
+        if (callback)
+            callback(released);
+        return released;
+        }
+
+    CMemoryBudget(const CMemoryBudget&) = delete;
+    CMemoryBudget& operator=(const CMemoryBudget&) = delete;
+
+    private:
+    class TClient
+        {
+        public:
+        MMemoryBudgetClient* iClient;
+        size_t iMinimumBytes;
+        size_t iReservedBytes;
+        };
+
+    TClient* FindLocked(const MMemoryBudgetClient& aClient)
+        {
+        for (auto& c : m_client_array)
+            if (c.iClient == &aClient)
+                return &c;
+        return nullptr;
+        }
+    size_t UsedLocked() const
+        {
+        size_t used = 0;
+        for (const auto& c : m_client_array)
+            used += c.iClient->MemoryUsed() + c.iReservedBytes;
+        return used;
+        }
+
+    /*
+    Reclaims at least aBytes if possible, taking memory from the caches with the least valuable data first.
+    The requesting cache, if any, is not trimmed: it may be holding its own lock while it makes the request.
+    Returns the number of bytes reclaimed.
+    */
+    size_t ReclaimLocked(size_t aBytes,const MMemoryBudgetClient* aRequester)
+        {
+        std::vector<TClient*> order;
+        for (auto& c : m_client_array)
+            if (c.iClient != aRequester)
+                order.push_back(&c);
+        std::stable_sort(order.begin(),order.end(),[](const TClient* a,const TClient* b)
+            {
+            return a->iClient->ValuePerByte() < b->iClient->ValuePerByte();
+            });
+
+        size_t reclaimed = 0;
+        for (auto c : order)
+            {
+            if (reclaimed >= aBytes)
+                break;
+            size_t used = c->iClient->MemoryUsed();
+            if (used <= c->iMinimumBytes)
+                continue;
+            size_t target = std::max(c->iMinimumBytes,used - std::min(used,aBytes - reclaimed));
+            size_t now_used = c->iClient->TrimMemory(target);
+            if (now_used < used)
+                reclaimed += used - now_used;
+            }
+        return reclaimed;
+        }
+
+    mutable std::mutex m_mutex;
+    size_t m_limit;
+    std::vector<TClient> m_client_array;
+    LowMemoryCallBack m_low_memory_callback;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_MEMORY_BUDGET_H__
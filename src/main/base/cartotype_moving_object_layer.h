@@ -0,0 +1,312 @@
+/*
+cartotype_moving_object_layer.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_MOVING_OBJECT_LAYER_H__
+#define CARTOTYPE_MOVING_OBJECT_LAYER_H__
+
+#include <cartotype_string.h>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoType
+{
+
+/** A moving object, such as a vehicle, as returned by CMovingObjectLayer. */
+class TMovingObject
+    {
+    public:
+    /** The id, which is unique within the layer. */
+    uint64_t iId = 0;
+    /** The position in map coordinates. */
+    TPoint iPosition;
+    /** The heading in degrees clockwise from north. */
+    float iHeading = 0;
+    /** The icon index, selecting one of the icons defined for the layer in the style sheet. */
+    uint32_t iIconIndex = 0;
+    };
+
+/**
+A layer of moving objects, such as vehicles, designed for frequent position updates.
+
+Objects are not stored as map objects in a writable map, so updating them involves no attribute
+encoding or re-indexing. Positions, headings and icons are stored in separate arrays (a struct of arrays),
+so that a batch of position updates touches only the arrays it changes, and are indexed by a uniform grid
+of square cells, so an update moves an object between cells only when it crosses a cell boundary.
+
+The layer name is the name of the style sheet layer intended to define the icons. An application draws
+the objects by calling ForEach or Find for the area being drawn, and uses TakeDirtyBounds to find the area to redraw.
+
+All functions may be called from any thread; updates and drawing are serialized by an internal lock,
+which is held only for the duration of each call.
+*/
+class CMovingObjectLayer
+    {
+    public:
+    /**
+    Creates a moving object layer drawn using the style sheet layer aLayerName.
+    aCellSize is the size of the grid cells in map units; it should be about the size of the area typically drawn in a tile.
+    */
+    explicit CMovingObjectLayer(const CString& aLayerName,int32_t aCellSize = 8192 * 32):
+        m_layer_name(aLayerName),
+        m_cell_size(std::max(aCellSize,1))
+        {
+        }
+
+    /** Returns the name of the style sheet layer used to draw the objects. */
+    const CString& LayerName() const { return m_layer_name; }
+    /** Returns the number of objects. */
+    size_t Count() const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_id.size();
+        }
+
+    /** Inserts an object, or replaces it if an object with the same id exists. */
+    void Insert(const TMovingObject& aObject)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto p = m_index.find(aObject.iId);
+        if (p != m_index.end())
+            {
+            m_icon_index[p->second] = aObject.iIconIndex;
+            Move(p->second,aObject.iPosition,aObject.iHeading);
+            return;
+            }
+        uint32_t index = uint32_t(m_id.size());
+        m_id.push_back(aObject.iId);
+        m_x.push_back(aObject.iPosition.iX);
+        m_y.push_back(aObject.iPosition.iY);
+        m_heading.push_back(aObject.iHeading);
+        m_icon_index.push_back(aObject.iIconIndex);
+        m_cell.push_back(CellKey(aObject.iPosition));
+        m_cell_slot.push_back(0);
+        m_index.emplace(aObject.iId,index);
+        AddToCell(index);
+        Dirty(aObject.iPosition);
+        }
+    /** Removes the object with the id aId. Returns false if there is no such object. */
+    bool Remove(uint64_t aId)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto p = m_index.find(aId);
+        if (p == m_index.end())
+            return false;
+        uint32_t index = p->second;
+        m_index.erase(p);
+        Dirty(TPoint(m_x[index],m_y[index]));
+        RemoveFromCell(index);
+
+        // Move the last object into the vacated place.
+        uint32_t last = uint32_t(m_id.size() - 1);
+        if (index != last)
+            {
+            m_id[index] = m_id[last];
+            m_x[index] = m_x[last];
+            m_y[index] = m_y[last];
+            m_heading[index] = m_heading[last];
+            m_icon_index[index] = m_icon_index[last];
+            m_cell[index] = m_cell[last];
+            m_cell_slot[index] = m_cell_slot[last];
+            m_grid[m_cell[index]][m_cell_slot[index]] = index;
+            m_index[m_id[index]] = index;
+            }
+        m_id.pop_back();
+        m_x.pop_back();
+        m_y.pop_back();
+        m_heading.pop_back();
+        m_icon_index.pop_back();
+        m_cell.pop_back();
+        m_cell_slot.pop_back();
+        return true;
+        }
+    /** Removes all objects. */
+    void Clear()
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < m_id.size(); i++)
+            Dirty(TPoint(m_x[i],m_y[i]));
+        m_id.clear();
+        m_x.clear();
+        m_y.clear();
+        m_heading.clear();
+        m_icon_index.clear();
+        m_cell.clear();
+        m_cell_slot.clear();
+        m_index.clear();
+        m_grid.clear();
+        }
+
+    /**
+    Updates the positions and headings of aCount objects. aIdArray, aPositionArray and aHeadingArray each contain aCount elements;
+    aHeadingArray may be null, in which case headings are unchanged. Objects which do not exist are ignored.
+    Returns the number of objects updated.
+    */
+    size_t UpdatePositions(const uint64_t* aIdArray,const TPoint* aPositionArray,const float* aHeadingArray,size_t aCount)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t updated = 0;
+        for (size_t i = 0; i < aCount; i++)
+            {
+            auto p = m_index.find(aIdArray[i]);
+            if (p == m_index.end())
+                continue;
+            Move(p->second,aPositionArray[i],aHeadingArray ? aHeadingArray[i] : m_heading[p->second]);
+            updated++;
+            }
+        return updated;
+        }
+    /** Gets an object by its id. Returns false if there is no such object. */
+    bool Get(uint64_t aId,TMovingObject& aObject) const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto p = m_index.find(aId);
+        if (p == m_index.end())
+            return false;
+        aObject = Object(p->second);
+        return true;
+        }
+
+    /**
+    Calls aFunction for each object inside or on the edge of aBounds, which is in map coordinates.
+    Only the grid cells overlapping aBounds are examined. aFunction must not call other functions of this layer.
+    */
+    void ForEach(const TRect& aBounds,const std::function<void(const TMovingObject& aObject)>& aFunction) const
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int32_t x0 = CellCoord(aBounds.iTopLeft.iX), x1 = CellCoord(aBounds.iBottomRight.iX);
+        int32_t y0 = CellCoord(aBounds.iTopLeft.iY), y1 = CellCoord(aBounds.iBottomRight.iY);
+        if (uint64_t(int64_t(x1) - x0 + 1) * uint64_t(int64_t(y1) - y0 + 1) > m_grid.size())
+            {
+            // The area covers more cells than are occupied, so it is faster to test the occupied cells.
+            for (const auto& cell : m_grid)
+                for (uint32_t index : cell.second)
+                    Visit(index,aBounds,aFunction);
+            return;
+            }
+        for (int32_t y = y0; y <= y1; y++)
+            for (int32_t x = x0; x <= x1; x++)
+                {
+                auto p = m_grid.find(CellKey(x,y));
+                if (p != m_grid.end())
+                    for (uint32_t index : p->second)
+                        Visit(index,aBounds,aFunction);
+                }
+        }
+    /** Appends the objects inside or on the edge of aBounds to aObjectArray and returns the number of objects appended. */
+    size_t Find(std::vector<TMovingObject>& aObjectArray,const TRect& aBounds) const
+        {
+        size_t old_size = aObjectArray.size();
+        ForEach(aBounds,[&aObjectArray](const TMovingObject& aObject) { aObjectArray.push_back(aObject); });
+        return aObjectArray.size() - old_size;
+        }
+
+    /**
+    Gets the bounds, in map coordinates, of the old and new positions of all objects inserted, moved or removed since the last call,
+    and resets them. Returns false if nothing has changed. Icon sizes are not included, so callers should add a margin.
+    */
+    bool TakeDirtyBounds(TRect& aBounds)
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_has_dirty_bounds)
+            return false;
+        aBounds = m_dirty_bounds;
+        m_has_dirty_bounds = false;
+        return true;
+        }
+
+    private:
+    static constexpr uint64_t CellKey(int32_t aX,int32_t aY) { return (uint64_t(uint32_t(aX)) << 32) | uint32_t(aY); }
+    int32_t CellCoord(int32_t aValue) const { return aValue >= 0 ? aValue / m_cell_size : -1 - (-1 - aValue) / m_cell_size; }
+    uint64_t CellKey(const TPoint& aPoint) const { return CellKey(CellCoord(aPoint.iX),CellCoord(aPoint.iY)); }
+
+    TMovingObject Object(uint32_t aIndex) const
+        {
+        TMovingObject object;
+        object.iId = m_id[aIndex];
+        object.iPosition = TPoint(m_x[aIndex],m_y[aIndex]);
+        object.iHeading = m_heading[aIndex];
+        object.iIconIndex = m_icon_index[aIndex];
+        return object;
+        }
+    void Visit(uint32_t aIndex,const TRect& aBounds,const std::function<void(const TMovingObject& aObject)>& aFunction) const
+        {
+        int32_t x = m_x[aIndex], y = m_y[aIndex];
+        if (x >= aBounds.iTopLeft.iX && x <= aBounds.iBottomRight.iX && y >= aBounds.iTopLeft.iY && y <= aBounds.iBottomRight.iY)
+            aFunction(Object(aIndex));
+        }
+
+    void AddToCell(uint32_t aIndex)
+        {
+        auto& cell = m_grid[m_cell[aIndex]];
+        m_cell_slot[aIndex] = uint32_t(cell.size());
+        cell.push_back(aIndex);
+        }
+    void RemoveFromCell(uint32_t aIndex)
+        {
+        auto p = m_grid.find(m_cell[aIndex]);
+        auto& cell = p->second;
+        uint32_t slot = m_cell_slot[aIndex];
+        cell[slot] = cell.back();
+        m_cell_slot[cell[slot]] = slot;
+        cell.pop_back();
+        if (cell.empty())
+            m_grid.erase(p);
+        }
+    void Move(uint32_t aIndex,const TPoint& aPosition,float aHeading)
+        {
+        Dirty(TPoint(m_x[aIndex],m_y[aIndex]));
+        Dirty(aPosition);
+        m_x[aIndex] = aPosition.iX;
+        m_y[aIndex] = aPosition.iY;
+        m_heading[aIndex] = aHeading;
+        uint64_t cell = CellKey(aPosition);
+        if (cell != m_cell[aIndex])
+            {
+            RemoveFromCell(aIndex);
+            m_cell[aIndex] = cell;
+            AddToCell(aIndex);
+            }
+        }
+    void Dirty(const TPoint& aPoint)
+        {
+        if (!m_has_dirty_bounds)
+            {
+            m_dirty_bounds = TRect(aPoint.iX,aPoint.iY,aPoint.iX,aPoint.iY);
+            m_has_dirty_bounds = true;
+            return;
+            }
+        m_dirty_bounds.iTopLeft.iX = std::min(m_dirty_bounds.iTopLeft.iX,aPoint.iX);
+        m_dirty_bounds.iTopLeft.iY = std::min(m_dirty_bounds.iTopLeft.iY,aPoint.iY);
+        m_dirty_bounds.iBottomRight.iX = std::max(m_dirty_bounds.iBottomRight.iX,aPoint.iX);
+        m_dirty_bounds.iBottomRight.iY = std::max(m_dirty_bounds.iBottomRight.iY,aPoint.iY);
+        }
+
+    CString m_layer_name;
+    int32_t m_cell_size;
+    mutable std::mutex m_mutex;
+
+    // The objects, stored as a struct of arrays.
+    std::vector<uint64_t> m_id;
+    std::vector<int32_t> m_x;
+    std::vector<int32_t> m_y;
+    std::vector<float> m_heading;
+    std::vector<uint32_t> m_icon_index;
+    std::vector<uint64_t> m_cell; // the key of the grid cell containing each object
+    std::vector<uint32_t> m_cell_slot; // the position of each object in its grid cell
+
+    std::unordered_map<uint64_t,uint32_t> m_index; // from ids to positions in the arrays
+    std::unordered_map<uint64_t,std::vector<uint32_t>> m_grid; // from cell keys to positions in the arrays
+    TRect m_dirty_bounds;
+    bool m_has_dirty_bounds = false;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_MOVING_OBJECT_LAYER_H__
@@ -0,0 +1,267 @@
+/*
+cartotype_point_cluster.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_POINT_CLUSTER_H__
+#define CARTOTYPE_POINT_CLUSTER_H__
+
+#include <cartotype_base.h>
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace CartoType
+{
+
+/** Parameters controlling the clustering of a point layer. */
+class TPointClusterParam
+    {
+    public:
+    /** The approximate radius of a cluster on the display, in pixels. */
+    int32_t iClusterRadiusInPixels = 40;
+    /** The smallest number of points drawn as a cluster; smaller groups are drawn as individual points. */
+    uint32_t iMinClusterCount = 2;
+    /** The size, in map units, of the grid cells at the finest clustering level. */
+    int32_t iFinestCellSize = 32 * 256;
+    /** The number of clustering levels; the cell size doubles at each level. */
+    int32_t iLevelCount = 20;
+    };
+
+/** A cluster of points, or a single point, returned by CPointClusterIndex. */
+class TPointCluster
+    {
+    public:
+    /** The centroid of the points in map coordinates. */
+    TPoint iCenter;
+    /** The number of points. */
+    uint32_t iCount = 0;
+    /** The id of the point if iCount is 1, otherwise zero. */
+    uint64_t iId = 0;
+    /** The bounds of the grid cell containing the cluster, or the single point, at the level searched, in map coordinates. */
+    TRect iCell;
+    };
+
+/**
+A hierarchical clustering index for a point layer, allowing dense layers of pushpins or points of interest
+to be drawn and searched as clusters with counts at small scales and as individual points at large scales.
+
+The index consists of a series of grids, one for each level, with the cell size doubling from level to level.
+Each cell records the number of points in it and the sum of their coordinates, so that inserting or deleting a point
+updates one cell per level, and clusters never need to be recomputed from scratch.
+*/
+class CPointClusterIndex
+    {
+    public:
+    /** Creates an empty index using the parameters aParam. */
+    explicit CPointClusterIndex(const TPointClusterParam& aParam = TPointClusterParam()):
+        m_param(aParam)
+        {
+        m_param.iFinestCellSize = std::max(m_param.iFinestCellSize,1);
+        m_param.iLevelCount = std::min(std::max(m_param.iLevelCount,1),31 - int32_t(std::log2(double(m_param.iFinestCellSize))));
+        m_level.resize(m_param.iLevelCount);
+        }
+
+    /** Returns the parameters. */
+    const TPointClusterParam& Param() const { return m_param; }
+    /** Returns the number of levels. */
+    int32_t LevelCount() const { return m_param.iLevelCount; }
+    /** Returns the number of points. */
+    size_t Count() const { return m_point.size(); }
+    /** Returns the size, in map units, of the cells at level aLevel. */
+    int32_t CellSize(int32_t aLevel) const { return m_param.iFinestCellSize << aLevel; }
+
+    /** Inserts a point, or moves it if a point with the same id is already in the index. */
+    void Insert(uint64_t aId,const TPoint& aPoint)
+        {
+        auto p = m_point.find(aId);
+        if (p != m_point.end())
+            {
+            Update(aId,p->second,-1);
+            p->second = aPoint;
+            }
+        else
+            m_point.emplace(aId,aPoint);
+        Update(aId,aPoint,1);
+        }
+    /** Removes a point. Returns false if there is no such point. */
+    bool Remove(uint64_t aId)
+        {
+        auto p = m_point.find(aId);
+        if (p == m_point.end())
+            return false;
+        Update(aId,p->second,-1);
+        m_point.erase(p);
+        return true;
+        }
+    /** Removes all points. */
+    void Clear()
+        {
+        m_point.clear();
+        for (auto& level : m_level)
+            level.clear();
+        m_finest_cell_points.clear();
+        }
+
+    /**
+    Returns the level to be used when drawing at aMapUnitsPerPixel map units per pixel: the finest level
+    with cells at least as large as the cluster radius. Returns -1 if the scale is so large that points should not be clustered.
+    */
+    int32_t Level(double aMapUnitsPerPixel) const
+        {
+        double radius = m_param.iClusterRadiusInPixels * aMapUnitsPerPixel;
+        if (radius < m_param.iFinestCellSize)
+            return -1;
+        int32_t level = int32_t(std::ceil(std::log2(radius / m_param.iFinestCellSize)));
+        return std::min(level,m_param.iLevelCount - 1);
+        }
+
+    /**
+    Appends the clusters at level aLevel whose centroids are inside or on the edge of aBounds to aClusterArray, and returns the number appended.
+    Groups of fewer than TPointClusterParam::iMinClusterCount points are returned as individual points.
+    If aLevel is negative, all points in aBounds are returned individually.
+    */
+    size_t Find(std::vector<TPointCluster>& aClusterArray,const TRect& aBounds,int32_t aLevel) const
+        {
+        size_t old_size = aClusterArray.size();
+        bool individual = aLevel < 0;
+        aLevel = std::min(std::max(aLevel,0),m_param.iLevelCount - 1);
+        const auto& grid = m_level[aLevel];
+        int32_t cell_size = CellSize(aLevel);
+        int64_t x0 = CellCoord(aBounds.iTopLeft.iX,cell_size), x1 = CellCoord(aBounds.iBottomRight.iX,cell_size);
+        int64_t y0 = CellCoord(aBounds.iTopLeft.iY,cell_size), y1 = CellCoord(aBounds.iBottomRight.iY,cell_size);
+        auto add = [&](uint64_t aKey,const TCell& aCell)
+            {
+            int32_t cx = int32_t(aKey >> 32), cy = int32_t(uint32_t(aKey));
+            if (individual || (aCell.iCount > 1 && aCell.iCount < m_param.iMinClusterCount))
+                {
+                AddPointsInCell(aClusterArray,aBounds,CellBounds(cx,cy,cell_size),aLevel,cx,cy);
+                return;
+                }
+            TPointCluster c;
+            c.iCount = aCell.iCount;
+            c.iCenter = TPoint(int32_t(std::lround(aCell.iSumX / double(aCell.iCount))),int32_t(std::lround(aCell.iSumY / double(aCell.iCount))));
+            if (!Contains(aBounds,c.iCenter))
+                return;
+            c.iCell = CellBounds(cx,cy,cell_size);
+            if (aCell.iCount == 1)
+                c.iId = aCell.iIdXor;
+            aClusterArray.push_back(c);
+            };
+        if (uint64_t(x1 - x0 + 1) * uint64_t(y1 - y0 + 1) > grid.size())
+            {
+            for (const auto& p : grid)
+                add(p.first,p.second);
+            }
+        else
+            {
+            for (int64_t y = y0; y <= y1; y++)
+                for (int64_t x = x0; x <= x1; x++)
+                    {
+                    uint64_t key = CellKey(x,y);
+                    auto p = grid.find(key);
+                    if (p != grid.end())
+                        add(key,p->second);
+                    }
+            }
+        return aClusterArray.size() - old_size;
+        }
+
+    private:
+    class TCell
+        {
+        public:
+        uint32_t iCount = 0;
+        int64_t iSumX = 0;
+        int64_t iSumY = 0;
+        uint64_t iIdXor = 0; // the XOR of the ids of the points: equal to the id of the only point when iCount is 1
+        };
+
+    static int64_t CellCoord(int32_t aValue,int32_t aCellSize) { return aValue >= 0 ? aValue / aCellSize : -1 - (-1 - int64_t(aValue)) / aCellSize; }
+    static uint64_t CellKey(int64_t aX,int64_t aY) { return (uint64_t(uint32_t(aX)) << 32) | uint32_t(aY); }
+    static bool Contains(const TRect& aBounds,const TPoint& aPoint)
+        {
+        return aPoint.iX >= aBounds.iTopLeft.iX && aPoint.iX <= aBounds.iBottomRight.iX &&
+               aPoint.iY >= aBounds.iTopLeft.iY && aPoint.iY <= aBounds.iBottomRight.iY;
+        }
+    // Returns the bounds of a grid cell, limited to the range of map coordinates.
+    static TRect CellBounds(int64_t aX,int64_t aY,int32_t aCellSize)
+        {
+        auto coord = [](int64_t aValue) { return int32_t(std::min(std::max(aValue,int64_t(INT32_MIN)),int64_t(INT32_MAX))); };
+        return TRect(coord(aX * aCellSize),coord(aY * aCellSize),coord((aX + 1) * aCellSize),coord((aY + 1) * aCellSize));
+        }
+    static TPointCluster SinglePoint(uint64_t aId,const TPoint& aPoint,const TRect& aCell)
+        {
+        TPointCluster c;
+        c.iCenter = aPoint;
+        c.iCount = 1;
+        c.iId = aId;
+        c.iCell = aCell;
+        return c;
+        }
+
+    /*
+    Adds the individual points in a cell too small to be a cluster, by descending through the occupied cells below it to the finest level.
+    aCell is the bounds of the cell at the level searched, which is given to each point.
+    */
+    void AddPointsInCell(std::vector<TPointCluster>& aClusterArray,const TRect& aBounds,const TRect& aCell,int32_t aLevel,int64_t aX,int64_t aY) const
+        {
+        if (aLevel == 0)
+            {
+            auto p = m_finest_cell_points.find(CellKey(aX,aY));
+            if (p != m_finest_cell_points.end())
+                for (uint64_t id : p->second)
+                    {
+                    const TPoint& point = m_point.find(id)->second;
+                    if (Contains(aBounds,point))
+                        aClusterArray.push_back(SinglePoint(id,point,aCell));
+                    }
+            return;
+            }
+        for (int64_t y = aY * 2; y <= aY * 2 + 1; y++)
+            for (int64_t x = aX * 2; x <= aX * 2 + 1; x++)
+                if (m_level[aLevel - 1].count(CellKey(x,y)))
+                    AddPointsInCell(aClusterArray,aBounds,aCell,aLevel - 1,x,y);
+        }
+
+    void Update(uint64_t aId,const TPoint& aPoint,int aDelta)
+        {
+        for (int32_t level = 0; level < m_param.iLevelCount; level++)
+            {
+            int32_t cell_size = CellSize(level);
+            auto& grid = m_level[level];
+            uint64_t key = CellKey(CellCoord(aPoint.iX,cell_size),CellCoord(aPoint.iY,cell_size));
+            TCell& cell = grid[key];
+            cell.iCount += aDelta;
+            cell.iSumX += aDelta * int64_t(aPoint.iX);
+            cell.iSumY += aDelta * int64_t(aPoint.iY);
+            cell.iIdXor ^= aId;
+            if (cell.iCount == 0)
+                grid.erase(key);
+            if (level == 0)
+                {
+                auto& ids = m_finest_cell_points[key];
+                if (aDelta > 0)
+                    ids.push_back(aId);
+                else
+                    {
+                    ids.erase(std::find(ids.begin(),ids.end(),aId));
+                    if (ids.empty())
+                        m_finest_cell_points.erase(key);
+                    }
+                }
+            }
+        }
+
+    TPointClusterParam m_param;
+    std::unordered_map<uint64_t,TPoint> m_point;
+    std::vector<std::unordered_map<uint64_t,TCell>> m_level;
+    std::unordered_map<uint64_t,std::vector<uint64_t>> m_finest_cell_points;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_POINT_CLUSTER_H__
@@ -0,0 +1,381 @@
+/*
+cartotype_readahead.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_READAHEAD_H__
+#define CARTOTYPE_READAHEAD_H__
+
+#include <cartotype_stream.h>
+#include <cartotype_block_cache.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A pool of threads performing background reads for one or more CReadAheadFileInputStream objects.
+A single pool is normally shared by all the streams reading map files in a process.
+*/
+class CReadAheadThreadPool
+    {
+    public:
+    /** Creates a pool with aThreadCount threads; if aThreadCount is zero, the default number is used. */
+    explicit CReadAheadThreadPool(size_t aThreadCount = 0)
+        {
+        if (aThreadCount == 0)
+            aThreadCount = KDefaultThreadCount;
+        for (size_t i = 0; i < aThreadCount; i++)
+            m_thread_array.emplace_back([this] { Run(); });
+        }
+    /** Destroys the pool after finishing the tasks already queued. */
+    ~CReadAheadThreadPool()
+        {
+            {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            }
+        m_condition.notify_all();
+        for (auto& t : m_thread_array)
+            t.join();
+        }
+
+    /**
+    The default number of threads. Reads are mostly waiting for the storage device,
+    so there can usefully be more threads than processor cores, up to the queue depth the device can handle.
+    */
+    static constexpr size_t KDefaultThreadCount = 8;
+
+    /** Queues a task to be run on one of the threads. */
+    void Post(std::function<void()> aTask)
+        {
+            {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task_queue.push_back(std::move(aTask));
+            }
+        m_condition.notify_one();
+        }
+    /** Returns the number of threads. */
+    size_t ThreadCount() const { return m_thread_array.size(); }
+
+    CReadAheadThreadPool(const CReadAheadThreadPool&) = delete;
+    CReadAheadThreadPool& operator=(const CReadAheadThreadPool&) = delete;
+
+    private:
+    void Run()
+        {
+        for (;;)
+            {
+            std::function<void()> task;
+                {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock,[this] { return m_stop || !m_task_queue.empty(); });
+                if (m_task_queue.empty())
+                    return;
+                task = std::move(m_task_queue.front());
+                m_task_queue.pop_front();
+                }
+            task();
+            }
+        }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_task_queue;
+    std::vector<std::thread> m_thread_array;
+    bool m_stop = false;
+    };
+
+/** Statistics for a CReadAheadFileInputStream. */
+class TReadAheadStatistics
+    {
+    public:
+    /** The number of blocks requested by Prefetch or by sequential read-ahead. */
+    uint64_t iPrefetchCount = 0;
+    /** The number of buffer reads satisfied by a block that had already been prefetched. */
+    uint64_t iHitCount = 0;
+    /** The number of buffer reads that waited for a prefetch which was still in progress. */
+    uint64_t iWaitCount = 0;
+    /** The number of buffer reads that were not prefetched and were read synchronously. */
+    uint64_t iMissCount = 0;
+    /** The number of prefetched blocks discarded without being used. */
+    uint64_t iDiscardCount = 0;
+    };
+
+/**
+A file input stream that reads blocks in the background before they are needed.
+
+Callers may call Prefetch with the positions of all the blocks found by a
+spatial index lookup before decoding any of them, so that the reads are issued
+together and can be serviced in parallel by the storage device, instead of as a
+series of blocking random reads. When the stream detects that blocks are being
+read in order it also reads the following blocks ahead of time.
+
+Background reads use a shared thread pool; each thread uses its own file handle, so reads never
+interfere with the stream's own file position.
+
+If a block cache is set using SetBlockCache, the stream reads through the cache as described for
+CCachedFileInputStream, so that copies of the stream used by different threads share blocks, and prefetched
+blocks are added to the cache when they are used. The stream then has no buffers of its own and aMaxBuffers is not used.
+*/
+class CReadAheadFileInputStream: public CCachedFileInputStream
+    {
+    public:
+    /** Creates a CReadAheadFileInputStream to read from the file aFileName using aThreadPool. Returns the result in aError. */
+    static std::unique_ptr<CReadAheadFileInputStream> New(TResult& aError,const std::string& aFileName,std::shared_ptr<CReadAheadThreadPool> aThreadPool,
+                                                          size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers)
+        {
+        aError = KErrorNone;
+        try
+            {
+            return std::make_unique<CReadAheadFileInputStream>(aFileName,aThreadPool,aBufferSize,aMaxBuffers);
+            }
+        catch (TResult error)
+            {
+            aError = error;
+            }
+        catch (std::bad_alloc&)
+            {
+            aError = KErrorNoMemory;
+            }
+        return nullptr;
+        }
+    /** Creates a CReadAheadFileInputStream to read from the file aFileName using aThreadPool. Throws an exception if the file cannot be opened. */
+    CReadAheadFileInputStream(const std::string& aFileName,std::shared_ptr<CReadAheadThreadPool> aThreadPool,
+                              size_t aBufferSize = KDefaultBufferSize,size_t aMaxBuffers = KDefaultMaxBuffers):
+        CCachedFileInputStream(aFileName,nullptr,aBufferSize,aMaxBuffers),
+        m_thread_pool(aThreadPool),
+        m_state(std::make_shared<TState>(aFileName,aBufferSize,std::max(aMaxBuffers,size_t(KDefaultMaxPrefetchedBlocks))))
+        {
+        if (!m_thread_pool)
+            throw KErrorInvalidArgument;
+        }
+    ~CReadAheadFileInputStream()
+        {
+        // Reads in progress keep the shared state alive; their results are discarded.
+        std::lock_guard<std::mutex> lock(m_state->iMutex);
+        m_state->iCancelled = true;
+        }
+
+    /** The default maximum number of prefetched blocks held in memory before they are used. */
+    static constexpr size_t KDefaultMaxPrefetchedBlocks = 64;
+    /** The default number of blocks read ahead when the stream is read sequentially. */
+    static constexpr size_t KDefaultReadAheadBlocks = 4;
+
+    std::unique_ptr<CFileInputStream> Copy() override
+        {
+        auto copy = std::make_unique<CReadAheadFileInputStream>(iName,m_thread_pool,iBufferSize,MaxBuffers());
+        copy->SetBlockCache(BlockCache());
+        copy->SetReadAheadBlocks(m_read_ahead_blocks);
+        return copy;
+        }
+
+    /**
+    Starts reading, in the background, the blocks containing the byte positions in aPositionArray.
+    Blocks already read or being read are not read again. Blocks are read in file order.
+    */
+    void Prefetch(const std::vector<int64_t>& aPositionArray)
+        {
+        std::vector<int64_t> block;
+        for (auto p : aPositionArray)
+            if (p >= 0 && p < iLength)
+                block.push_back(p - p % int64_t(iBufferSize));
+        std::sort(block.begin(),block.end());
+        block.erase(std::unique(block.begin(),block.end()),block.end());
+        PrefetchBlocks(block);
+        }
+    /** Starts reading, in the background, the blocks containing the byte range from aStart to aEnd (exclusive). */
+    void PrefetchRange(int64_t aStart,int64_t aEnd)
+        {
+        std::vector<int64_t> block;
+        aStart = std::max(aStart,int64_t(0));
+        aEnd = std::min(aEnd,iLength);
+        for (int64_t p = aStart - aStart % int64_t(iBufferSize); p < aEnd; p += iBufferSize)
+            block.push_back(p);
+        PrefetchBlocks(block);
+        }
+    /** Sets the number of blocks read ahead when the stream is read sequentially; zero disables sequential read-ahead. */
+    void SetReadAheadBlocks(size_t aBlocks) { m_read_ahead_blocks = aBlocks; }
+    /** Returns the number of blocks read ahead when the stream is read sequentially. */
+    size_t ReadAheadBlocks() const { return m_read_ahead_blocks; }
+    /** Returns statistics about the use of prefetched blocks. */
+    TReadAheadStatistics Statistics() const
+        {
+        std::lock_guard<std::mutex> lock(m_state->iMutex);
+        return m_state->iStatistics;
+        }
+
+    protected:
+    // Used when there is no block cache.
+    void ReadBuffer(CBuffer& aBuffer,int64_t aPos) override
+        {
+        StartBlock(aPos);
+        std::vector<uint8_t> data;
+        if (TakeBlock(data,aPos))
+            CopyToBuffer(aBuffer,aPos,data);
+        else
+            CFileInputStream::ReadBuffer(aBuffer,aPos);
+        }
+    void ReadBlock(std::vector<uint8_t>& aData,int64_t aPos) override
+        {
+        if (!TakeBlock(aData,aPos))
+            CCachedFileInputStream::ReadBlock(aData,aPos);
+        }
+    void StartBlock(int64_t aPos) override
+        {
+        bool sequential = m_last_block >= 0 && aPos == m_last_block + int64_t(iBufferSize);
+        m_last_block = aPos;
+        if (sequential && m_read_ahead_blocks)
+            PrefetchRange(aPos + iBufferSize,aPos + iBufferSize * (m_read_ahead_blocks + 1));
+        }
+
+    private:
+    class TState
+        {
+        public:
+        TState(const std::string& aFileName,size_t aBufferSize,size_t aMaxBlocks):
+            iFileName(aFileName),
+            iBufferSize(aBufferSize),
+            iMaxBlocks(aMaxBlocks)
+            {
+            }
+
+        std::mutex iMutex;
+        std::condition_variable iCondition;
+        std::string iFileName;
+        size_t iBufferSize;
+        size_t iMaxBlocks;
+        bool iCancelled = false;
+        /** Blocks that have been read, by position. */
+        std::map<int64_t,std::vector<uint8_t>> iReady;
+        /** Positions of blocks being read. */
+        std::set<int64_t> iPending;
+        /** File handles not in use by a background read. */
+        std::vector<std::unique_ptr<CBinaryInputFile>> iFreeFile;
+        TReadAheadStatistics iStatistics;
+        };
+
+    void PrefetchBlocks(const std::vector<int64_t>& aBlockArray)
+        {
+        std::vector<int64_t> to_read;
+        std::shared_ptr<CBlockCache> block_cache = BlockCache();
+            {
+            std::lock_guard<std::mutex> lock(m_state->iMutex);
+            for (auto p : aBlockArray)
+                {
+                if (m_state->iReady.size() + m_state->iPending.size() >= m_state->iMaxBlocks)
+                    break;
+                if (block_cache && block_cache->Contains(FileId(),uint64_t(p) / iBufferSize))
+                    continue;
+                if (!m_state->iReady.count(p) && m_state->iPending.insert(p).second)
+                    to_read.push_back(p);
+                }
+            m_state->iStatistics.iPrefetchCount += to_read.size();
+            }
+        for (auto p : to_read)
+            {
+            std::shared_ptr<TState> state = m_state;
+            m_thread_pool->Post([state,p] { ReadInBackground(*state,p); });
+            }
+        }
+
+    static void ReadInBackground(TState& aState,int64_t aPos)
+        {
+        std::unique_ptr<CBinaryInputFile> file;
+            {
+            std::lock_guard<std::mutex> lock(aState.iMutex);
+            if (!aState.iFreeFile.empty())
+                {
+                file = std::move(aState.iFreeFile.back());
+                aState.iFreeFile.pop_back();
+                }
+            }
+
+        std::vector<uint8_t> data;
+        bool cancelled = false;
+            {
+            std::lock_guard<std::mutex> lock(aState.iMutex);
+            cancelled = aState.iCancelled;
+            }
+        if (!cancelled)
+            {
+            if (!file)
+                {
+                file = std::make_unique<CBinaryInputFile>();
+                if (file->Open(aState.iFileName.c_str()))
+                    file.reset();
+                }
+            if (file && !file->Seek(aPos,SEEK_SET))
+                {
+                data.resize(aState.iBufferSize);
+                data.resize(file->Read(data.data(),data.size()));
+                }
+            }
+
+            {
+            std::lock_guard<std::mutex> lock(aState.iMutex);
+            aState.iPending.erase(aPos);
+            if (!aState.iCancelled && !data.empty())
+                aState.iReady[aPos] = std::move(data);
+            if (file)
+                aState.iFreeFile.push_back(std::move(file));
+            }
+        aState.iCondition.notify_all();
+        }
+
+    // Moves a prefetched block into aData, waiting for it if it is being read. Returns false if the block was not prefetched.
+    bool TakeBlock(std::vector<uint8_t>& aData,int64_t aPos)
+        {
+        std::unique_lock<std::mutex> lock(m_state->iMutex);
+        if (m_state->iPending.count(aPos))
+            {
+            m_state->iStatistics.iWaitCount++;
+            m_state->iCondition.wait(lock,[this,aPos] { return !m_state->iPending.count(aPos); });
+            }
+        auto p = m_state->iReady.find(aPos);
+        if (p == m_state->iReady.end())
+            {
+            m_state->iStatistics.iMissCount++;
+            return false;
+            }
+        m_state->iStatistics.iHitCount++;
+        aData = std::move(p->second);
+        m_state->iReady.erase(p);
+
+        // Blocks before the one just used and well behind the current position are unlikely to be used.
+        while (m_state->iReady.size() > m_state->iMaxBlocks / 2 && m_state->iReady.begin()->first < aPos)
+            {
+            m_state->iReady.erase(m_state->iReady.begin());
+            m_state->iStatistics.iDiscardCount++;
+            }
+        return true;
+        }
+
+    void CopyToBuffer(CBuffer& aBuffer,int64_t aPos,const std::vector<uint8_t>& aData)
+        {
+        if (!aBuffer.iData)
+            aBuffer.iData = new uint8_t[iBufferSize];
+        aBuffer.iSize = std::min(aData.size(),iBufferSize);
+        memcpy(aBuffer.iData,aData.data(),aBuffer.iSize);
+        aBuffer.iPosition = aPos;
+        }
+
+    std::shared_ptr<CReadAheadThreadPool> m_thread_pool;
+    std::shared_ptr<TState> m_state;
+    size_t m_read_ahead_blocks = KDefaultReadAheadBlocks;
+    int64_t m_last_block = -1;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_READAHEAD_H__
@@ -0,0 +1,170 @@
+/*
+cartotype_statistics.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_STATISTICS_H__
+#define CARTOTYPE_STATISTICS_H__
+
+#include <cartotype_types.h>
+
+#include <array>
+#include <chrono>
+
+namespace CartoType
+{
+
+/**
+Stages of the map rendering pipeline, used when collecting rendering statistics.
+The stages form a hierarchy: see ParentRenderStage.
+*/
+enum class TRenderStage
+    {
+    /** The whole of a frame or tile. */
+    Total,
+    /** Querying the map databases for the objects in the view. */
+    DataQuery,
+    /** Decoding map objects; part of DataQuery. */
+    Decode,
+    /** Clipping map objects to the view or to overlapping maps. */
+    Clip,
+    /** Evaluating style sheet conditions and expressions. */
+    StyleEvaluation,
+    /** Simplifying geometry for drawing at small scales. */
+    Simplification,
+    /** Rasterizing the strokes of lines and polygon borders. */
+    StrokeRasterization,
+    /** Rasterizing polygon fills. */
+    FillRasterization,
+    /** Placing labels and checking for overlaps. */
+    LabelPlacement,
+    /** Shaping the text of labels; part of LabelPlacement. */
+    TextShaping,
+    /** Encoding tiles as PNG images. */
+    PngEncoding,
+
+    /** Not a stage but the number of stages. */
+    Count
+    };
+
+/** Returns the stage of which aStage is a part. Returns TRenderStage::Total for the top-level stages, including Total itself. */
+constexpr TRenderStage ParentRenderStage(TRenderStage aStage) noexcept
+    {
+    return aStage == TRenderStage::Decode ? TRenderStage::DataQuery :
+           aStage == TRenderStage::TextShaping ? TRenderStage::LabelPlacement :
+           TRenderStage::Total;
+    }
+
+/** The name of a rendering stage, for use in reports and traces. */
+inline const char* RenderStageName(TRenderStage aStage) noexcept
+    {
+    static const char* const name[size_t(TRenderStage::Count)] =
+        { "Total", "DataQuery", "Decode", "Clip", "StyleEvaluation", "Simplification",
+          "StrokeRasterization", "FillRasterization", "LabelPlacement", "TextShaping", "PngEncoding" };
+    return aStage < TRenderStage::Count ? name[size_t(aStage)] : "";
+    }
+
+/** The time spent in a rendering stage and the number of times it was entered. */
+class TRenderStageStatistics
+    {
+    public:
+    /** Adds another set of statistics to this one. */
+    void operator+=(const TRenderStageStatistics& aOther) noexcept
+        {
+        iTimeInSeconds += aOther.iTimeInSeconds;
+        iCount += aOther.iCount;
+        }
+
+    /** The total time in seconds, including the time spent in any stages that are part of this one. */
+    double iTimeInSeconds = 0;
+    /** The number of times the stage was entered. */
+    uint64_t iCount = 0;
+    };
+
+/**
+Rendering statistics: the time spent in each stage of the rendering pipeline,
+and counts of the objects and labels drawn. The statistics for a single frame or tile
+are gathered using TRenderStageTimer objects, and can be accumulated over many frames and tiles using operator+=.
+*/
+class TRenderStatistics
+    {
+    public:
+    /** Returns the statistics for a stage. */
+    const TRenderStageStatistics& Stage(TRenderStage aStage) const noexcept { return iStage[size_t(aStage)]; }
+    /** Returns the statistics for a stage as a writable reference. */
+    TRenderStageStatistics& Stage(TRenderStage aStage) noexcept { return iStage[size_t(aStage)]; }
+    /** Returns the time spent in a stage, not including the time spent in the stages that are part of it. */
+    double SelfTimeInSeconds(TRenderStage aStage) const noexcept
+        {
+        double t = Stage(aStage).iTimeInSeconds;
+        for (size_t i = 0; i < iStage.size(); i++)
+            {
+            auto s = TRenderStage(i);
+            if (s != aStage && ParentRenderStage(s) == aStage)
+                t -= iStage[i].iTimeInSeconds;
+            }
+        return t > 0 ? t : 0;
+        }
+    /** Adds another set of statistics to this one. */
+    void operator+=(const TRenderStatistics& aOther) noexcept
+        {
+        for (size_t i = 0; i < iStage.size(); i++)
+            iStage[i] += aOther.iStage[i];
+        iFrameCount += aOther.iFrameCount;
+        iObjectCount += aOther.iObjectCount;
+        iLabelCount += aOther.iLabelCount;
+        }
+    /** Resets all statistics to zero. */
+    void Clear() noexcept { *this = TRenderStatistics(); }
+
+    /** The statistics for each stage, indexed by TRenderStage. */
+    std::array<TRenderStageStatistics,size_t(TRenderStage::Count)> iStage = { };
+    /** The number of frames or tiles drawn. */
+    uint64_t iFrameCount = 0;
+    /** The number of map objects drawn. */
+    uint64_t iObjectCount = 0;
+    /** The number of labels drawn. */
+    uint64_t iLabelCount = 0;
+    };
+
+/**
+A timer that adds the time between its construction and destruction to a rendering stage.
+If the statistics pointer is null the timer does nothing, so that statistics collection
+costs almost nothing when it is disabled.
+*/
+class TRenderStageTimer
+    {
+    public:
+    /** Starts timing aStage, adding the result to aStatistics, which may be null. */
+    TRenderStageTimer(TRenderStatistics* aStatistics,TRenderStage aStage) noexcept:
+        m_statistics(aStatistics),
+        m_stage(aStage)
+        {
+        if (m_statistics)
+            m_start = std::chrono::steady_clock::now();
+        }
+    /** Stops timing and adds the elapsed time to the statistics. */
+    ~TRenderStageTimer()
+        {
+        if (m_statistics)
+            {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+            auto& s = m_statistics->Stage(m_stage);
+            s.iTimeInSeconds += elapsed.count();
+            s.iCount++;
+            }
+        }
+
+    TRenderStageTimer(const TRenderStageTimer&) = delete;
+    TRenderStageTimer& operator=(const TRenderStageTimer&) = delete;
+
+    private:
+    TRenderStatistics* m_statistics;
+    TRenderStage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_STATISTICS_H__
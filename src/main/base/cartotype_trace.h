@@ -0,0 +1,265 @@
+/*
+cartotype_trace.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_TRACE_H__
+#define CARTOTYPE_TRACE_H__
+
+#include <cartotype_stream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A recorder for spans of time, recorded using TTraceSpan, spent in operations and their internal stages.
+The recorded spans can be written in the Chrome trace-event JSON format, which can be
+loaded into chrome://tracing or the Perfetto UI for inspection.
+
+A trace recorder may be used by any number of threads at once. Each thread records spans
+into its own buffer, so that recording does not contend for a lock shared with the other threads;
+the buffers are merged when the trace is written.
+*/
+class CTraceRecorder
+    {
+    public:
+    /** Creates a trace recorder which records up to aMaxEventCount spans; spans after that are counted but not stored. */
+    explicit CTraceRecorder(size_t aMaxEventCount = KDefaultMaxEventCount):
+        m_max_event_count(aMaxEventCount),
+        m_start(std::chrono::steady_clock::now()),
+        m_id(NextRecorderId())
+        {
+        }
+
+    /** The default maximum number of spans recorded. */
+    static constexpr size_t KDefaultMaxEventCount = 1000000;
+
+    /** Enables or disables recording. Returns the previous state. */
+    bool Enable(bool aEnable) { return m_enabled.exchange(aEnable); }
+    /** Returns true if recording is enabled. */
+    bool Enabled() const { return m_enabled; }
+    /** Returns the time in microseconds since the recorder was created. */
+    double Now() const
+        {
+        std::chrono::duration<double,std::micro> t = std::chrono::steady_clock::now() - m_start;
+        return t.count();
+        }
+    /**
+    Records a span on the current thread, given its name, category, start time and end time in microseconds
+    as returned by Now. aArgs, if not empty, is a string describing the operation, such as the tile coordinates.
+    */
+    void AddSpan(const char* aName,const char* aCategory,double aStart,double aEnd,const std::string& aArgs = std::string())
+        {
+        if (!m_enabled)
+            return;
+        if (m_event_count.fetch_add(1,std::memory_order_relaxed) >= m_max_event_count)
+            {
+            m_dropped_event_count.fetch_add(1,std::memory_order_relaxed);
+            return;
+            }
+        TThreadBuffer& buffer = ThreadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.iMutex); // contended only while the trace is being written or cleared
+        buffer.iEventArray.push_back(TEvent { aName,aCategory,aStart,aEnd - aStart,buffer.iThread,aArgs });
+        }
+    /** Discards all recorded spans. */
+    void Clear()
+        {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& b : m_buffer_array)
+            {
+            std::lock_guard<std::mutex> buffer_lock(b->iMutex);
+            b->iEventArray.clear();
+            }
+        m_event_count = 0;
+        m_dropped_event_count = 0;
+        }
+    /** Returns the number of spans recorded. */
+    size_t EventCount() const { return std::min(m_event_count.load(),m_max_event_count); }
+    /** Returns the number of spans not recorded because the maximum number had been reached. */
+    size_t DroppedEventCount() const { return m_dropped_event_count; }
+
+    /** Writes the recorded spans in Chrome trace-event JSON format, merging the spans recorded by all threads in order of start time. */
+    void WriteJson(MOutputStream& aOutput) const
+        {
+        std::vector<TEvent> event_array;
+        std::vector<uint32_t> thread_array;
+            {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto& b : m_buffer_array)
+                {
+                std::lock_guard<std::mutex> buffer_lock(b->iMutex);
+                event_array.insert(event_array.end(),b->iEventArray.begin(),b->iEventArray.end());
+                thread_array.push_back(b->iThread);
+                }
+            }
+        std::stable_sort(event_array.begin(),event_array.end(),[](const TEvent& aA,const TEvent& aB) { return aA.iStart < aB.iStart; });
+
+        aOutput.WriteString("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        bool first = true;
+        for (uint32_t thread : thread_array)
+            {
+            char buffer[128];
+            snprintf(buffer,sizeof(buffer),"%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                     first ? "" : ",",unsigned(thread),unsigned(thread));
+            aOutput.WriteString(buffer);
+            first = false;
+            }
+        for (const auto& e : event_array)
+            {
+            aOutput.WriteString(first ? "\n{\"name\":" : ",\n{\"name\":");
+            first = false;
+            WriteJsonString(aOutput,e.iName);
+            aOutput.WriteString(",\"cat\":");
+            WriteJsonString(aOutput,e.iCategory);
+            char buffer[128];
+            snprintf(buffer,sizeof(buffer),",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",e.iStart,e.iDuration,unsigned(e.iThread));
+            aOutput.WriteString(buffer);
+            if (!e.iArgs.empty())
+                {
+                aOutput.WriteString(",\"args\":{\"detail\":");
+                WriteJsonString(aOutput,e.iArgs.c_str());
+                aOutput.WriteString("}");
+                }
+            aOutput.WriteString("}");
+            }
+        aOutput.WriteString("\n]}\n");
+        }
+
+    CTraceRecorder(const CTraceRecorder&) = delete;
+    CTraceRecorder& operator=(const CTraceRecorder&) = delete;
+
+    private:
+    class TEvent
+        {
+        public:
+        const char* iName;
+        const char* iCategory;
+        double iStart;
+        double iDuration;
+        uint32_t iThread;
+        std::string iArgs;
+        };
+
+    // The spans recorded by one thread. The buffers are owned by the recorder, so they survive the threads that wrote them.
+    class TThreadBuffer
+        {
+        public:
+        std::mutex iMutex;
+        std::vector<TEvent> iEventArray;
+        uint32_t iThread = 0;
+        };
+
+    // A thread's cache of the buffers it uses, keyed by recorder id. Ids are never reused, so an entry for a destroyed recorder never matches.
+    class TThreadCacheEntry
+        {
+        public:
+        uint64_t iRecorderId;
+        TThreadBuffer* iBuffer;
+        std::weak_ptr<TThreadBuffer> iOwner;
+        };
+
+    static uint64_t NextRecorderId()
+        {
+        static std::atomic<uint64_t> next_id { 1 };
+        return next_id++;
+        }
+
+    // Returns the current thread's buffer, creating it the first time the thread records a span. Only that first call takes the recorder's lock.
+    TThreadBuffer& ThreadBuffer()
+        {
+        thread_local std::vector<TThreadCacheEntry> cache;
+        for (const auto& e : cache)
+            if (e.iRecorderId == m_id)
+                return *e.iBuffer;
+
+        cache.erase(std::remove_if(cache.begin(),cache.end(),[](const TThreadCacheEntry& aEntry) { return aEntry.iOwner.expired(); }),cache.end());
+        auto buffer = std::make_shared<TThreadBuffer>();
+            {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            buffer->iThread = uint32_t(m_buffer_array.size() + 1);
+            m_buffer_array.push_back(buffer);
+            }
+        cache.push_back(TThreadCacheEntry { m_id,buffer.get(),buffer });
+        return *buffer;
+        }
+
+    static void WriteJsonString(MOutputStream& aOutput,const char* aText)
+        {
+        aOutput.WriteString("\"");
+        for (const char* p = aText ? aText : ""; *p; p++)
+            {
+            uint8_t c = uint8_t(*p);
+            if (c == '"' || c == '\\')
+                {
+                char buffer[3] = { '\\', char(c), 0 };
+                aOutput.WriteString(buffer);
+                }
+            else if (c < 0x20)
+                {
+                char buffer[8];
+                snprintf(buffer,sizeof(buffer),"\\u%04x",unsigned(c));
+                aOutput.WriteString(buffer);
+                }
+            else
+                aOutput.Write(&c,1);
+            }
+        aOutput.WriteString("\"");
+        }
+
+    mutable std::mutex m_mutex; // protects m_buffer_array
+    std::atomic<bool> m_enabled { true };
+    size_t m_max_event_count;
+    std::atomic<size_t> m_event_count { 0 };
+    std::atomic<size_t> m_dropped_event_count { 0 };
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_id;
+    std::vector<std::shared_ptr<TThreadBuffer>> m_buffer_array;
+    };
+
+/**
+A span which is recorded by a trace recorder when it is destroyed.
+If the recorder is null the span does nothing. The name and category must be
+string literals or other strings that outlive the recorder.
+*/
+class TTraceSpan
+    {
+    public:
+    /** Starts a span with a given name and category. */
+    TTraceSpan(CTraceRecorder* aRecorder,const char* aName,const char* aCategory = "framework"):
+        m_recorder(aRecorder),
+        m_name(aName),
+        m_category(aCategory),
+        m_start(aRecorder ? aRecorder->Now() : 0)
+        {
+        }
+    /** Ends the span and records it. */
+    ~TTraceSpan()
+        {
+        if (m_recorder)
+            m_recorder->AddSpan(m_name,m_category,m_start,m_recorder->Now(),m_args);
+        }
+    /** Sets a string describing the operation, such as the tile coordinates. */
+    void SetArgs(const std::string& aArgs) { m_args = aArgs; }
+
+    TTraceSpan(const TTraceSpan&) = delete;
+    TTraceSpan& operator=(const TTraceSpan&) = delete;
+
+    private:
+    CTraceRecorder* m_recorder;
+    const char* m_name;
+    const char* m_category;
+    double m_start;
+    std::string m_args;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_TRACE_H__
@@ -0,0 +1,262 @@
+/*
+cartotype_versioned_map.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+*/
+
+#ifndef CARTOTYPE_VERSIONED_MAP_H__
+#define CARTOTYPE_VERSIONED_MAP_H__
+
+#include <cartotype_errors.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CartoType
+{
+
+/**
+A map from 64-bit ids to immutable objects, with copy-on-write versions, used to store the objects in
+writable memory maps so that drawing and finding do not contend with updates.
+
+Readers call Snapshot to pin the current version, which stays unchanged for as long as they hold it,
+however many updates are made meanwhile. Writers make changes in a CTransaction, which builds the next
+version by copying only the nodes on the paths to the changed ids and sharing the rest with the previous version;
+Commit then publishes the new version atomically. Only one transaction may be open at a time: a
+second writer waits until the first transaction has been committed or abandoned.
+
+The versions are stored as radix trees with 32 children per node, so the cost of a change is proportional to
+the number of levels, which is about log32 of the largest id, and a version shares all unchanged nodes with its predecessor.
+Nodes created within a transaction are modified in place until it is committed, so batches of changes are cheap.
+*/
+template<class T> class CVersionedMap
+    {
+    private:
+    class TNode;
+    using TNodePtr = std::shared_ptr<TNode>;
+
+    public:
+    /** A shared pointer to an object stored in the map. */
+    using TValue = std::shared_ptr<const T>;
+
+    /** An immutable version of the map. */
+    class CVersion
+        {
+        public:
+        /** Returns the version number, which starts at 0 for the empty map and increases by 1 for each committed transaction. */
+        uint64_t Number() const { return m_number; }
+        /** Returns the number of objects. */
+        size_t Count() const { return m_count; }
+        /** Returns the object with the id aId, or null if there is none. */
+        TValue Find(uint64_t aId) const
+            {
+            if (!m_root || aId > MaxId(m_height))
+                return nullptr;
+            const TNode* node = m_root.get();
+            for (int level = m_height; level > 0; level--)
+                {
+                node = node->iChild[Slot(aId,level)].get();
+                if (!node)
+                    return nullptr;
+                }
+            return node->iValue[Slot(aId,0)];
+            }
+        /** Calls aFunction for each object with an id in the inclusive range aStartId...aEndId, in ascending order of id. */
+        void ForEach(uint64_t aStartId,uint64_t aEndId,const std::function<void(uint64_t aId,const TValue& aValue)>& aFunction) const
+            {
+            if (m_root && aStartId <= aEndId)
+                ForEach(*m_root,m_height,0,aStartId,aEndId,aFunction);
+            }
+
+        private:
+        friend class CVersionedMap;
+        static void ForEach(const TNode& aNode,int aLevel,uint64_t aBase,uint64_t aStartId,uint64_t aEndId,
+                            const std::function<void(uint64_t aId,const TValue& aValue)>& aFunction)
+            {
+            uint64_t span = uint64_t(1) << (KBitsPerLevel * aLevel);
+            for (uint64_t i = 0; i < KFanOut; i++)
+                {
+                uint64_t first = aBase + i * span;
+                uint64_t last = first + span - 1;
+                if (last < aStartId || first > aEndId)
+                    continue;
+                if (aLevel == 0)
+                    {
+                    if (aNode.iValue[i])
+                        aFunction(first,aNode.iValue[i]);
+                    }
+                else if (aNode.iChild[i])
+                    ForEach(*aNode.iChild[i],aLevel - 1,first,aStartId,aEndId,aFunction);
+                }
+            }
+
+        TNodePtr m_root;
+        int m_height = 0; // the level of the root; leaves are at level 0
+        size_t m_count = 0;
+        uint64_t m_number = 0;
+        };
+
+    /** A shared pointer to an immutable version. */
+    using TSnapshot = std::shared_ptr<const CVersion>;
+
+    /**
+    A set of changes making up the next version of a versioned map. The changes are invisible to readers until Commit is called.
+    If the transaction is destroyed without being committed the changes are discarded.
+    */
+    class CTransaction
+        {
+        public:
+        /** Inserts aValue with the id aId, replacing any existing object with that id. aValue must not be null. */
+        TResult Insert(uint64_t aId,TValue aValue)
+            {
+            if (!aValue)
+                return KErrorInvalidArgument;
+            if (!m_open)
+                return KErrorNotFound;
+            while (aId > MaxId(m_version->m_height) || !m_version->m_root)
+                {
+                if (!m_version->m_root)
+                    {
+                    m_version->m_root = NewNode(0);
+                    m_version->m_height = 0;
+                    continue;
+                    }
+                auto root = NewNode(m_version->m_height + 1);
+                root->iChild[0] = std::move(m_version->m_root);
+                m_version->m_root = std::move(root);
+                m_version->m_height++;
+                }
+            TNode* node = Writable(m_version->m_root,m_version->m_height);
+            for (int level = m_version->m_height; level > 0; level--)
+                node = Writable(node->iChild[Slot(aId,level)],level - 1);
+            auto& slot = node->iValue[Slot(aId,0)];
+            if (!slot)
+                m_version->m_count++;
+            slot = std::move(aValue);
+            return KErrorNone;
+            }
+        /** Removes the object with the id aId. Returns false if there was no such object. */
+        bool Remove(uint64_t aId)
+            {
+            if (!m_open || !m_version->Find(aId))
+                return false;
+            TNode* node = Writable(m_version->m_root,m_version->m_height);
+            for (int level = m_version->m_height; level > 0; level--)
+                node = Writable(node->iChild[Slot(aId,level)],level - 1);
+            node->iValue[Slot(aId,0)].reset();
+            m_version->m_count--;
+            return true;
+            }
+        /** Returns the object with the id aId in the version being built, including uncommitted changes, or null if the transaction has been committed. */
+        TValue Find(uint64_t aId) const { return m_open ? m_version->Find(aId) : nullptr; }
+        /** Returns the number of objects in the version being built, or zero if the transaction has been committed. */
+        size_t Count() const { return m_open ? m_version->m_count : 0; }
+        /** Publishes the changes as a new version and ends the transaction. Readers pinning a snapshot after this see the changes. */
+        void Commit()
+            {
+            if (!m_open)
+                return;
+            m_open = false;
+            m_map.Publish(std::move(m_version));
+            m_lock.unlock();
+            }
+
+        private:
+        friend class CVersionedMap;
+        CTransaction(CVersionedMap& aMap,std::unique_lock<std::mutex>&& aLock):
+            m_map(aMap),
+            m_lock(std::move(aLock)),
+            m_version(new CVersion(*aMap.Snapshot())),
+            m_owner(++aMap.m_last_transaction)
+            {
+            m_version->m_number++;
+            }
+
+        TNodePtr NewNode(int aLevel) const
+            {
+            auto node = std::make_shared<TNode>();
+            node->iOwner = m_owner;
+            if (aLevel == 0)
+                node->iValue.resize(KFanOut);
+            else
+                node->iChild.resize(KFanOut);
+            return node;
+            }
+        // Returns a node which may be modified by this transaction, copying aNode if it belongs to an earlier version.
+        TNode* Writable(TNodePtr& aNode,int aLevel) const
+            {
+            if (!aNode)
+                aNode = NewNode(aLevel);
+            else if (aNode->iOwner != m_owner)
+                {
+                auto copy = std::make_shared<TNode>(*aNode);
+                copy->iOwner = m_owner;
+                aNode = std::move(copy);
+                }
+            return aNode.get();
+            }
+
+        CVersionedMap& m_map;
+        std::unique_lock<std::mutex> m_lock;
+        std::unique_ptr<CVersion> m_version;
+        uint64_t m_owner;
+        bool m_open = true;
+        };
+
+    CVersionedMap(): m_current(new CVersion) { }
+    CVersionedMap(const CVersionedMap&) = delete;
+    CVersionedMap& operator=(const CVersionedMap&) = delete;
+
+    /** Returns the current version. It remains valid and unchanged for as long as the caller holds it. */
+    TSnapshot Snapshot() const
+        {
+        std::lock_guard<std::mutex> lock(m_publish_mutex);
+        return m_current;
+        }
+    /** Starts a transaction, waiting for any other transaction to finish. */
+    std::unique_ptr<CTransaction> BeginTransaction()
+        {
+        std::unique_lock<std::mutex> lock(m_write_mutex);
+        return std::unique_ptr<CTransaction>(new CTransaction(*this,std::move(lock)));
+        }
+
+    /** The number of bits of the id used at each level of the tree. */
+    static constexpr int KBitsPerLevel = 5;
+    /** The number of children of each node. */
+    static constexpr uint64_t KFanOut = uint64_t(1) << KBitsPerLevel;
+
+    private:
+    class TNode
+        {
+        public:
+        uint64_t iOwner = 0; // the transaction which created the node, and may modify it until it is committed
+        std::vector<TNodePtr> iChild;
+        std::vector<TValue> iValue;
+        };
+
+    static size_t Slot(uint64_t aId,int aLevel) { return size_t((aId >> (KBitsPerLevel * aLevel)) & (KFanOut - 1)); }
+    static uint64_t MaxId(int aHeight)
+        {
+        int bits = KBitsPerLevel * (aHeight + 1);
+        return bits >= 64 ? UINT64_MAX : (uint64_t(1) << bits) - 1;
+        }
+
+    void Publish(std::unique_ptr<CVersion> aVersion)
+        {
+        TSnapshot version(aVersion.release());
+        std::lock_guard<std::mutex> lock(m_publish_mutex);
+        m_current.swap(version);
+        // The old version, if no reader holds it, is destroyed here, outside the lock, when 'version' goes out of scope.
+        }
+
+    mutable std::mutex m_publish_mutex;
+    std::mutex m_write_mutex;
+    TSnapshot m_current;
+    uint64_t m_last_transaction = 0;
+    };
+
+} // namespace CartoType
+
+#endif // CARTOTYPE_VERSIONED_MAP_H__
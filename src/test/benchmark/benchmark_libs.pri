@@ -0,0 +1,15 @@
+# Libraries linked by the benchmarks: the same CartoType builds as those used by the Maps app.
+
+win32:
+{
+CONFIG(debug, debug|release): LIBS += -L$$PWD/../../../bin/17.0/x64/DebugDLL/ -lcartotype
+else:CONFIG(release, debug|release): LIBS += -L$$PWD/../../../bin/17.0/x64/ReleaseDLL/ -lcartotype
+}
+
+unix:!macx: LIBS += -L$$PWD/../../main/single_library/unix/bin/ReleaseLicensed/ -lcartotype -ldl -lpthread
+
+unix:!macx: PRE_TARGETDEPS += $$PWD/../../main/single_library/unix/bin/ReleaseLicensed/libcartotype.a
+
+macx: LIBS += -L$$PWD/../../main/single_library/mac/CartoType/build/Release/ -lCartoType
+
+macx: PRE_TARGETDEPS += $$PWD/../../main/single_library/mac/CartoType/build/Release/libCartoType.a
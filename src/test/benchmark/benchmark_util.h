@@ -0,0 +1,322 @@
+/*
+benchmark_util.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Timing, percentile, memory and JSON output utilities shared by the CartoType benchmarks.
+*/
+
+#ifndef CARTOTYPE_BENCHMARK_UTIL_H__
+#define CARTOTYPE_BENCHMARK_UTIL_H__
+
+#include <cartotype_framework.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace Benchmark
+{
+
+/** A simple stopwatch measuring elapsed time in seconds. */
+class TStopwatch
+    {
+    public:
+    TStopwatch(): m_start(std::chrono::steady_clock::now()) { }
+    /** Returns the time in seconds since the stopwatch was created or restarted. */
+    double Elapsed() const
+        {
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - m_start;
+        return t.count();
+        }
+    /** Restarts the stopwatch. */
+    void Restart() { m_start = std::chrono::steady_clock::now(); }
+
+    private:
+    std::chrono::steady_clock::time_point m_start;
+    };
+
+/** A set of latency samples in seconds, from which throughput and percentiles can be obtained. */
+class CLatencySet
+    {
+    public:
+    /** Adds a sample. */
+    void Add(double aSeconds) { m_sample_array.push_back(aSeconds); m_sorted = false; }
+    /** Returns the number of samples. */
+    size_t Count() const { return m_sample_array.size(); }
+    /** Returns the total of all samples. */
+    double Total() const
+        {
+        double t = 0;
+        for (double s : m_sample_array)
+            t += s;
+        return t;
+        }
+    /** Returns the number of operations per second, treating the samples as sequential. */
+    double Throughput() const
+        {
+        double t = Total();
+        return t > 0 ? Count() / t : 0;
+        }
+    /** Returns a percentile (0...100) using the nearest-rank method. */
+    double Percentile(double aPercent)
+        {
+        if (m_sample_array.empty())
+            return 0;
+        if (!m_sorted)
+            {
+            std::sort(m_sample_array.begin(),m_sample_array.end());
+            m_sorted = true;
+            }
+        size_t rank = size_t(std::ceil(aPercent / 100.0 * m_sample_array.size()));
+        if (rank > 0)
+            rank--;
+        return m_sample_array[std::min(rank,m_sample_array.size() - 1)];
+        }
+
+    private:
+    std::vector<double> m_sample_array;
+    bool m_sorted = true;
+    };
+
+/** Returns the peak resident memory used by this process in bytes, or 0 if it cannot be determined. */
+inline uint64_t PeakMemoryBytes()
+    {
+#if defined(__APPLE__)
+    rusage usage = { };
+    getrusage(RUSAGE_SELF,&usage);
+    return uint64_t(usage.ru_maxrss); // bytes on macOS
+#elif defined(__unix__)
+    rusage usage = { };
+    getrusage(RUSAGE_SELF,&usage);
+    return uint64_t(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#else
+    return 0;
+#endif
+    }
+
+/** Returns the current resident memory used by this process in bytes, or 0 if it cannot be determined. */
+inline uint64_t CurrentMemoryBytes()
+    {
+#if defined(__linux__)
+    FILE* file = fopen("/proc/self/statm","r");
+    if (!file)
+        return 0;
+    unsigned long pages = 0, resident = 0;
+    int n = fscanf(file,"%lu %lu",&pages,&resident);
+    fclose(file);
+    return n == 2 ? uint64_t(resident) * uint64_t(sysconf(_SC_PAGESIZE)) : 0;
+#else
+    return 0;
+#endif
+    }
+
+/** Writes benchmark results as JSON. Objects and arrays are opened and closed explicitly. */
+class CJsonWriter
+    {
+    public:
+    /** Begins an object, which is a member called aName if aName is non-null. */
+    void BeginObject(const char* aName = nullptr) { Open(aName,'{'); }
+    /** Ends an object. */
+    void EndObject() { Close('}'); }
+    /** Begins an array, which is a member called aName if aName is non-null. */
+    void BeginArray(const char* aName = nullptr) { Open(aName,'['); }
+    /** Ends an array. */
+    void EndArray() { Close(']'); }
+    /** Writes a string member. */
+    void Write(const char* aName,const std::string& aValue) { Key(aName); Quote(aValue); }
+    /** Writes a number member. */
+    void Write(const char* aName,double aValue)
+        {
+        Key(aName);
+        char buffer[32];
+        snprintf(buffer,sizeof(buffer),"%.9g",aValue);
+        m_text += buffer;
+        }
+    /** Writes a Boolean member. */
+    void Write(const char* aName,bool aValue) { Key(aName); m_text += aValue ? "true" : "false"; }
+    /** Writes the count, throughput and latency percentiles of a set of samples as members of the current object. */
+    void WriteLatency(CLatencySet& aLatency)
+        {
+        Write("count",double(aLatency.Count()));
+        Write("per_second",aLatency.Throughput());
+        Write("p50_ms",aLatency.Percentile(50) * 1000);
+        Write("p90_ms",aLatency.Percentile(90) * 1000);
+        Write("p99_ms",aLatency.Percentile(99) * 1000);
+        Write("max_ms",aLatency.Percentile(100) * 1000);
+        }
+    /** Returns the JSON text. */
+    const std::string& Text() const { return m_text; }
+
+    private:
+    void Key(const char* aName)
+        {
+        if (m_need_comma)
+            m_text += ',';
+        m_text += '\n';
+        m_text.append(m_depth * 2,' ');
+        if (aName)
+            {
+            Quote(aName);
+            m_text += ':';
+            }
+        m_need_comma = true;
+        }
+    void Open(const char* aName,char aBracket)
+        {
+        if (m_depth || m_need_comma)
+            Key(aName);
+        m_text += aBracket;
+        m_depth++;
+        m_need_comma = false;
+        }
+    void Close(char aBracket)
+        {
+        m_depth--;
+        m_text += '\n';
+        m_text.append(m_depth * 2,' ');
+        m_text += aBracket;
+        m_need_comma = true;
+        }
+    void Quote(const std::string& aText)
+        {
+        m_text += '"';
+        for (char c : aText)
+            {
+            if (c == '"' || c == '\\')
+                m_text += '\\';
+            m_text += c;
+            }
+        m_text += '"';
+        }
+
+    std::string m_text;
+    int m_depth = 0;
+    bool m_need_comma = false;
+    };
+
+/**
+Begins an object when it is constructed and ends it when it is destroyed,
+so that returning early on an error still leaves well-formed JSON.
+*/
+class TJsonObjectScope
+    {
+    public:
+    /** Begins an object, which is a member called aName if aName is non-null. */
+    TJsonObjectScope(CJsonWriter& aJson,const char* aName = nullptr): m_json(aJson) { m_json.BeginObject(aName); }
+    /** Ends the object. */
+    ~TJsonObjectScope() { m_json.EndObject(); }
+
+    TJsonObjectScope(const TJsonObjectScope&) = delete;
+    TJsonObjectScope& operator=(const TJsonObjectScope&) = delete;
+
+    private:
+    CJsonWriter& m_json;
+    };
+
+/**
+Command-line options of the form --name=value. Options not given on the command
+line take their default values, which are relative to the benchmark directory.
+*/
+class CCommandLine
+    {
+    public:
+    CCommandLine(int aArgc,char** aArgv)
+        {
+        for (int i = 1; i < aArgc; i++)
+            {
+            const char* p = aArgv[i];
+            if (strncmp(p,"--",2))
+                continue;
+            p += 2;
+            const char* q = strchr(p,'=');
+            if (q)
+                m_option[std::string(p,q - p)] = q + 1;
+            else
+                m_option[p] = "1";
+            }
+        }
+    /** Returns the value of an option, or aDefault if it was not given. */
+    std::string Get(const char* aName,const char* aDefault) const
+        {
+        auto p = m_option.find(aName);
+        return p == m_option.end() ? aDefault : p->second;
+        }
+    /** Returns the integer value of an option, or aDefault if it was not given. */
+    int GetInt(const char* aName,int aDefault) const
+        {
+        auto p = m_option.find(aName);
+        return p == m_option.end() ? aDefault : atoi(p->second.c_str());
+        }
+
+    private:
+    std::map<std::string,std::string> m_option;
+    };
+
+/** The default map used by the benchmarks. */
+constexpr const char* KDefaultMap = "../data/ctm1/santa-cruz.ctm1";
+/** The default font used by the benchmarks. */
+constexpr const char* KDefaultFont = "../../../font/DejaVuSans.ttf";
+/** The default style sheet used by the benchmarks. */
+constexpr const char* KDefaultStyleSheet = "../../../style/standard.ctstyle";
+
+/** Writes the JSON results to the file named by the --out option, or to standard output if there is no such option. */
+inline int WriteResults(const CCommandLine& aCommandLine,const CJsonWriter& aJson)
+    {
+    std::string out = aCommandLine.Get("out","");
+    FILE* file = out.empty() ? stdout : fopen(out.c_str(),"w");
+    if (!file)
+        {
+        fprintf(stderr,"cannot open %s\n",out.c_str());
+        return 1;
+        }
+    fputs(aJson.Text().c_str(),file);
+    fputs("\n",file);
+    if (file != stdout)
+        fclose(file);
+    return 0;
+    }
+
+/** Writes the start of the results: the CartoType version and build and the map file name. */
+inline void WriteHeader(CJsonWriter& aJson,const char* aBenchmarkName,const std::string& aMapFileName)
+    {
+    aJson.BeginObject();
+    aJson.Write("benchmark",std::string(aBenchmarkName));
+    aJson.Write("cartotype_version",std::string(CartoType::Version()));
+    aJson.Write("cartotype_build",std::string(CartoType::Build()));
+    aJson.Write("map",aMapFileName);
+    }
+
+/** Creates a framework for a benchmark, loading the additional fonts found in the font directory. */
+inline std::unique_ptr<CartoType::CFramework> CreateFramework(CartoType::TResult& aError,const CCommandLine& aCommandLine,const std::string& aStyleSheet,int32_t aWidth,int32_t aHeight,int32_t aTextIndexLevels = 0)
+    {
+    CartoType::CFramework::TParam param;
+    param.iMapFileName = aCommandLine.Get("map",KDefaultMap).c_str();
+    param.iStyleSheetFileName = aStyleSheet.c_str();
+    param.iFontFileName = aCommandLine.Get("font",KDefaultFont).c_str();
+    param.iViewWidth = aWidth;
+    param.iViewHeight = aHeight;
+    param.iTextIndexLevels = aTextIndexLevels;
+    auto framework = CartoType::CFramework::New(aError,param);
+    if (!aError)
+        {
+        std::string font_dir = aCommandLine.Get("font_dir","../../../font/");
+        for (const char* font : { "DejaVuSans-Bold.ttf", "DejaVuSerif.ttf", "DejaVuSerif-Italic.ttf", "MapkeyIcons.ttf" })
+            framework->LoadFont((font_dir + font).c_str());
+        }
+    return framework;
+    }
+
+} // namespace Benchmark
+
+#endif // CARTOTYPE_BENCHMARK_UTIL_H__
@@ -0,0 +1,194 @@
+/*
+render_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+A headless rendering benchmark. For each style sheet it draws a fixed set of views
+at zoom levels 8 to 18 in flat, rotated, perspective and night modes, and a fixed set
+of tiles at the same zoom levels, and reports throughput, latency percentiles
+and peak memory as JSON.
+
+Usage: render_benchmark [--map=file] [--font=file] [--style_dir=dir] [--styles=a,b]
+                        [--iterations=n] [--size=pixels] [--out=file]
+*/
+
+#include "benchmark_util.h"
+
+using namespace CartoType;
+using namespace Benchmark;
+
+namespace
+{
+
+enum class TViewMode
+    {
+    Flat,
+    Rotated,
+    Perspective,
+    Night
+    };
+
+const char* const KViewModeName[] = { "flat", "rotated", "perspective", "night" };
+
+constexpr int32_t KMinZoom = 8;
+constexpr int32_t KMaxZoom = 18;
+
+// Pans, in fractions of the view size, giving a fixed set of views around the map center at each zoom level.
+const TPointFP KViewOffset[] = { { 0, 0 }, { 0.5, 0 }, { 0, 0.5 }, { -0.5, 0 }, { 0, -0.5 } };
+
+void SetViewMode(CFramework& aFramework,TViewMode aMode)
+    {
+    aFramework.SetRotation(aMode == TViewMode::Rotated ? 30 : 0);
+    aFramework.SetPerspective(aMode == TViewMode::Perspective);
+    aFramework.SetNightMode(aMode == TViewMode::Night);
+    }
+
+// Gets the coordinates of the standard web map tile containing a point in degrees.
+void GetTile(const TPointFP& aPoint,int32_t aZoom,int32_t& aX,int32_t& aY)
+    {
+    double n = double(1 << aZoom);
+    double lat = aPoint.iY * KDegreesToRadiansDouble;
+    aX = int32_t(std::floor((aPoint.iX + 180.0) / 360.0 * n));
+    aY = int32_t(std::floor((1.0 - std::log(std::tan(lat) + 1.0 / std::cos(lat)) / KPiDouble) / 2.0 * n));
+    }
+
+TResult RunViews(CJsonWriter& aJson,CFramework& aFramework,const TPointFP& aCenter,int32_t aSize,int aIterations)
+    {
+    TJsonObjectScope views(aJson,"views");
+    for (int mode = 0; mode < 4; mode++)
+        {
+        SetViewMode(aFramework,TViewMode(mode));
+        TJsonObjectScope view_mode(aJson,KViewModeName[mode]);
+        CLatencySet all;
+        for (int32_t zoom = KMinZoom; zoom <= KMaxZoom; zoom++)
+            {
+            CLatencySet latency;
+            for (const auto& offset : KViewOffset)
+                {
+                TResult error = aFramework.SetViewCenter(aCenter.iX,aCenter.iY,TCoordType::Degree);
+                if (!error)
+                    error = aFramework.SetScaleDenominator(aFramework.ScaleDenominatorFromZoomLevel(zoom,aSize));
+                if (!error)
+                    error = aFramework.Pan(int32_t(offset.iX * aSize),int32_t(offset.iY * aSize));
+                if (error)
+                    return error;
+                for (int i = 0; i < aIterations; i++)
+                    {
+                    aFramework.ForceRedraw();
+                    TStopwatch stopwatch;
+                    aFramework.MapBitmap(error);
+                    double t = stopwatch.Elapsed();
+                    if (error)
+                        return error;
+                    latency.Add(t);
+                    all.Add(t);
+                    }
+                }
+            aJson.BeginObject(std::to_string(zoom).c_str());
+            aJson.WriteLatency(latency);
+            aJson.EndObject();
+            }
+        aJson.BeginObject("all");
+        aJson.WriteLatency(all);
+        aJson.EndObject();
+        }
+    SetViewMode(aFramework,TViewMode::Flat);
+    return KErrorNone;
+    }
+
+TResult RunTiles(CJsonWriter& aJson,CFramework& aFramework,const TPointFP& aCenter,int aIterations)
+    {
+    TJsonObjectScope tiles(aJson,"tiles");
+    CLatencySet all;
+    for (int32_t zoom = KMinZoom; zoom <= KMaxZoom; zoom++)
+        {
+        int32_t center_x = 0, center_y = 0;
+        GetTile(aCenter,zoom,center_x,center_y);
+        CLatencySet latency;
+        for (int i = 0; i < aIterations; i++)
+            {
+            for (int32_t y = center_y - 1; y <= center_y + 1; y++)
+                for (int32_t x = center_x - 1; x <= center_x + 1; x++)
+                    {
+                    TResult error;
+                    TStopwatch stopwatch;
+                    CBitmap bitmap { aFramework.TileBitmap(error,256,zoom,x,y) };
+                    double t = stopwatch.Elapsed();
+                    if (error)
+                        return error;
+                    latency.Add(t);
+                    all.Add(t);
+                    }
+            }
+        aJson.BeginObject(std::to_string(zoom).c_str());
+        aJson.WriteLatency(latency);
+        aJson.EndObject();
+        }
+    aJson.BeginObject("all");
+    aJson.WriteLatency(all);
+    aJson.EndObject();
+    return KErrorNone;
+    }
+
+TResult RunStyle(CJsonWriter& aJson,const CCommandLine& aCommandLine,const std::string& aStyleName)
+    {
+    int32_t size = aCommandLine.GetInt("size",512);
+    int iterations = aCommandLine.GetInt("iterations",3);
+    std::string style_sheet = aCommandLine.Get("style_dir","../../../style/") + aStyleName + ".ctstyle";
+
+    TStopwatch stopwatch;
+    TResult error;
+    auto framework = CreateFramework(error,aCommandLine,style_sheet,size,size);
+    if (error)
+        return error;
+    aJson.BeginObject(aStyleName.c_str());
+    aJson.Write("startup_ms",stopwatch.Elapsed() * 1000);
+    aJson.Write("memory_after_startup_bytes",double(CurrentMemoryBytes()));
+
+    TRectFP extent;
+    error = framework->GetMapExtent(extent,TCoordType::Degree);
+    TPointFP center = extent.Center();
+    if (!error)
+        error = RunViews(aJson,*framework,center,size,iterations);
+    if (!error)
+        error = RunTiles(aJson,*framework,center,iterations);
+    aJson.Write("memory_after_run_bytes",double(CurrentMemoryBytes()));
+    aJson.EndObject();
+    return error;
+    }
+
+} // namespace
+
+int main(int aArgc,char** aArgv)
+    {
+    CCommandLine command_line(aArgc,aArgv);
+    std::string map = command_line.Get("map",KDefaultMap);
+    CJsonWriter json;
+    WriteHeader(json,"render",map);
+    json.Write("iterations",double(command_line.GetInt("iterations",3)));
+    json.Write("size",double(command_line.GetInt("size",512)));
+
+    std::string styles = command_line.Get("styles","standard,neo");
+    json.BeginObject("styles");
+    TResult error;
+    size_t start = 0;
+    while (!error && start <= styles.length())
+        {
+        size_t end = styles.find(',',start);
+        if (end == std::string::npos)
+            end = styles.length();
+        std::string style = styles.substr(start,end - start);
+        if (!style.empty())
+            error = RunStyle(json,command_line,style);
+        start = end + 1;
+        }
+    json.EndObject();
+
+    json.Write("peak_memory_bytes",double(PeakMemoryBytes()));
+    json.Write("error",double(uint32_t(error)));
+    if (error)
+        json.Write("error_string",ErrorString(error));
+    json.EndObject();
+    int result = WriteResults(command_line,json);
+    return error ? 2 : result;
+    }
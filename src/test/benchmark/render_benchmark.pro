@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Headless rendering benchmark
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = render_benchmark
+
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+DEFINES += NDEBUG
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += render_benchmark.cpp
+
+HEADERS += benchmark_util.h
+
+include(benchmark_libs.pri)
@@ -0,0 +1,331 @@
+/*
+routing_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+A routing benchmark. For each router type available for the map it loads the
+navigation data, then creates routes between a fixed set of random origin-destination
+pairs, computes a time and distance matrix, computes range isochrones and creates
+best routes through sets of waypoints. It reports the time taken to load the
+navigation data, latency percentiles, memory used and the router's cache statistics as JSON.
+
+The random points are generated from a fixed seed so that successive runs, and runs
+using different releases of CartoType, use the same points.
+
+Usage: routing_benchmark [--map=file] [--routers=a,b] [--seed=n] [--pairs=n]
+                         [--matrix_size=n] [--ranges=n] [--best_routes=n]
+                         [--best_route_points=n] [--out=file]
+*/
+
+#include "benchmark_util.h"
+
+#include <random>
+
+using namespace CartoType;
+using namespace Benchmark;
+
+namespace
+{
+
+const std::pair<const char*,TRouterType> KRouterType[] =
+    {
+    { "StandardAStar", TRouterType::StandardAStar },
+    { "TurnExpandedAStar", TRouterType::TurnExpandedAStar },
+    { "StandardContractionHierarchy", TRouterType::StandardContractionHierarchy },
+    { "TECH", TRouterType::TECH }
+    };
+
+// Range limits in seconds.
+const double KRangeTime[] = { 300, 600, 900 };
+
+// The fraction of the map extent, around the center, in which random points are placed.
+constexpr double KPointArea = 0.8;
+
+// The number of iterations used by CreateBestRoute.
+constexpr size_t KBestRouteIterations = 16;
+
+/** The points used by the benchmark, in degrees. */
+class CRoutingPoints
+    {
+    public:
+    CRoutingPoints(const TRectFP& aExtent,const CCommandLine& aCommandLine)
+        {
+        std::mt19937 generator(uint32_t(aCommandLine.GetInt("seed",1)));
+        TPointFP center = aExtent.Center();
+        double w = aExtent.Width() * KPointArea / 2;
+        double h = aExtent.Height() * KPointArea / 2;
+        std::uniform_real_distribution<double> x(center.iX - w,center.iX + w);
+        std::uniform_real_distribution<double> y(center.iY - h,center.iY + h);
+        auto random_points = [&](size_t aCount)
+            {
+            std::vector<TPointFP> p(aCount);
+            for (auto& q : p)
+                {
+                q.iX = x(generator);
+                q.iY = y(generator);
+                }
+            return p;
+            };
+        iPair = random_points(size_t(aCommandLine.GetInt("pairs",50)) * 2);
+        iMatrix = random_points(size_t(aCommandLine.GetInt("matrix_size",10)));
+        iRange = random_points(size_t(aCommandLine.GetInt("ranges",10)));
+        size_t best_count = size_t(aCommandLine.GetInt("best_routes",10));
+        size_t best_points = size_t(std::max(aCommandLine.GetInt("best_route_points",6),3));
+        for (size_t i = 0; i < best_count; i++)
+            iBest.push_back(random_points(best_points));
+        }
+
+    /** Origins and destinations, in pairs. */
+    std::vector<TPointFP> iPair;
+    /** Points used as both the origins and the destinations of the time and distance matrix. */
+    std::vector<TPointFP> iMatrix;
+    /** Start points for range isochrones. */
+    std::vector<TPointFP> iRange;
+    /** Sets of waypoints for best routes. */
+    std::vector<std::vector<TPointFP>> iBest;
+    };
+
+/** Route creation data accumulated over a number of routes. */
+class CRouteCreationTotals
+    {
+    public:
+    void Add(const TRouteCreationData& aData)
+        {
+        iRouteCalculationTime += aData.iRouteCalculationTime;
+        iRouteExpansionTime += aData.iRouteExpansionTime;
+        iNodeCacheQueries += uint64_t(aData.iNodeCacheQueries);
+        iNodeCacheMisses += uint64_t(aData.iNodeCacheMisses);
+        iArcCacheQueries += uint64_t(aData.iArcCacheQueries);
+        iArcCacheMisses += uint64_t(aData.iArcCacheMisses);
+        }
+    void Write(CJsonWriter& aJson) const
+        {
+        aJson.BeginObject("route_creation_data");
+        aJson.Write("calculation_ms",iRouteCalculationTime * 1000);
+        aJson.Write("expansion_ms",iRouteExpansionTime * 1000);
+        aJson.Write("node_cache_queries",double(iNodeCacheQueries));
+        aJson.Write("node_cache_misses",double(iNodeCacheMisses));
+        aJson.Write("node_cache_hit_rate",iNodeCacheQueries ? 1.0 - double(iNodeCacheMisses) / double(iNodeCacheQueries) : 0.0);
+        aJson.Write("arc_cache_queries",double(iArcCacheQueries));
+        aJson.Write("arc_cache_misses",double(iArcCacheMisses));
+        aJson.Write("arc_cache_hit_rate",iArcCacheQueries ? 1.0 - double(iArcCacheMisses) / double(iArcCacheQueries) : 0.0);
+        aJson.EndObject();
+        }
+
+    double iRouteCalculationTime = 0;
+    double iRouteExpansionTime = 0;
+    uint64_t iNodeCacheQueries = 0;
+    uint64_t iNodeCacheMisses = 0;
+    uint64_t iArcCacheQueries = 0;
+    uint64_t iArcCacheMisses = 0;
+    };
+
+class CRoutingRunner
+    {
+    public:
+    CRoutingRunner(CFramework& aFramework,const CRoutingPoints& aPoints):
+        m_framework(aFramework),
+        m_points(aPoints)
+        {
+        const TRouteProfile* profile = m_framework.Profile(0);
+        if (profile)
+            m_profile = *profile;
+        }
+
+    void Run(CJsonWriter& aJson)
+        {
+        RunRoutes(aJson);
+        RunMatrix(aJson);
+        RunRanges(aJson);
+        RunBestRoutes(aJson);
+        }
+
+    private:
+    void RunRoutes(CJsonWriter& aJson)
+        {
+        CLatencySet latency;
+        CRouteCreationTotals totals;
+        size_t failures = 0;
+        double distance = 0;
+        for (size_t i = 0; i + 1 < m_points.iPair.size(); i += 2)
+            {
+            TResult error;
+            TCoordSet cs(&m_points.iPair[i],2);
+            TStopwatch stopwatch;
+            auto route = m_framework.CreateRoute(error,m_profile,cs,TCoordType::Degree);
+            double t = stopwatch.Elapsed();
+            if (error)
+                {
+                failures++;
+                continue;
+                }
+            latency.Add(t);
+            totals.Add(m_framework.RouteCreationData());
+            distance += route->iDistance;
+            }
+        aJson.BeginObject("routes");
+        aJson.WriteLatency(latency);
+        aJson.Write("failures",double(failures));
+        aJson.Write("mean_distance_m",latency.Count() ? distance / latency.Count() : 0.0);
+        totals.Write(aJson);
+        aJson.EndObject();
+        }
+
+    void RunMatrix(CJsonWriter& aJson)
+        {
+        TResult error;
+        TStopwatch stopwatch;
+        auto matrix = m_framework.TimeAndDistanceMatrix(error,m_points.iMatrix,m_points.iMatrix,TCoordType::Degree);
+        double t = stopwatch.Elapsed();
+        size_t cells = m_points.iMatrix.size() * m_points.iMatrix.size();
+        aJson.BeginObject("matrix");
+        aJson.Write("size",double(m_points.iMatrix.size()));
+        aJson.Write("time_ms",t * 1000);
+        aJson.Write("cells_per_second",t > 0 ? cells / t : 0.0);
+        aJson.Write("error",double(uint32_t(error)));
+        aJson.EndObject();
+        }
+
+    void RunRanges(CJsonWriter& aJson)
+        {
+        aJson.BeginObject("ranges");
+        CLatencySet all;
+        for (double time : KRangeTime)
+            {
+            CLatencySet latency;
+            size_t failures = 0;
+            for (const auto& p : m_points.iRange)
+                {
+                TResult error;
+                TStopwatch stopwatch;
+                CGeometry range = m_framework.Range(error,&m_profile,p.iX,p.iY,TCoordType::Degree,time,true);
+                double t = stopwatch.Elapsed();
+                if (error)
+                    {
+                    failures++;
+                    continue;
+                    }
+                latency.Add(t);
+                all.Add(t);
+                }
+            aJson.BeginObject((std::to_string(int(time)) + "s").c_str());
+            aJson.WriteLatency(latency);
+            aJson.Write("failures",double(failures));
+            aJson.EndObject();
+            }
+        aJson.BeginObject("all");
+        aJson.WriteLatency(all);
+        aJson.EndObject();
+        aJson.EndObject();
+        }
+
+    void RunBestRoutes(CJsonWriter& aJson)
+        {
+        CLatencySet latency;
+        CRouteCreationTotals totals;
+        size_t failures = 0;
+        for (const auto& points : m_points.iBest)
+            {
+            TResult error;
+            TCoordSet cs(points.data(),points.size());
+            TStopwatch stopwatch;
+            auto route = m_framework.CreateBestRoute(error,m_profile,cs,TCoordType::Degree,true,false,KBestRouteIterations);
+            double t = stopwatch.Elapsed();
+            if (error)
+                {
+                failures++;
+                continue;
+                }
+            latency.Add(t);
+            totals.Add(m_framework.RouteCreationData());
+            }
+        aJson.BeginObject("best_routes");
+        aJson.Write("points_per_route",double(m_points.iBest.empty() ? 0 : m_points.iBest[0].size()));
+        aJson.WriteLatency(latency);
+        aJson.Write("failures",double(failures));
+        totals.Write(aJson);
+        aJson.EndObject();
+        }
+
+    CFramework& m_framework;
+    const CRoutingPoints& m_points;
+    TRouteProfile m_profile;
+    };
+
+// Runs the benchmark for a router type. Returns an error only if the framework cannot be created.
+TResult RunRouter(CJsonWriter& aJson,const CCommandLine& aCommandLine,const char* aName,TRouterType aRouterType,std::unique_ptr<CRoutingPoints>& aPoints)
+    {
+    TResult error;
+    auto framework = CreateFramework(error,aCommandLine,KDefaultStyleSheet,256,256);
+    if (error)
+        return error;
+    if (!aPoints)
+        {
+        TRectFP extent;
+        error = framework->GetMapExtent(extent,TCoordType::Degree);
+        if (error)
+            return error;
+        aPoints = std::make_unique<CRoutingPoints>(extent,aCommandLine);
+        }
+
+    aJson.BeginObject(aName);
+    framework->SetPreferredRouterType(aRouterType);
+    // Measure only the memory used by the navigation data, not by the framework or the routing points.
+    uint64_t memory_before = CurrentMemoryBytes();
+    TStopwatch stopwatch;
+    error = framework->LoadNavigationData();
+    double load_time = stopwatch.Elapsed();
+    uint64_t memory_after = CurrentMemoryBytes();
+
+    // The framework falls back to another router type if the map does not support the preferred one.
+    bool available = !error && framework->ActualRouterType() == aRouterType;
+    aJson.Write("available",available);
+    if (available)
+        {
+        aJson.Write("load_ms",load_time * 1000);
+        aJson.Write("memory_bytes",double(memory_after > memory_before ? memory_after - memory_before : 0));
+        CRoutingRunner runner(*framework,*aPoints);
+        runner.Run(aJson);
+        aJson.Write("memory_after_run_bytes",double(CurrentMemoryBytes()));
+        }
+    else if (error)
+        {
+        aJson.Write("error",double(uint32_t(error)));
+        aJson.Write("error_string",ErrorString(error));
+        }
+    aJson.EndObject();
+    return KErrorNone;
+    }
+
+} // namespace
+
+int main(int aArgc,char** aArgv)
+    {
+    CCommandLine command_line(aArgc,aArgv);
+    std::string map = command_line.Get("map",KDefaultMap);
+    CJsonWriter json;
+    WriteHeader(json,"routing",map);
+    json.Write("seed",double(command_line.GetInt("seed",1)));
+
+    std::string routers = "," + command_line.Get("routers","StandardAStar,TurnExpandedAStar,StandardContractionHierarchy,TECH") + ",";
+    std::unique_ptr<CRoutingPoints> points;
+    json.BeginObject("routers");
+    TResult error;
+    for (const auto& r : KRouterType)
+        {
+        if (routers.find(std::string(",") + r.first + ",") == std::string::npos)
+            continue;
+        error = RunRouter(json,command_line,r.first,r.second,points);
+        if (error)
+            break;
+        }
+    json.EndObject();
+
+    json.Write("peak_memory_bytes",double(PeakMemoryBytes()));
+    json.Write("error",double(uint32_t(error)));
+    if (error)
+        json.Write("error_string",ErrorString(error));
+    json.EndObject();
+    int result = WriteResults(command_line,json);
+    return error ? 2 : result;
+    }
@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Routing benchmark
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = routing_benchmark
+
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+DEFINES += NDEBUG
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += routing_benchmark.cpp
+
+HEADERS += benchmark_util.h
+
+include(benchmark_libs.pri)
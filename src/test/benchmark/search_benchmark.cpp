@@ -0,0 +1,380 @@
+/*
+search_benchmark.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+A search and geocoding benchmark. It runs a recorded corpus of queries (by default
+search_corpus.txt) using FindText, Find, FindAddress, incremental FindAddressPart
+and GetAddress, once for each text index level from -1 to 5, and reports
+throughput, latency percentiles per category and the approximate memory used by each
+text index level as JSON. FindText queries are run with every combination of
+string matching flags.
+
+The memory used by a text index level is measured as the growth of the resident set size while the
+framework is created. It is approximate: memory freed by earlier levels and still held by the allocator
+is reused without being counted, and pages are counted only when first touched. Run a single level at a time,
+using --levels, for a more reliable figure.
+
+Usage: search_benchmark [--map=file] [--font=file] [--corpus=file] [--levels=a,b]
+                        [--iterations=n] [--max_objects=n] [--out=file]
+*/
+
+#include "benchmark_util.h"
+
+#include <fstream>
+
+using namespace CartoType;
+using namespace Benchmark;
+
+namespace
+{
+
+/** A query from the corpus: the category followed by its fields. */
+using TQuery = std::vector<std::string>;
+
+/** The queries in the corpus, indexed by category. */
+using CCorpus = std::map<std::string,std::vector<TQuery>>;
+
+constexpr int32_t KMinTextIndexLevel = -1;
+constexpr int32_t KMaxTextIndexLevel = 5;
+constexpr unsigned KStringMatchFlagCombinations = 64;
+
+// Half the width and height, in degrees, of the clip rectangle used by Find.
+constexpr double KClipSize = 0.02;
+
+std::vector<std::string> Split(const std::string& aText,char aSeparator)
+    {
+    std::vector<std::string> field;
+    size_t start = 0;
+    for (;;)
+        {
+        size_t end = aText.find(aSeparator,start);
+        field.push_back(aText.substr(start,end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos)
+            break;
+        start = end + 1;
+        }
+    return field;
+    }
+
+// Reads the corpus, padding each query with empty fields so that every category has all the fields it uses.
+TResult ReadCorpus(CCorpus& aCorpus,const std::string& aFileName)
+    {
+    std::ifstream file(aFileName);
+    if (!file)
+        return KErrorNotFound;
+    std::string line;
+    while (std::getline(file,line))
+        {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        TQuery query = Split(line,'\t');
+        std::string category = query[0];
+        query.erase(query.begin());
+        query.resize(std::max(query.size(),size_t(4)));
+        aCorpus[category].push_back(query);
+        }
+    return KErrorNone;
+    }
+
+// The name of a set of string matching flags, such as "prefix+fold_case", or "exact" if there are no flags.
+std::string StringMatchMethodName(unsigned aFlags)
+    {
+    static const char* const flag_name[] = { "prefix", "ignore_symbols", "fold_accents", "fuzzy", "fold_case", "ignore_whitespace" };
+    std::string name;
+    for (unsigned i = 0; i < 6; i++)
+        if (aFlags & (1 << i))
+            {
+            if (!name.empty())
+                name += '+';
+            name += flag_name[i];
+            }
+    return name.empty() ? "exact" : name;
+    }
+
+TAddressPart AddressPart(const std::string& aName)
+    {
+    static const std::pair<const char*,TAddressPart> part[] =
+        {
+        { "building", TAddressPart::Building }, { "feature", TAddressPart::Feature }, { "street", TAddressPart::Street },
+        { "sublocality", TAddressPart::SubLocality }, { "locality", TAddressPart::Locality }, { "island", TAddressPart::Island },
+        { "subadminarea", TAddressPart::SubAdminArea }, { "adminarea", TAddressPart::AdminArea }, { "country", TAddressPart::Country },
+        { "postcode", TAddressPart::PostCode }
+        };
+    for (const auto& p : part)
+        if (aName == p.first)
+            return p.second;
+    return TAddressPart::Street;
+    }
+
+/**
+The latency of the queries in a category, and counts of the queries that
+found something, found nothing, or failed with an error.
+*/
+class CCategoryResult
+    {
+    public:
+    void Add(double aSeconds,TResult aError,size_t aObjectCount)
+        {
+        iLatency.Add(aSeconds);
+        if (aError && aError != KErrorNotFound)
+            iErrorCount++;
+        else if (aObjectCount == 0)
+            iEmptyCount++;
+        iObjectCount += aObjectCount;
+        }
+    void Write(CJsonWriter& aJson,const char* aName)
+        {
+        aJson.BeginObject(aName);
+        aJson.WriteLatency(iLatency);
+        aJson.Write("objects_found",double(iObjectCount));
+        aJson.Write("empty_results",double(iEmptyCount));
+        aJson.Write("errors",double(iErrorCount));
+        aJson.EndObject();
+        }
+
+    CLatencySet iLatency;
+    size_t iObjectCount = 0;
+    size_t iEmptyCount = 0;
+    size_t iErrorCount = 0;
+    };
+
+class CSearchRunner
+    {
+    public:
+    CSearchRunner(CFramework& aFramework,const CCorpus& aCorpus,size_t aMaxObjectCount,int aIterations):
+        m_framework(aFramework),
+        m_corpus(aCorpus),
+        m_max_object_count(aMaxObjectCount),
+        m_iterations(aIterations)
+        {
+        m_framework.GetMapExtent(m_extent,TCoordType::Degree);
+        }
+
+    void Run(CJsonWriter& aJson)
+        {
+        RunText(aJson);
+        RunFind(aJson);
+        RunAddress(aJson);
+        RunAddressPart(aJson);
+        RunReverse(aJson);
+        }
+
+    private:
+    const std::vector<TQuery>& Queries(const char* aCategory)
+        {
+        static const std::vector<TQuery> empty;
+        auto p = m_corpus.find(aCategory);
+        return p == m_corpus.end() ? empty : p->second;
+        }
+
+    void RunText(CJsonWriter& aJson)
+        {
+        aJson.BeginObject("find_text");
+        CCategoryResult all;
+        for (unsigned flags = 0; flags < KStringMatchFlagCombinations; flags++)
+            {
+            auto method = TStringMatchMethod::FromFlags(flags);
+            CCategoryResult result;
+            for (int i = 0; i < m_iterations; i++)
+                for (const auto& q : Queries("text"))
+                    {
+                    CMapObjectArray found;
+                    TStopwatch stopwatch;
+                    TResult error = m_framework.FindText(found,m_max_object_count,q[0].c_str(),method,"","");
+                    double t = stopwatch.Elapsed();
+                    result.Add(t,error,found.size());
+                    all.Add(t,error,found.size());
+                    }
+            result.Write(aJson,StringMatchMethodName(flags).c_str());
+            }
+        all.Write(aJson,"all");
+        aJson.EndObject();
+        }
+
+    void RunFind(CJsonWriter& aJson)
+        {
+        static const char* const variant_name[] = { "plain", "clip", "location" };
+        TPointFP center = m_extent.Center();
+        TRectFP clip(center.iX - KClipSize,center.iY - KClipSize,center.iX + KClipSize,center.iY + KClipSize);
+
+        aJson.BeginObject("find");
+        CCategoryResult all;
+        for (int variant = 0; variant < 3; variant++)
+            {
+            CCategoryResult result;
+            for (int i = 0; i < m_iterations; i++)
+                for (const auto& q : Queries("find"))
+                    {
+                    TFindParam param;
+                    param.iMaxObjectCount = m_max_object_count;
+                    param.iText = q[0].c_str();
+                    param.iStringMatchMethod = TStringMatchMethod::Fuzzy;
+                    param.iLayers = q[1].c_str();
+                    param.iCondition = q[2].c_str();
+                    if (variant == 1)
+                        param.iClip = CGeometry(clip,TCoordType::Degree);
+                    else if (variant == 2)
+                        param.iLocation = CGeometry(center,TCoordType::Degree);
+                    CMapObjectArray found;
+                    TStopwatch stopwatch;
+                    TResult error = m_framework.Find(found,param);
+                    double t = stopwatch.Elapsed();
+                    result.Add(t,error,found.size());
+                    all.Add(t,error,found.size());
+                    }
+            result.Write(aJson,variant_name[variant]);
+            }
+        all.Write(aJson,"all");
+        aJson.EndObject();
+        }
+
+    void RunAddress(CJsonWriter& aJson)
+        {
+        aJson.BeginObject("find_address");
+        CCategoryResult all;
+        for (int fuzzy = 0; fuzzy < 2; fuzzy++)
+            {
+            CCategoryResult result;
+            for (int i = 0; i < m_iterations; i++)
+                for (const auto& q : Queries("address"))
+                    {
+                    CAddress address;
+                    address.iBuilding = q[0].c_str();
+                    address.iStreet = q[1].c_str();
+                    address.iLocality = q[2].c_str();
+                    address.iPostCode = q[3].c_str();
+                    CMapObjectArray found;
+                    TStopwatch stopwatch;
+                    TResult error = m_framework.FindAddress(found,m_max_object_count,address,fuzzy != 0);
+                    double t = stopwatch.Elapsed();
+                    result.Add(t,error,found.size());
+                    all.Add(t,error,found.size());
+                    }
+            result.Write(aJson,fuzzy ? "fuzzy" : "exact");
+            }
+        all.Write(aJson,"all");
+        aJson.EndObject();
+        }
+
+    // Runs each address part query as a user would type it, one character at a time.
+    void RunAddressPart(CJsonWriter& aJson)
+        {
+        aJson.BeginObject("find_address_part");
+        CCategoryResult result;
+        CCategoryResult sequence;
+        for (int i = 0; i < m_iterations; i++)
+            for (const auto& q : Queries("part"))
+                {
+                TAddressPart part = AddressPart(q[0]);
+                const std::string& text = q[1];
+                TStopwatch sequence_stopwatch;
+                size_t found_count = 0;
+                TResult sequence_error = KErrorNone;
+                for (size_t length = 1; length <= text.length(); length++)
+                    {
+                    CMapObjectArray found;
+                    TStopwatch stopwatch;
+                    TResult error = m_framework.FindAddressPart(found,m_max_object_count,text.substr(0,length).c_str(),part,false,true);
+                    result.Add(stopwatch.Elapsed(),error,found.size());
+                    found_count = found.size();
+                    if (error && error != KErrorNotFound)
+                        sequence_error = error;
+                    }
+                sequence.Add(sequence_stopwatch.Elapsed(),sequence_error,found_count);
+                }
+        result.Write(aJson,"keystroke");
+        sequence.Write(aJson,"sequence");
+        aJson.EndObject();
+        }
+
+    void RunReverse(CJsonWriter& aJson)
+        {
+        CCategoryResult result;
+        for (int i = 0; i < m_iterations; i++)
+            for (const auto& q : Queries("reverse"))
+                {
+                CAddress address;
+                TStopwatch stopwatch;
+                TResult error = m_framework.GetAddress(address,atof(q[0].c_str()),atof(q[1].c_str()),TCoordType::Degree);
+                double t = stopwatch.Elapsed();
+                result.Add(t,error,error ? 0 : 1);
+                }
+        result.Write(aJson,"get_address");
+        }
+
+    CFramework& m_framework;
+    const CCorpus& m_corpus;
+    size_t m_max_object_count;
+    int m_iterations;
+    TRectFP m_extent;
+    };
+
+TResult RunLevel(CJsonWriter& aJson,const CCommandLine& aCommandLine,const CCorpus& aCorpus,int32_t aTextIndexLevels)
+    {
+    uint64_t memory_before = CurrentMemoryBytes();
+    TStopwatch stopwatch;
+    TResult error;
+    auto framework = CreateFramework(error,aCommandLine,KDefaultStyleSheet,512,512,aTextIndexLevels);
+    if (error)
+        return error;
+    double startup = stopwatch.Elapsed();
+    uint64_t memory_after = CurrentMemoryBytes();
+
+    aJson.BeginObject(std::to_string(aTextIndexLevels).c_str());
+    aJson.Write("startup_ms",startup * 1000);
+    aJson.Write("approximate_memory_bytes",double(memory_after > memory_before ? memory_after - memory_before : 0));
+    CSearchRunner runner(*framework,aCorpus,size_t(aCommandLine.GetInt("max_objects",100)),aCommandLine.GetInt("iterations",1));
+    runner.Run(aJson);
+    aJson.Write("memory_after_run_bytes",double(CurrentMemoryBytes()));
+    aJson.EndObject();
+    return KErrorNone;
+    }
+
+} // namespace
+
+int main(int aArgc,char** aArgv)
+    {
+    CCommandLine command_line(aArgc,aArgv);
+    std::string map = command_line.Get("map",KDefaultMap);
+    CJsonWriter json;
+    WriteHeader(json,"search",map);
+    json.Write("iterations",double(command_line.GetInt("iterations",1)));
+    json.Write("max_objects",double(command_line.GetInt("max_objects",100)));
+
+    CCorpus corpus;
+    std::string corpus_file = command_line.Get("corpus","search_corpus.txt");
+    json.Write("corpus",corpus_file);
+    TResult error = ReadCorpus(corpus,corpus_file);
+    for (const auto& p : corpus)
+        json.Write((p.first + "_queries").c_str(),double(p.second.size()));
+
+    std::vector<int32_t> level_array;
+    std::string levels = command_line.Get("levels","");
+    if (levels.empty())
+        {
+        for (int32_t level = KMinTextIndexLevel; level <= KMaxTextIndexLevel; level++)
+            level_array.push_back(level);
+        }
+    else
+        {
+        for (const auto& level : Split(levels,','))
+            if (!level.empty())
+                level_array.push_back(atoi(level.c_str()));
+        }
+
+    json.BeginObject("text_index_levels");
+    for (size_t i = 0; !error && i < level_array.size(); i++)
+        error = RunLevel(json,command_line,corpus,level_array[i]);
+    json.EndObject();
+
+    json.Write("peak_memory_bytes",double(PeakMemoryBytes()));
+    json.Write("error",double(uint32_t(error)));
+    if (error)
+        json.Write("error_string",ErrorString(error));
+    json.EndObject();
+    int result = WriteResults(command_line,json);
+    return error ? 2 : result;
+    }
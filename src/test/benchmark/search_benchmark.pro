@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Search and geocoding benchmark
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = search_benchmark
+
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+DEFINES += NDEBUG
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += search_benchmark.cpp
+
+HEADERS += benchmark_util.h
+
+OTHER_FILES += search_corpus.txt
+
+include(benchmark_libs.pri)
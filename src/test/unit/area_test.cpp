@@ -0,0 +1,189 @@
+/*
+area_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests the vectorizable area and length functions: Area for separate x and y arrays and GetAreas agree with
+Area(const point_t*,size_t); GetSphericalAreaAndLength gives the exact area of a region bounded by meridians
+and parallels and the same lengths as GreatCircleDistanceInMeters; and GetSphericalAreasAndLengths gives
+the same results with any number of threads.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_area.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+bool Near(double aA,double aB,double aRelativeTolerance)
+    {
+    return std::fabs(aA - aB) <= aRelativeTolerance * std::max(std::fabs(aA),std::fabs(aB)) + 1e-12;
+    }
+
+// Random star-shaped polygons with from 3 to 300 points, some far from the origin, stored as contours of TPointFP and as separate arrays.
+class TPolygonSet
+    {
+    public:
+    explicit TPolygonSet(size_t aCount)
+        {
+        std::mt19937 random(3);
+        std::uniform_real_distribution<double> unit(0,1);
+        for (size_t i = 0; i < aCount; i++)
+            {
+            size_t n = 3 + size_t(random() % 298);
+            double cx = i % 3 ? unit(random) * 1000 : 1e7 + unit(random) * 1000;
+            double cy = unit(random) * 1000;
+            std::vector<TPointFP> contour;
+            for (size_t k = 0; k < n; k++)
+                {
+                double angle = 2 * KPiDouble * double(k) / double(n);
+                double r = 10 + unit(random) * 100;
+                contour.push_back(TPointFP(cx + r * std::cos(angle),cy + r * std::sin(angle)));
+                iX.push_back(contour.back().iX);
+                iY.push_back(contour.back().iY);
+                }
+            iContour.push_back(contour);
+            iContourEnd.push_back(iX.size());
+            }
+        }
+
+    std::vector<std::vector<TPointFP>> iContour;
+    std::vector<double> iX;
+    std::vector<double> iY;
+    std::vector<size_t> iContourEnd;
+    };
+
+void TestPlanarArea()
+    {
+    TPolygonSet polygons(200);
+    std::vector<double> area(polygons.iContour.size());
+    double total = GetAreas(polygons.iX.data(),polygons.iY.data(),polygons.iContourEnd.data(),polygons.iContour.size(),area.data());
+    double expected_total = 0;
+    bool same = true;
+    for (size_t i = 0; i < polygons.iContour.size(); i++)
+        {
+        const auto& contour = polygons.iContour[i];
+        double expected = Area(contour.data(),contour.size());
+        size_t start = i ? polygons.iContourEnd[i - 1] : 0;
+        same = same && Near(Area(polygons.iX.data() + start,polygons.iY.data() + start,contour.size()),expected,1e-9);
+        same = same && Near(area[i],expected,1e-9) && expected > 0;
+        expected_total += std::fabs(expected);
+
+        // Reversing a polygon negates its area.
+        std::vector<double> rx(polygons.iX.begin() + start,polygons.iX.begin() + start + contour.size());
+        std::vector<double> ry(polygons.iY.begin() + start,polygons.iY.begin() + start + contour.size());
+        std::reverse(rx.begin(),rx.end());
+        std::reverse(ry.begin(),ry.end());
+        same = same && Near(Area(rx.data(),ry.data(),rx.size()),-expected,1e-9);
+        }
+    UNIT_TEST_CHECK(same);
+    UNIT_TEST_CHECK(Near(total,expected_total,1e-12));
+
+    // Degenerate polygons.
+    double x[] = { 0, 1, 2 }, y[] = { 0, 1, 2 };
+    UNIT_TEST_CHECK(Area(x,y,2) == 0);
+    UNIT_TEST_CHECK(Area(x,y,3) == 0);
+    }
+
+void TestSphericalArea()
+    {
+    // A region bounded by two meridians and two parallels has the area R^2 * (long2 - long1) * (sin(lat2) - sin(lat1)).
+    // The edges along the parallels are great circles here, so use many points to follow the parallels closely.
+    std::vector<double> lng, lat;
+    const double long1 = 10, long2 = 12, lat1 = 50, lat2 = 51;
+    const int n = 2000;
+    for (int i = 0; i <= n; i++)
+        {
+        lng.push_back(long1 + (long2 - long1) * i / n);
+        lat.push_back(lat1);
+        }
+    for (int i = 0; i <= n; i++)
+        {
+        lng.push_back(long2 - (long2 - long1) * i / n);
+        lat.push_back(lat2);
+        }
+    double r = KEquatorialRadiusInMetres;
+    double expected_area = r * r * (long2 - long1) * KDegreesToRadiansDouble * (std::sin(lat2 * KDegreesToRadiansDouble) - std::sin(lat1 * KDegreesToRadiansDouble));
+    double area = 0, length = 0;
+    GetSphericalAreaAndLength(lng.data(),lat.data(),lng.size(),false,&area,&length);
+    UNIT_TEST_CHECK(Near(area,expected_area,1e-6));
+
+    // The lengths are the sums of the great-circle distances between successive points.
+    double expected_length = 0;
+    for (size_t i = 0; i < lng.size(); i++)
+        {
+        size_t j = (i + 1) % lng.size();
+        expected_length += GreatCircleDistanceInMeters(lng[i],lat[i],lng[j],lat[j]);
+        }
+    UNIT_TEST_CHECK(Near(length,expected_length,1e-9));
+    double polyline_length = 0;
+    GetSphericalAreaAndLength(lng.data(),lat.data(),lng.size(),true,&area,&polyline_length);
+    UNIT_TEST_CHECK(area == 0);
+    UNIT_TEST_CHECK(Near(polyline_length,expected_length - GreatCircleDistanceInMeters(lng.back(),lat.back(),lng[0],lat[0]),1e-9));
+
+    // Small polygons, which use the buffer on the stack, match the planar area in metres near the equator.
+    double x[] = { 0, 0.001, 0.001, 0 }, y[] = { 0, 0, 0.001, 0.001 };
+    GetSphericalAreaAndLength(x,y,4,false,&area,nullptr);
+    double side = r * 0.001 * KDegreesToRadiansDouble;
+    UNIT_TEST_CHECK(Near(area,side * side,1e-6));
+    }
+
+void TestThreads()
+    {
+    // Polygons of a few hundred metres in degrees.
+    TPolygonSet polygons(2000);
+    std::vector<double> lng(polygons.iX.size()), lat(polygons.iY.size());
+    for (size_t i = 0; i < lng.size(); i++)
+        {
+        lng[i] = std::fmod(polygons.iX[i],1000) * 1e-4 - 0.05;
+        lat[i] = polygons.iY[i] * 1e-4 + 51;
+        }
+    size_t count = polygons.iContour.size();
+    std::vector<double> area1(count), length1(count);
+    double total1 = GetSphericalAreasAndLengths(lng.data(),lat.data(),polygons.iContourEnd.data(),count,false,area1.data(),length1.data(),1);
+    double expected_total = 0;
+    bool same = true;
+    for (size_t i = 0; i < count; i++)
+        {
+        size_t start = i ? polygons.iContourEnd[i - 1] : 0;
+        double area = 0, length = 0;
+        GetSphericalAreaAndLength(lng.data() + start,lat.data() + start,polygons.iContourEnd[i] - start,false,&area,&length);
+        same = same && area == area1[i] && length == length1[i];
+        expected_total += area;
+        }
+    UNIT_TEST_CHECK(same);
+    UNIT_TEST_CHECK(Near(total1,expected_total,1e-12));
+
+    for (size_t threads : { size_t(0), size_t(3), size_t(64) })
+        {
+        std::vector<double> area(count), length(count);
+        double total = GetSphericalAreasAndLengths(lng.data(),lat.data(),polygons.iContourEnd.data(),count,false,area.data(),length.data(),threads);
+        UNIT_TEST_CHECK(area == area1);
+        UNIT_TEST_CHECK(length == length1);
+        UNIT_TEST_CHECK(Near(total,total1,1e-12));
+        }
+
+    // Either result array may be null.
+    std::vector<double> area(count);
+    GetSphericalAreasAndLengths(lng.data(),lat.data(),polygons.iContourEnd.data(),count,false,area.data(),nullptr,4);
+    UNIT_TEST_CHECK(area == area1);
+    UNIT_TEST_CHECK(GetSphericalAreasAndLengths(lng.data(),lat.data(),polygons.iContourEnd.data(),0,false,nullptr,nullptr) == 0);
+    }
+
+} // namespace
+
+int main()
+    {
+    TestPlanarArea();
+    TestSphericalArea();
+    TestThreads();
+    return UnitTest::Result("area_test");
+    }
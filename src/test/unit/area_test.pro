@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Unit test for the area and length functions
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = area_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += area_test.cpp
+
+HEADERS += unit_test_util.h
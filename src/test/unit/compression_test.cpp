@@ -0,0 +1,221 @@
+/*
+compression_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests CCompressedBlockReader: a table written by CCompressedBlockReader::Write reads back correctly,
+and tables with corrupt headers or block offsets are rejected with KErrorCorrupt, without
+allocating memory according to the corrupt values. Also tests that Lz4DecompressBlock decodes blocks
+produced by the reference LZ4 implementation.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_compression.h>
+
+#include <string>
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+class CStringOutputStream: public MOutputStream
+    {
+    public:
+    void Write(const uint8_t* aBuffer,size_t aBytes) override { iText.append((const char*)aBuffer,aBytes); }
+    std::string iText;
+    };
+
+// A memory input stream returning at most 7 bytes at a time, so that reads are split across calls.
+class CSmallReadInputStream: public MInputStream
+    {
+    public:
+    explicit CSmallReadInputStream(const std::string& aData): iData(aData) { }
+
+    void Read(const uint8_t*& aPointer,size_t& aLength) override
+        {
+        aPointer = (const uint8_t*)iData.data() + iPosition;
+        aLength = std::min(iData.size() - iPosition,size_t(7));
+        iPosition += aLength;
+        }
+    bool EndOfStream() const override { return iPosition >= iData.size(); }
+    void Seek(int64_t aPosition) override
+        {
+        if (aPosition < 0 || uint64_t(aPosition) > iData.size())
+            throw KErrorEndOfData;
+        iPosition = size_t(aPosition);
+        }
+    int64_t Position() override { return int64_t(iPosition); }
+    int64_t Length() override { return int64_t(iData.size()); }
+    std::string Name() override { return "compression_test"; }
+
+    private:
+    std::string iData;
+    size_t iPosition = 0;
+    };
+
+const uint32_t KBlockSize = 256;
+
+std::vector<uint8_t> TestData()
+    {
+    std::vector<uint8_t> data(KBlockSize * 4 + 100);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint8_t((i / 16) % 7 + (i % 3));
+    return data;
+    }
+
+std::string WriteTable(const std::vector<uint8_t>& aData)
+    {
+    CStringOutputStream output;
+    TResult error = CCompressedBlockReader::Write(output,aData.data(),aData.size(),TBlockCompression::LZ4,KBlockSize);
+    UNIT_TEST_CHECK(error == KErrorNone);
+    return output.iText;
+    }
+
+void SetLE(std::string& aTable,size_t aOffset,uint64_t aValue,size_t aBytes)
+    {
+    for (size_t i = 0; i < aBytes; i++)
+        aTable[aOffset + i] = char(uint8_t(aValue >> (8 * i)));
+    }
+
+TResult Open(const std::string& aTable)
+    {
+    CSmallReadInputStream input(aTable);
+    TResult error;
+    auto reader = CCompressedBlockReader::New(error,input,0,std::make_shared<CBlockCache>());
+    UNIT_TEST_CHECK((reader != nullptr) == (error == KErrorNone));
+    return error;
+    }
+
+void TestRoundTrip()
+    {
+    auto data = TestData();
+    std::string table = WriteTable(data);
+    CSmallReadInputStream input(table);
+    TResult error;
+    auto reader = CCompressedBlockReader::New(error,input,0,std::make_shared<CBlockCache>());
+    UNIT_TEST_CHECK(error == KErrorNone);
+    if (!reader)
+        return;
+    UNIT_TEST_CHECK(reader->BlockCount() == 5);
+    std::vector<uint8_t> output(data.size());
+    UNIT_TEST_CHECK(reader->Read(0,output.data(),output.size()) == KErrorNone);
+    UNIT_TEST_CHECK(output == data);
+    }
+
+// Blocks produced by the reference LZ4 implementation (lz4 1.9.4, lz4 -9 -BD, taken from the frame), and the data they decode to.
+const uint8_t KLz4Block1[] =
+    {
+    0xAF, 0x43, 0x61, 0x72, 0x74, 0x6F, 0x54, 0x79, 0x70, 0x65, 0x20, 0x0A, 0x00, 0x01, 0xDF, 0x6D, 0x61, 0x70, 0x20, 0x64, 0x61,
+    0x74, 0x61, 0x3A, 0x20, 0x61, 0x62, 0x63, 0x03, 0x00, 0x05, 0xA0, 0x2C, 0x20, 0x74, 0x68, 0x65, 0x20, 0x65, 0x6E, 0x64, 0x2E
+    };
+const char KLz4Text1[] = "CartoType CartoType CartoType map data: abcabcabcabcabcabcabcabcabc, the end.";
+
+// Long literal and match lengths, an overlapping match with an offset of 1, and a distant match.
+const uint8_t KLz4Block2[] =
+    {
+    0xFF, 0x06, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x7A, 0x01, 0x00, 0xFF, 0x19, 0x0F, 0x40, 0x01, 0x01, 0x50, 0x20, 0x74, 0x61, 0x69, 0x6C
+    };
+std::string Lz4Text2()
+    {
+    return "0123456789ABCDEFGHIJ" + std::string(300,'z') + "0123456789ABCDEFGHIJ tail";
+    }
+
+void TestReferenceBlock(const uint8_t* aBlock,size_t aLength,const std::string& aExpected)
+    {
+    std::vector<uint8_t> output(aExpected.size());
+    size_t output_length = 0;
+    UNIT_TEST_CHECK(Lz4DecompressBlock(aBlock,aLength,output.data(),output.size(),output_length) == KErrorNone);
+    UNIT_TEST_CHECK(output_length == aExpected.size());
+    UNIT_TEST_CHECK(std::string((const char*)output.data(),output_length) == aExpected);
+
+    // The output buffer must be large enough.
+    output_length = 0;
+    UNIT_TEST_CHECK(Lz4DecompressBlock(aBlock,aLength,output.data(),output.size() - 1,output_length) == KErrorCorrupt);
+
+    // Our own compressor must produce a block which decodes to the same data.
+    std::vector<uint8_t> compressed;
+    Lz4CompressBlock((const uint8_t*)aExpected.data(),aExpected.size(),compressed);
+    UNIT_TEST_CHECK(Lz4DecompressBlock(compressed.data(),compressed.size(),output.data(),output.size(),output_length) == KErrorNone);
+    UNIT_TEST_CHECK(std::string((const char*)output.data(),output_length) == aExpected);
+    }
+
+void TestReferenceBlocks()
+    {
+    TestReferenceBlock(KLz4Block1,sizeof(KLz4Block1),KLz4Text1);
+    TestReferenceBlock(KLz4Block2,sizeof(KLz4Block2),Lz4Text2());
+    }
+
+void TestCorruptHeaders()
+    {
+    const std::string table = WriteTable(TestData());
+    const size_t offset_table = 24;
+    std::string t;
+
+    // zero block size
+    t = table;
+    SetLE(t,8,0,4);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+
+    // a total length giving a block count that overflows, or an offset table larger than the stream
+    t = table;
+    SetLE(t,8,1,4);
+    SetLE(t,12,UINT64_MAX,8);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+    t = table;
+    SetLE(t,12,uint64_t(KBlockSize) * 1000000,8);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+
+    // a dictionary larger than the stream, or a dictionary for LZ4
+    t = table;
+    SetLE(t,20,0xFFFFFFFF,4);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+    t = table;
+    SetLE(t,20,8,4);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+
+    // an unknown compression method
+    t = table;
+    t[4] = 99;
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+
+    // offsets that go backwards, point outside the stream, overlap the offset table, or give blocks larger than the block size
+    t = table;
+    SetLE(t,offset_table + 16,0,8);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+    t = table;
+    SetLE(t,offset_table + 5 * 8,table.size() + 1,8);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+    t = table;
+    SetLE(t,offset_table,0,8);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+    t = table;
+    SetLE(t,offset_table + 8,offset_table + 6 * 8 + KBlockSize + 1,8);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+
+    // a truncated stream
+    t = table.substr(0,table.size() - 1);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+    t = table.substr(0,offset_table + 10);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+    t = table.substr(0,10);
+    UNIT_TEST_CHECK(Open(t) == KErrorCorrupt);
+
+    // the wrong signature is not a compressed block table at all
+    t = table;
+    t[0] = 'X';
+    UNIT_TEST_CHECK(Open(t) == KErrorUnknownDataFormat);
+    }
+
+} // namespace
+
+int main()
+    {
+    TestRoundTrip();
+    TestCorruptHeaders();
+    TestReferenceBlocks();
+    return UnitTest::Result("compression_test");
+    }
@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Unit test for CCompressedBlockReader
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = compression_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += compression_test.cpp
+
+HEADERS += unit_test_util.h
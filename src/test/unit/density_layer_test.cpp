@@ -0,0 +1,156 @@
+/*
+density_layer_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests CDensityLayer: the density is drawn with row 0 at the northern (maximum y) edge and column 0
+at the western edge, points outside the extent are ignored, negative weights remove points,
+areas outside the extent are drawn transparent, and the pyramid stops before cell sizes overflow.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_density_layer.h>
+
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+// Returns the position of the densest pixel, by drawing with a ramp which increases in red.
+void DensestPixel(const CDensityLayer& aLayer,const TRect& aBounds,int32_t aSize,int32_t& aX,int32_t& aY)
+    {
+    std::vector<uint32_t> pixels;
+    aLayer.Draw(pixels,aBounds,aSize,aSize);
+    aX = aY = -1;
+    int32_t best = -1;
+    for (int32_t y = 0; y < aSize; y++)
+        for (int32_t x = 0; x < aSize; x++)
+            {
+            int32_t red = TColor(pixels[size_t(y) * aSize + x]).Red();
+            if (red > best)
+                {
+                best = red;
+                aX = x;
+                aY = y;
+                }
+            }
+    }
+
+TDensityLayerParam Param()
+    {
+    TDensityLayerParam param;
+    param.iExtent = TRect(0,0,10000,10000);
+    param.iFinestCellSize = 100;
+    param.iRadiusInPixels = 2;
+    param.iColorRamp = { TColor(0,0,0,255),TColor(255,0,0,255) };
+    return param;
+    }
+
+void TestOrientation()
+    {
+    CDensityLayer layer("density",Param());
+
+    // A cluster of points in the north-west of the extent: small x, large y.
+    std::vector<TPoint> points(50,TPoint(2050,8050));
+    layer.AddPoints(points.data(),nullptr,points.size());
+    UNIT_TEST_CHECK(layer.TotalWeight() == 50);
+    int32_t x = 0, y = 0;
+    DensestPixel(layer,TRect(0,0,10000,10000),100,x,y);
+    UNIT_TEST_CHECK(x >= 19 && x <= 21);
+    UNIT_TEST_CHECK(y >= 18 && y <= 20); // (10000 - 8050) / 100 = 19.5
+
+    // Drawing a part of the extent puts the cluster at the corresponding place.
+    DensestPixel(layer,TRect(2000,5000,7000,10000),50,x,y);
+    UNIT_TEST_CHECK(x >= 0 && x <= 1);
+    UNIT_TEST_CHECK(y >= 18 && y <= 20);
+
+    // Non-square pixels.
+    std::vector<uint32_t> pixels;
+    layer.Draw(pixels,TRect(0,0,10000,10000),200,50);
+    UNIT_TEST_CHECK(pixels.size() == 200 * 50);
+    int32_t best_x = -1, best_y = -1, best = -1;
+    for (int32_t py = 0; py < 50; py++)
+        for (int32_t px = 0; px < 200; px++)
+            if (TColor(pixels[size_t(py) * 200 + px]).Red() > best)
+                {
+                best = TColor(pixels[size_t(py) * 200 + px]).Red();
+                best_x = px;
+                best_y = py;
+                }
+    UNIT_TEST_CHECK(best_x >= 38 && best_x <= 43);
+    UNIT_TEST_CHECK(best_y >= 8 && best_y <= 11);
+    }
+
+void TestWeights()
+    {
+    CDensityLayer layer("density",Param());
+    TPoint points[] = { TPoint(5000,5000), TPoint(-1,5000), TPoint(5000,10000), TPoint(10000,0), TPoint(9999,9999) };
+    float weights[] = { 2, 100, 100, 100, 3 };
+    layer.AddPoints(points,weights,5);
+    UNIT_TEST_CHECK(layer.TotalWeight() == 5); // the three points outside the extent are ignored
+
+    std::vector<uint32_t> pixels;
+    float max_density = layer.Draw(pixels,TRect(0,0,10000,10000),64,64);
+    UNIT_TEST_CHECK(max_density > 0);
+    UNIT_TEST_CHECK(layer.Draw(pixels,TRect(0,0,10000,10000),64,64,1000) == 1000);
+
+    // Negative weights remove the points again.
+    float negative[] = { -2, 0, 0, 0, -3 };
+    layer.AddPoints(points,negative,5);
+    UNIT_TEST_CHECK(layer.TotalWeight() == 0);
+    layer.Draw(pixels,TRect(0,0,10000,10000),64,64);
+    bool transparent = true;
+    for (uint32_t p : pixels)
+        transparent = transparent && p == 0;
+    UNIT_TEST_CHECK(transparent);
+
+    // Areas far outside the extent are transparent and take no time however large they are.
+    layer.AddPoints(points,weights,1);
+    layer.Draw(pixels,TRect(1000000,1000000,2000000,2000000),64,64);
+    transparent = true;
+    for (uint32_t p : pixels)
+        transparent = transparent && p == 0;
+    UNIT_TEST_CHECK(transparent);
+    layer.Draw(pixels,TRect(INT32_MIN / 2,INT32_MIN / 2,INT32_MAX / 2,INT32_MAX / 2),64,64);
+    transparent = true;
+    for (uint32_t p : pixels)
+        transparent = transparent && p == 0;
+    UNIT_TEST_CHECK(!transparent);
+
+    layer.Clear();
+    UNIT_TEST_CHECK(layer.TotalWeight() == 0);
+    UNIT_TEST_CHECK(layer.Draw(pixels,TRect(0,0,10000,10000),0,64) == 0);
+    UNIT_TEST_CHECK(pixels.empty());
+    }
+
+void TestLevels()
+    {
+    TDensityLayerParam param;
+    param.iExtent = TRect(0,0,102400,51200);
+    param.iFinestCellSize = 100;
+    CDensityLayer layer("density",param);
+    UNIT_TEST_CHECK(layer.LevelCount() == 11); // 1024 by 512 cells halved down to 1 by 1
+
+    // Large finest cells: the next cell size would overflow an int32_t, so there is only one level.
+    param.iExtent = TRect(0,0,INT32_MAX,INT32_MAX);
+    param.iFinestCellSize = 1 << 30;
+    CDensityLayer big("density",param);
+    UNIT_TEST_CHECK(big.LevelCount() == 1);
+    TPoint point(INT32_MAX - 1,INT32_MAX - 1);
+    big.AddPoints(&point,nullptr,1);
+    std::vector<uint32_t> pixels;
+    UNIT_TEST_CHECK(big.Draw(pixels,param.iExtent,16,16) > 0);
+    }
+
+} // namespace
+
+int main()
+    {
+    TestOrientation();
+    TestWeights();
+    TestLevels();
+    return UnitTest::Result("density_layer_test");
+    }
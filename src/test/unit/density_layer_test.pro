@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Unit test for CDensityLayer
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = density_layer_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += density_layer_test.cpp
+
+HEADERS += unit_test_util.h
+
+# CDensityLayer stores its name as a CString, which is implemented in the CartoType library.
+include(../benchmark/benchmark_libs.pri)
@@ -0,0 +1,217 @@
+/*
+edit_geometry_cache_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests CEditGeometryCache: moving, inserting or deleting a point recalculates only the chunk containing it,
+the display points are the transformed points of the object in order, simplified to within the tolerance,
+the current point and chunk ends are never removed, and the dirty area covers the changed segments.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_edit_geometry_cache.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+const TTransform KMapToDisplay(0.5,0,0,-0.5,100,900); // half scale, y flipped
+
+TPointFP ToDisplay(const TPointFP& aPoint)
+    {
+    double x = aPoint.iX, y = aPoint.iY;
+    KMapToDisplay.Transform(x,y);
+    return TPointFP(x,y);
+    }
+
+bool Contains(const TRectFP& aBounds,const TPointFP& aPoint)
+    {
+    return aPoint.iX >= aBounds.iTopLeft.iX && aPoint.iX <= aBounds.iBottomRight.iX &&
+           aPoint.iY >= aBounds.iTopLeft.iY && aPoint.iY <= aBounds.iBottomRight.iY;
+    }
+
+double DistanceToSegment(const TPointFP& aP,const TPointFP& aA,const TPointFP& aB)
+    {
+    double dx = aB.iX - aA.iX, dy = aB.iY - aA.iY;
+    double length_squared = dx * dx + dy * dy;
+    double t = length_squared == 0 ? 0 : ((aP.iX - aA.iX) * dx + (aP.iY - aA.iY) * dy) / length_squared;
+    t = std::max(0.0,std::min(t,1.0));
+    double ex = aA.iX + t * dx - aP.iX, ey = aA.iY + t * dy - aP.iY;
+    return std::sqrt(ex * ex + ey * ey);
+    }
+
+/*
+Checks that the display points are a subsequence of the transformed points, including the first and last,
+and that every transformed point is within the tolerance of the segment of the display points spanning it.
+*/
+bool IsValidSimplification(CEditGeometryCache& aCache,double aTolerance)
+    {
+    const auto& points = aCache.Points();
+    const auto& display = aCache.DisplayPoints();
+    if (points.empty())
+        return display.empty();
+    std::vector<size_t> index; // the index in points of each display point
+    size_t j = 0;
+    for (size_t i = 0; i < points.size() && j < display.size(); i++)
+        {
+        TPointFP p = ToDisplay(points[i]);
+        if (p.iX == display[j].iX && p.iY == display[j].iY)
+            {
+            index.push_back(i);
+            j++;
+            }
+        }
+    if (j != display.size() || index.front() != 0 || index.back() != points.size() - 1)
+        return false;
+    for (size_t k = 0; k + 1 < index.size(); k++)
+        for (size_t i = index[k] + 1; i < index[k + 1]; i++)
+            if (DistanceToSegment(ToDisplay(points[i]),display[k],display[k + 1]) > aTolerance + 1e-9)
+                return false;
+    return true;
+    }
+
+std::vector<TPointFP> Circle(size_t aCount)
+    {
+    std::vector<TPointFP> points;
+    for (size_t i = 0; i < aCount; i++)
+        {
+        double angle = 2 * 3.14159265358979 * double(i) / double(aCount);
+        points.push_back(TPointFP(1000 + 800 * std::cos(angle),1000 + 800 * std::sin(angle)));
+        }
+    return points;
+    }
+
+void TestIncremental()
+    {
+    const double tolerance = 0.25;
+    CEditGeometryCache cache(256);
+    cache.SetPoints(Circle(4000),true);
+    cache.SetTransform(KMapToDisplay,tolerance);
+    UNIT_TEST_CHECK(IsValidSimplification(cache,tolerance));
+    size_t chunk_count = cache.ChunksRecalculated();
+    UNIT_TEST_CHECK(chunk_count == 16); // 4000 points in chunks of 256
+    UNIT_TEST_CHECK(cache.DisplayPoints().size() < 4000);
+
+    // Nothing has changed, so nothing is recalculated.
+    cache.DisplayPoints();
+    cache.SetTransform(KMapToDisplay,tolerance);
+    cache.DisplayPoints();
+    UNIT_TEST_CHECK(cache.ChunksRecalculated() == chunk_count);
+
+    // Each edit recalculates only the chunk containing the point.
+    std::mt19937 random(5);
+    std::vector<TPointFP> expected = cache.Points();
+    for (int i = 0; i < 300; i++)
+        {
+        size_t before = cache.ChunksRecalculated();
+        size_t index = random() % expected.size();
+        TPointFP p(double(random() % 2000),double(random() % 2000));
+        switch (i % 4)
+            {
+            case 0:
+            case 1:
+                cache.MovePoint(index,p);
+                expected[index] = p;
+                break;
+            case 2:
+                cache.InsertPoint(index,p);
+                expected.insert(expected.begin() + index,p);
+                break;
+            default:
+                cache.DeletePoint(index);
+                expected.erase(expected.begin() + index);
+                break;
+            }
+        cache.DisplayPoints();
+        UNIT_TEST_CHECK(cache.ChunksRecalculated() - before == 1);
+        }
+    bool same = cache.Points().size() == expected.size();
+    for (size_t i = 0; same && i < expected.size(); i++)
+        same = cache.Points()[i].iX == expected[i].iX && cache.Points()[i].iY == expected[i].iY;
+    UNIT_TEST_CHECK(same);
+    UNIT_TEST_CHECK(IsValidSimplification(cache,tolerance));
+
+    // A new transform recalculates everything.
+    size_t before = cache.ChunksRecalculated();
+    cache.SetTransform(TTransform(1,0,0,1,0,0),tolerance);
+    cache.DisplayPoints();
+    UNIT_TEST_CHECK(cache.ChunksRecalculated() - before >= 15);
+    }
+
+void TestCurrentPoint()
+    {
+    // A straight line simplifies to the ends of its chunks, except for the current point.
+    std::vector<TPointFP> line;
+    for (int i = 0; i < 100; i++)
+        line.push_back(TPointFP(i * 10,500));
+    CEditGeometryCache cache(50);
+    cache.SetPoints(line,false);
+    cache.SetTransform(KMapToDisplay);
+    UNIT_TEST_CHECK(cache.DisplayPoints().size() == 4);
+    cache.SetCurrentPoint(20);
+    const auto& display = cache.DisplayPoints();
+    UNIT_TEST_CHECK(display.size() == 5);
+    bool found = false;
+    TPointFP current = ToDisplay(line[20]);
+    for (const auto& p : display)
+        found = found || (p.iX == current.iX && p.iY == current.iY);
+    UNIT_TEST_CHECK(found);
+
+    // Moving the current point leaves it exactly where it was put.
+    TPointFP moved(205,503);
+    cache.MovePoint(20,moved);
+    current = ToDisplay(moved);
+    found = false;
+    for (const auto& p : cache.DisplayPoints())
+        found = found || (p.iX == current.iX && p.iY == current.iY);
+    UNIT_TEST_CHECK(found);
+
+    cache.SetCurrentPoint(SIZE_MAX);
+    cache.MovePoint(20,line[20]);
+    UNIT_TEST_CHECK(cache.DisplayPoints().size() == 4);
+    }
+
+void TestDirtyBounds()
+    {
+    std::vector<TPointFP> points = { TPointFP(0,0), TPointFP(100,0), TPointFP(200,0), TPointFP(300,0), TPointFP(400,0) };
+    CEditGeometryCache cache;
+    cache.SetPoints(points,false);
+    cache.SetTransform(KMapToDisplay);
+    TRectFP bounds;
+    bool all = false;
+    UNIT_TEST_CHECK(cache.TakeDirtyBounds(bounds,all));
+    UNIT_TEST_CHECK(all);
+    UNIT_TEST_CHECK(!cache.TakeDirtyBounds(bounds,all));
+
+    // Moving point 2 changes the segments from point 1 to point 3.
+    cache.MovePoint(2,TPointFP(200,300));
+    UNIT_TEST_CHECK(cache.TakeDirtyBounds(bounds,all));
+    UNIT_TEST_CHECK(!all);
+    UNIT_TEST_CHECK(Contains(bounds,ToDisplay(TPointFP(100,0))));
+    UNIT_TEST_CHECK(Contains(bounds,ToDisplay(TPointFP(200,0))));
+    UNIT_TEST_CHECK(Contains(bounds,ToDisplay(TPointFP(200,300))));
+    UNIT_TEST_CHECK(Contains(bounds,ToDisplay(TPointFP(300,0))));
+    UNIT_TEST_CHECK(!Contains(bounds,ToDisplay(TPointFP(0,0))));
+    UNIT_TEST_CHECK(!Contains(bounds,ToDisplay(TPointFP(400,0))));
+
+    cache.DeletePoint(0);
+    UNIT_TEST_CHECK(cache.TakeDirtyBounds(bounds,all));
+    UNIT_TEST_CHECK(Contains(bounds,ToDisplay(TPointFP(0,0))));
+    UNIT_TEST_CHECK(cache.Points().size() == 4);
+    }
+
+} // namespace
+
+int main()
+    {
+    TestIncremental();
+    TestCurrentPoint();
+    TestDirtyBounds();
+    return UnitTest::Result("edit_geometry_cache_test");
+    }
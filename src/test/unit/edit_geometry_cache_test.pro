@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Unit test for CEditGeometryCache
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = edit_geometry_cache_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += edit_geometry_cache_test.cpp
+
+HEADERS += unit_test_util.h
+
+# CEditGeometryCache uses TTransform, which is implemented in the CartoType library.
+include(../benchmark/benchmark_libs.pri)
@@ -0,0 +1,185 @@
+/*
+moving_object_layer_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests CMovingObjectLayer: after random insertions, position updates and removals, Find returns
+exactly the objects a brute-force search finds, including those at negative coordinates and on the
+edges of the search area; Get returns the current state of each object; and TakeDirtyBounds
+covers the old and new positions of everything changed.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_moving_object_layer.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+bool Contains(const TRect& aBounds,const TPoint& aPoint)
+    {
+    return aPoint.iX >= aBounds.iTopLeft.iX && aPoint.iX <= aBounds.iBottomRight.iX &&
+           aPoint.iY >= aBounds.iTopLeft.iY && aPoint.iY <= aBounds.iBottomRight.iY;
+    }
+
+bool Same(const TMovingObject& aA,const TMovingObject& aB)
+    {
+    return aA.iId == aB.iId && aA.iPosition == aB.iPosition && aA.iHeading == aB.iHeading && aA.iIconIndex == aB.iIconIndex;
+    }
+
+// Checks that Find returns the same objects as a brute-force search of aExpected.
+void CheckFind(const CMovingObjectLayer& aLayer,const std::map<uint64_t,TMovingObject>& aExpected,const TRect& aBounds)
+    {
+    std::vector<TMovingObject> found;
+    size_t n = aLayer.Find(found,aBounds);
+    UNIT_TEST_CHECK(n == found.size());
+    std::sort(found.begin(),found.end(),[](const TMovingObject& aA,const TMovingObject& aB) { return aA.iId < aB.iId; });
+    std::vector<TMovingObject> expected;
+    for (const auto& p : aExpected)
+        if (Contains(aBounds,p.second.iPosition))
+            expected.push_back(p.second);
+    bool same = found.size() == expected.size();
+    for (size_t i = 0; same && i < found.size(); i++)
+        same = Same(found[i],expected[i]);
+    UNIT_TEST_CHECK(same);
+    }
+
+void TestRandomUpdates()
+    {
+    const int32_t cell_size = 1000;
+    CMovingObjectLayer layer("vehicles",cell_size);
+    UNIT_TEST_CHECK(layer.Count() == 0);
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int32_t> coord(-20000,20000);
+    std::map<uint64_t,TMovingObject> expected;
+
+    for (uint64_t id = 1; id <= 2000; id++)
+        {
+        TMovingObject object;
+        object.iId = id * 3;
+        object.iPosition = TPoint(coord(random),coord(random));
+        object.iHeading = float(id % 360);
+        object.iIconIndex = uint32_t(id % 5);
+        layer.Insert(object);
+        expected[object.iId] = object;
+        }
+    UNIT_TEST_CHECK(layer.Count() == expected.size());
+
+    for (int round = 0; round < 20; round++)
+        {
+        // Move a batch of objects, some by small distances within their cells and some across the whole area, and include an id that does not exist.
+        std::vector<uint64_t> ids;
+        std::vector<TPoint> positions;
+        std::vector<float> headings;
+        for (auto& p : expected)
+            {
+            if (random() % 3)
+                continue;
+            TPoint pos = p.second.iPosition;
+            if (random() % 2)
+                pos = TPoint(coord(random),coord(random));
+            else
+                pos = TPoint(pos.iX + int32_t(random() % 21) - 10,pos.iY + int32_t(random() % 21) - 10);
+            ids.push_back(p.first);
+            positions.push_back(pos);
+            headings.push_back(float(random() % 360));
+            }
+        ids.push_back(1);
+        positions.push_back(TPoint(0,0));
+        headings.push_back(0);
+        bool with_headings = round % 2 == 0;
+        size_t updated = layer.UpdatePositions(ids.data(),positions.data(),with_headings ? headings.data() : nullptr,ids.size());
+        UNIT_TEST_CHECK(updated == ids.size() - 1);
+        for (size_t i = 0; i + 1 < ids.size(); i++)
+            {
+            expected[ids[i]].iPosition = positions[i];
+            if (with_headings)
+                expected[ids[i]].iHeading = headings[i];
+            }
+
+        // Remove some objects, which moves others into their places in the arrays, and insert some new ones.
+        for (int i = 0; i < 20 && !expected.empty(); i++)
+            {
+            auto p = expected.begin();
+            std::advance(p,random() % expected.size());
+            UNIT_TEST_CHECK(layer.Remove(p->first));
+            expected.erase(p);
+            }
+        UNIT_TEST_CHECK(!layer.Remove(2));
+        for (int i = 0; i < 10; i++)
+            {
+            TMovingObject object;
+            object.iId = 100000 + round * 10 + i;
+            object.iPosition = TPoint(coord(random),coord(random));
+            layer.Insert(object);
+            expected[object.iId] = object;
+            }
+
+        UNIT_TEST_CHECK(layer.Count() == expected.size());
+        CheckFind(layer,expected,TRect(-5000,-5000,5000,5000));
+        CheckFind(layer,expected,TRect(-20000,-20000,-15000,-15000));
+        CheckFind(layer,expected,TRect(INT32_MIN,INT32_MIN,INT32_MAX,INT32_MAX));
+        }
+
+    // Search areas whose edges pass exactly through objects.
+    const TMovingObject& edge = expected.begin()->second;
+    CheckFind(layer,expected,TRect(edge.iPosition.iX,edge.iPosition.iY,edge.iPosition.iX,edge.iPosition.iY));
+    CheckFind(layer,expected,TRect(edge.iPosition.iX - cell_size,edge.iPosition.iY,edge.iPosition.iX,edge.iPosition.iY + 2 * cell_size));
+
+    bool all_same = true;
+    for (const auto& p : expected)
+        {
+        TMovingObject object;
+        all_same = all_same && layer.Get(p.first,object) && Same(object,p.second);
+        }
+    UNIT_TEST_CHECK(all_same);
+    TMovingObject object;
+    UNIT_TEST_CHECK(!layer.Get(2,object));
+
+    layer.Clear();
+    UNIT_TEST_CHECK(layer.Count() == 0);
+    std::vector<TMovingObject> found;
+    UNIT_TEST_CHECK(layer.Find(found,TRect(INT32_MIN,INT32_MIN,INT32_MAX,INT32_MAX)) == 0);
+    }
+
+void TestDirtyBounds()
+    {
+    CMovingObjectLayer layer("vehicles",100);
+    TRect bounds;
+    UNIT_TEST_CHECK(!layer.TakeDirtyBounds(bounds));
+
+    TMovingObject object;
+    object.iId = 1;
+    object.iPosition = TPoint(10,20);
+    layer.Insert(object);
+    UNIT_TEST_CHECK(layer.TakeDirtyBounds(bounds));
+    UNIT_TEST_CHECK(Contains(bounds,TPoint(10,20)));
+    UNIT_TEST_CHECK(!layer.TakeDirtyBounds(bounds));
+
+    uint64_t id = 1;
+    TPoint position(-500,900);
+    layer.UpdatePositions(&id,&position,nullptr,1);
+    UNIT_TEST_CHECK(layer.TakeDirtyBounds(bounds));
+    UNIT_TEST_CHECK(Contains(bounds,TPoint(10,20)));
+    UNIT_TEST_CHECK(Contains(bounds,position));
+
+    layer.Remove(1);
+    UNIT_TEST_CHECK(layer.TakeDirtyBounds(bounds));
+    UNIT_TEST_CHECK(Contains(bounds,position));
+    }
+
+} // namespace
+
+int main()
+    {
+    TestRandomUpdates();
+    TestDirtyBounds();
+    return UnitTest::Result("moving_object_layer_test");
+    }
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Unit test for CMovingObjectLayer
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = moving_object_layer_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += moving_object_layer_test.cpp
+
+HEADERS += unit_test_util.h
+
+# CMovingObjectLayer stores its name as a CString, which is implemented in the CartoType library.
+include(../benchmark/benchmark_libs.pri)
@@ -0,0 +1,160 @@
+/*
+point_cluster_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests CPointClusterIndex: after random insertions, moves and removals, the clusters found at every level
+account for every point exactly once, each cluster's center is the centroid of the points in its cell,
+groups smaller than the minimum cluster count are returned as individual points, and every cluster
+and individual point is given the bounds of its grid cell.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_point_cluster.h>
+
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+bool Contains(const TRect& aBounds,const TPoint& aPoint)
+    {
+    return aPoint.iX >= aBounds.iTopLeft.iX && aPoint.iX <= aBounds.iBottomRight.iX &&
+           aPoint.iY >= aBounds.iTopLeft.iY && aPoint.iY <= aBounds.iBottomRight.iY;
+    }
+
+int64_t CellCoord(int32_t aValue,int32_t aCellSize)
+    {
+    return aValue >= 0 ? aValue / aCellSize : -1 - (-1 - int64_t(aValue)) / aCellSize;
+    }
+
+void TestTotals()
+    {
+    TPointClusterParam param;
+    param.iFinestCellSize = 100;
+    param.iLevelCount = 12;
+    param.iMinClusterCount = 3;
+    CPointClusterIndex index(param);
+    UNIT_TEST_CHECK(index.LevelCount() == 12);
+
+    std::mt19937 random(11);
+    std::uniform_int_distribution<int32_t> coord(-50000,50000);
+    std::map<uint64_t,TPoint> expected;
+    for (uint64_t id = 1; id <= 3000; id++)
+        {
+        TPoint p(coord(random),coord(random));
+        if (id % 10 == 0)
+            p = TPoint(1234,-5678); // many points at the same place
+        index.Insert(id,p);
+        expected[id] = p;
+        }
+    for (uint64_t id = 1; id <= 3000; id += 7)
+        {
+        TPoint p(coord(random),coord(random));
+        index.Insert(id,p);
+        expected[id] = p;
+        }
+    for (uint64_t id = 2; id <= 3000; id += 13)
+        {
+        UNIT_TEST_CHECK(index.Remove(id));
+        expected.erase(id);
+        }
+    UNIT_TEST_CHECK(!index.Remove(2));
+    UNIT_TEST_CHECK(index.Count() == expected.size());
+
+    const TRect everywhere(INT32_MIN,INT32_MIN,INT32_MAX,INT32_MAX);
+    for (int32_t level = -1; level < index.LevelCount(); level++)
+        {
+        int32_t cell_size = index.CellSize(level < 0 ? 0 : level);
+
+        // The points in each cell at this level, found by brute force.
+        std::map<std::pair<int64_t,int64_t>,std::vector<TPoint>> cells;
+        for (const auto& p : expected)
+            cells[{ CellCoord(p.second.iX,cell_size),CellCoord(p.second.iY,cell_size) }].push_back(p.second);
+
+        std::vector<TPointCluster> clusters;
+        size_t n = index.Find(clusters,everywhere,level);
+        UNIT_TEST_CHECK(n == clusters.size());
+        uint64_t total = 0;
+        bool all_valid = true;
+        for (const auto& c : clusters)
+            {
+            total += c.iCount;
+            bool in_cell = Contains(c.iCell,c.iCenter) &&
+                           c.iCell.iBottomRight.iX - c.iCell.iTopLeft.iX == cell_size &&
+                           c.iCell.iBottomRight.iY - c.iCell.iTopLeft.iY == cell_size;
+            const auto& points = cells[{ CellCoord(c.iCenter.iX,cell_size),CellCoord(c.iCenter.iY,cell_size) }];
+            bool valid = in_cell;
+            if (c.iCount == 1)
+                {
+                auto p = expected.find(c.iId);
+                valid = valid && p != expected.end() && p->second == c.iCenter;
+                }
+            else
+                {
+                int64_t sum_x = 0, sum_y = 0;
+                for (const auto& p : points)
+                    {
+                    sum_x += p.iX;
+                    sum_y += p.iY;
+                    }
+                valid = valid && level >= 0 && c.iCount >= param.iMinClusterCount && c.iCount == points.size() && c.iId == 0 &&
+                        std::abs(c.iCenter.iX - double(sum_x) / points.size()) <= 0.5 && std::abs(c.iCenter.iY - double(sum_y) / points.size()) <= 0.5;
+                }
+            all_valid = all_valid && valid;
+            }
+        UNIT_TEST_CHECK(all_valid);
+        UNIT_TEST_CHECK(total == expected.size());
+        }
+
+    // Individual points in part of the area.
+    const TRect bounds(-10000,-20000,15000,5000);
+    std::vector<TPointCluster> points;
+    index.Find(points,bounds,-1);
+    size_t count = 0;
+    for (const auto& p : expected)
+        if (Contains(bounds,p.second))
+            count++;
+    UNIT_TEST_CHECK(points.size() == count);
+
+    index.Clear();
+    UNIT_TEST_CHECK(index.Count() == 0);
+    points.clear();
+    UNIT_TEST_CHECK(index.Find(points,everywhere,3) == 0);
+    }
+
+void TestLevel()
+    {
+    TPointClusterParam param;
+    param.iFinestCellSize = 256;
+    param.iClusterRadiusInPixels = 32;
+    param.iLevelCount = 10;
+    CPointClusterIndex index(param);
+    UNIT_TEST_CHECK(index.Level(1) == -1); // a radius of 32 map units is smaller than the finest cells
+    UNIT_TEST_CHECK(index.Level(8) == 0);
+    UNIT_TEST_CHECK(index.Level(16) == 1);
+    UNIT_TEST_CHECK(index.Level(20) == 2);
+    UNIT_TEST_CHECK(index.Level(1e9) == 9);
+
+    // The number of levels is limited so that cell sizes fit into an int32_t.
+    param.iFinestCellSize = 1 << 20;
+    param.iLevelCount = 20;
+    CPointClusterIndex big(param);
+    UNIT_TEST_CHECK(big.LevelCount() == 11);
+    UNIT_TEST_CHECK(big.CellSize(big.LevelCount() - 1) == 1 << 30);
+    }
+
+} // namespace
+
+int main()
+    {
+    TestTotals();
+    TestLevel();
+    return UnitTest::Result("point_cluster_test");
+    }
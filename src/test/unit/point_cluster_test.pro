@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Unit test for CPointClusterIndex
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = point_cluster_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += point_cluster_test.cpp
+
+HEADERS += unit_test_util.h
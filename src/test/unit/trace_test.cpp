@@ -0,0 +1,162 @@
+/*
+trace_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests CTraceRecorder: spans recorded by several threads at once are all kept, the limit
+on the number of spans is obeyed, and the trace is written as well-formed trace-event JSON
+with the spans of all threads merged in order of start time.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_trace.h>
+
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+class CStringOutputStream: public MOutputStream
+    {
+    public:
+    void Write(const uint8_t* aBuffer,size_t aBytes) override { iText.append((const char*)aBuffer,aBytes); }
+    std::string iText;
+    };
+
+size_t CountOf(const std::string& aText,const char* aPattern)
+    {
+    size_t n = 0;
+    for (size_t p = aText.find(aPattern); p != std::string::npos; p = aText.find(aPattern,p + 1))
+        n++;
+    return n;
+    }
+
+// Checks that brackets and braces outside strings are balanced, and that strings are terminated.
+bool IsBalanced(const std::string& aText)
+    {
+    std::string stack;
+    bool in_string = false;
+    for (size_t i = 0; i < aText.size(); i++)
+        {
+        char c = aText[i];
+        if (in_string)
+            {
+            if (c == '\\')
+                i++;
+            else if (c == '"')
+                in_string = false;
+            }
+        else if (c == '"')
+            in_string = true;
+        else if (c == '{' || c == '[')
+            stack += c;
+        else if (c == '}' || c == ']')
+            {
+            if (stack.empty() || stack.back() != (c == '}' ? '{' : '['))
+                return false;
+            stack.pop_back();
+            }
+        }
+    return !in_string && stack.empty();
+    }
+
+// Returns the values of the "ts" members in the order in which they appear.
+std::vector<double> StartTimes(const std::string& aText)
+    {
+    std::vector<double> t;
+    for (size_t p = aText.find("\"ts\":"); p != std::string::npos; p = aText.find("\"ts\":",p + 1))
+        t.push_back(strtod(aText.c_str() + p + 5,nullptr));
+    return t;
+    }
+
+void TestThreads()
+    {
+    const int KThreadCount = 8;
+    const int KSpanCount = 1000;
+    CTraceRecorder recorder;
+    std::vector<std::thread> thread_array;
+    for (int i = 0; i < KThreadCount; i++)
+        thread_array.emplace_back([&recorder,i]
+            {
+            for (int j = 0; j < KSpanCount; j++)
+                {
+                TTraceSpan span(&recorder,"span","test");
+                if (j == 0)
+                    span.SetArgs("thread \"" + std::to_string(i) + "\"");
+                }
+            });
+    for (auto& t : thread_array)
+        t.join();
+
+    UNIT_TEST_CHECK(recorder.EventCount() == KThreadCount * KSpanCount);
+    UNIT_TEST_CHECK(recorder.DroppedEventCount() == 0);
+
+    CStringOutputStream output;
+    recorder.WriteJson(output);
+    UNIT_TEST_CHECK(IsBalanced(output.iText));
+    UNIT_TEST_CHECK(CountOf(output.iText,"\"ph\":\"X\"") == KThreadCount * KSpanCount);
+    UNIT_TEST_CHECK(CountOf(output.iText,"\"thread_name\"") == KThreadCount);
+    UNIT_TEST_CHECK(CountOf(output.iText,"\\\"") == KThreadCount * 2);
+    auto start = StartTimes(output.iText);
+    bool sorted = true;
+    for (size_t i = 1; i < start.size(); i++)
+        if (start[i] < start[i - 1])
+            sorted = false;
+    UNIT_TEST_CHECK(sorted);
+
+    recorder.Clear();
+    UNIT_TEST_CHECK(recorder.EventCount() == 0);
+    CStringOutputStream empty_output;
+    recorder.WriteJson(empty_output);
+    UNIT_TEST_CHECK(IsBalanced(empty_output.iText));
+    UNIT_TEST_CHECK(CountOf(empty_output.iText,"\"ph\":\"X\"") == 0);
+    }
+
+void TestLimit()
+    {
+    CTraceRecorder recorder(100);
+    std::vector<std::thread> thread_array;
+    for (int i = 0; i < 4; i++)
+        thread_array.emplace_back([&recorder]
+            {
+            for (int j = 0; j < 100; j++)
+                recorder.AddSpan("span","test",j,j + 1);
+            });
+    for (auto& t : thread_array)
+        t.join();
+    UNIT_TEST_CHECK(recorder.EventCount() == 100);
+    UNIT_TEST_CHECK(recorder.DroppedEventCount() == 300);
+
+    recorder.Enable(false);
+    recorder.AddSpan("span","test",0,1);
+    UNIT_TEST_CHECK(recorder.DroppedEventCount() == 300);
+    }
+
+// A new recorder must not pick up a thread's cached buffer from a destroyed recorder, even at the same address.
+void TestRecorderLifetime()
+    {
+    for (int i = 0; i < 3; i++)
+        {
+        CTraceRecorder recorder;
+        recorder.AddSpan("span","test",0,1);
+        CStringOutputStream output;
+        recorder.WriteJson(output);
+        UNIT_TEST_CHECK(CountOf(output.iText,"\"ph\":\"X\"") == 1);
+        }
+    }
+
+} // namespace
+
+int main()
+    {
+    TestThreads();
+    TestLimit();
+    TestRecorderLifetime();
+    return UnitTest::Result("trace_test");
+    }
@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Unit test for CTraceRecorder
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = trace_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += trace_test.cpp
+
+HEADERS += unit_test_util.h
@@ -0,0 +1,47 @@
+/*
+unit_test_util.h
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+A minimal checking macro and result reporting shared by the CartoType unit tests.
+Each test is a console program which returns zero if all its checks pass.
+*/
+
+#ifndef CARTOTYPE_UNIT_TEST_UTIL_H__
+#define CARTOTYPE_UNIT_TEST_UTIL_H__
+
+#include <cstdio>
+
+namespace UnitTest
+{
+
+/** Returns a reference to the number of failed checks. */
+inline int& FailureCount()
+    {
+    static int count = 0;
+    return count;
+    }
+
+/** Records a failed check. */
+inline void Fail(const char* aFile,int aLine,const char* aCondition)
+    {
+    fprintf(stderr,"%s(%d): check failed: %s\n",aFile,aLine,aCondition);
+    FailureCount()++;
+    }
+
+/** Prints a summary and returns the exit code for the test program. */
+inline int Result(const char* aTestName)
+    {
+    if (FailureCount())
+        printf("%s: %d check(s) failed\n",aTestName,FailureCount());
+    else
+        printf("%s: passed\n",aTestName);
+    return FailureCount() ? 1 : 0;
+    }
+
+} // namespace UnitTest
+
+/** Checks a condition, reporting the file and line if it is false. */
+#define UNIT_TEST_CHECK(aCondition) ((aCondition) ? (void)0 : UnitTest::Fail(__FILE__,__LINE__,#aCondition))
+
+#endif // CARTOTYPE_UNIT_TEST_UTIL_H__
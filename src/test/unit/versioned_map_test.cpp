@@ -0,0 +1,178 @@
+/*
+versioned_map_test.cpp
+Copyright (C) 2022 CartoType Ltd.
+See www.cartotype.com for more information.
+
+Tests CVersionedMap: a snapshot is unchanged by later transactions, changes are invisible
+until they are committed, an abandoned transaction leaves the map unchanged and releases
+the writer lock, and readers running alongside a writer always see a consistent version.
+*/
+
+#include "unit_test_util.h"
+
+#include <cartotype_versioned_map.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace CartoType;
+
+namespace
+{
+
+using CMap = CVersionedMap<std::string>;
+
+std::shared_ptr<const std::string> Value(const std::string& aText)
+    {
+    return std::make_shared<const std::string>(aText);
+    }
+
+std::string Text(const CMap::TValue& aValue)
+    {
+    return aValue ? *aValue : std::string();
+    }
+
+void TestSnapshotIsolation()
+    {
+    CMap map;
+    UNIT_TEST_CHECK(map.Snapshot()->Number() == 0);
+    UNIT_TEST_CHECK(map.Snapshot()->Count() == 0);
+
+    auto transaction = map.BeginTransaction();
+    for (uint64_t id = 1; id <= 100; id++)
+        UNIT_TEST_CHECK(transaction->Insert(id,Value("a" + std::to_string(id))) == KErrorNone);
+    UNIT_TEST_CHECK(transaction->Insert(101,nullptr) == KErrorInvalidArgument);
+    transaction->Commit();
+    auto first = map.Snapshot();
+    UNIT_TEST_CHECK(first->Number() == 1);
+    UNIT_TEST_CHECK(first->Count() == 100);
+
+    // Replace, remove and insert, including an id large enough to add levels to the tree.
+    const uint64_t big_id = uint64_t(1) << 40;
+    transaction = map.BeginTransaction();
+    UNIT_TEST_CHECK(transaction->Insert(5,Value("b5")) == KErrorNone);
+    UNIT_TEST_CHECK(transaction->Remove(6));
+    UNIT_TEST_CHECK(!transaction->Remove(1000));
+    UNIT_TEST_CHECK(transaction->Insert(big_id,Value("big")) == KErrorNone);
+    UNIT_TEST_CHECK(Text(transaction->Find(5)) == "b5");
+    UNIT_TEST_CHECK(transaction->Count() == 100);
+
+    // Uncommitted changes are not visible.
+    UNIT_TEST_CHECK(map.Snapshot() == first);
+    UNIT_TEST_CHECK(Text(map.Snapshot()->Find(5)) == "a5");
+
+    transaction->Commit();
+    UNIT_TEST_CHECK(!transaction->Find(5));
+    UNIT_TEST_CHECK(transaction->Count() == 0);
+    UNIT_TEST_CHECK(transaction->Insert(7,Value("x")) == KErrorNotFound);
+    auto second = map.Snapshot();
+    UNIT_TEST_CHECK(second->Number() == 2);
+    UNIT_TEST_CHECK(second->Count() == 100);
+    UNIT_TEST_CHECK(Text(second->Find(5)) == "b5");
+    UNIT_TEST_CHECK(!second->Find(6));
+    UNIT_TEST_CHECK(Text(second->Find(big_id)) == "big");
+    UNIT_TEST_CHECK(Text(second->Find(7)) == "a7");
+
+    // The first snapshot is unchanged.
+    UNIT_TEST_CHECK(first->Count() == 100);
+    UNIT_TEST_CHECK(Text(first->Find(5)) == "a5");
+    UNIT_TEST_CHECK(Text(first->Find(6)) == "a6");
+    UNIT_TEST_CHECK(!first->Find(big_id));
+    size_t count = 0;
+    uint64_t last_id = 0;
+    bool ascending = true;
+    first->ForEach(0,UINT64_MAX,[&](uint64_t aId,const CMap::TValue& aValue)
+        {
+        ascending = ascending && aId > last_id && Text(aValue) == "a" + std::to_string(aId);
+        last_id = aId;
+        count++;
+        });
+    UNIT_TEST_CHECK(ascending);
+    UNIT_TEST_CHECK(count == 100);
+    count = 0;
+    second->ForEach(50,60,[&count](uint64_t,const CMap::TValue&) { count++; });
+    UNIT_TEST_CHECK(count == 11);
+    }
+
+void TestAbandonedTransaction()
+    {
+    CMap map;
+    auto transaction = map.BeginTransaction();
+    transaction->Insert(1,Value("one"));
+    transaction->Commit();
+    auto before = map.Snapshot();
+
+    transaction = map.BeginTransaction();
+    transaction->Insert(1,Value("changed"));
+    transaction->Insert(2,Value("two"));
+    transaction->Remove(1);
+    transaction.reset();
+    UNIT_TEST_CHECK(map.Snapshot() == before);
+    UNIT_TEST_CHECK(Text(map.Snapshot()->Find(1)) == "one");
+    UNIT_TEST_CHECK(!map.Snapshot()->Find(2));
+
+    // The writer lock has been released, so a new transaction can start on this thread.
+    transaction = map.BeginTransaction();
+    transaction->Insert(3,Value("three"));
+    transaction->Commit();
+    UNIT_TEST_CHECK(map.Snapshot()->Number() == 2);
+    UNIT_TEST_CHECK(map.Snapshot()->Count() == 2);
+    UNIT_TEST_CHECK(Text(map.Snapshot()->Find(1)) == "one");
+    }
+
+// Each version written has every object set to the version number, so a reader seeing mixed values has seen a torn update.
+void TestConcurrentReaders()
+    {
+    const uint64_t object_count = 500;
+    const int version_count = 200;
+    CMap map;
+    std::atomic<bool> done { false };
+    std::atomic<int> failures { 0 };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++)
+        readers.emplace_back([&]()
+            {
+            while (!done)
+                {
+                auto snapshot = map.Snapshot();
+                if (snapshot->Number() == 0)
+                    continue;
+                std::string expected = std::to_string(snapshot->Number());
+                size_t count = 0;
+                snapshot->ForEach(0,UINT64_MAX,[&](uint64_t,const CMap::TValue& aValue)
+                    {
+                    if (*aValue != expected)
+                        failures++;
+                    count++;
+                    });
+                if (count != object_count)
+                    failures++;
+                }
+            });
+
+    for (int v = 1; v <= version_count; v++)
+        {
+        auto transaction = map.BeginTransaction();
+        auto value = Value(std::to_string(v));
+        for (uint64_t id = 0; id < object_count; id++)
+            transaction->Insert(id * 37,value);
+        transaction->Commit();
+        }
+    done = true;
+    for (auto& t : readers)
+        t.join();
+    UNIT_TEST_CHECK(failures == 0);
+    UNIT_TEST_CHECK(map.Snapshot()->Number() == uint64_t(version_count));
+    }
+
+} // namespace
+
+int main()
+    {
+    TestSnapshotIsolation();
+    TestAbandonedTransaction();
+    TestConcurrentReaders();
+    return UnitTest::Result("versioned_map_test");
+    }
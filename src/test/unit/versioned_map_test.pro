@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Unit test for CVersionedMap
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = versioned_map_test
+
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../../main/base
+
+SOURCES += versioned_map_test.cpp
+
+HEADERS += unit_test_util.h